@@ -2,19 +2,258 @@
 #define _SECMALLOC_H
 
 #include <stddef.h>  // Inclut les définitions de types standard comme size_t
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* En C++, même spécification d'exception que la libc : sinon ces déclarations et celles de <cstdlib> se contredisent */
+#ifdef __cplusplus
+    #define MSM_NOEXCEPT noexcept
+#else
+    #define MSM_NOEXCEPT
+#endif
 
 // Déclaration des fonctions d'allocateur personnalisées
 
 // Fonction pour allouer de la mémoire
-void *malloc(size_t size);
+void *malloc(size_t size) MSM_NOEXCEPT;
 
 // Fonction pour libérer de la mémoire
-void free(void *ptr);
+void free(void *ptr) MSM_NOEXCEPT;
+
+// Fonction pour libérer de la mémoire dont la taille est connue (C23)
+void free_sized(void *ptr, size_t size) MSM_NOEXCEPT;
+
+// Fonction pour libérer de la mémoire alignée dont la taille est connue (C23)
+void free_aligned_sized(void *ptr, size_t alignment, size_t size) MSM_NOEXCEPT;
 
 // Fonction pour allouer et initialiser de la mémoire
-void *calloc(size_t nmemb, size_t size);
+void *calloc(size_t nmemb, size_t size) MSM_NOEXCEPT;
 
 // Fonction pour redimensionner un bloc de mémoire alloué
-void *realloc(void *ptr, size_t size);
+void *realloc(void *ptr, size_t size) MSM_NOEXCEPT;
+
+// Fonction pour allouer de la mémoire alignée
+void *aligned_alloc(size_t alignment, size_t size) MSM_NOEXCEPT;
+
+// Fonction pour allouer de la mémoire alignée (version POSIX)
+int posix_memalign(void **memptr, size_t alignment, size_t size) MSM_NOEXCEPT;
+
+// Fonction pour allouer n chunks de même taille en une fois (retourne le nombre de chunks alloués)
+size_t msm_malloc_batch(size_t size, size_t n, void **out);
+
+// Fonction pour libérer n chunks en une fois
+void msm_free_batch(void **ptrs, size_t n);
+
+// Statistiques des arènes liées à un nœud NUMA
+typedef struct msm_node_stats
+{
+    size_t arenas;              // arènes créées pour ce nœud
+    size_t data_bytes;          // taille totale de leurs data_pool
+    size_t used_bytes;          // octets de data_pool déjà distribués
+    size_t allocated_chunks;    // chunks occupés dans data_pool
+    size_t mapped_chunks;       // gros blocs mappés à part
+    size_t mapped_bytes;        // taille totale des mappings des gros blocs
+} msm_node_stats;
+
+// Fonction pour connaître le nombre de nœuds NUMA vus par l'allocateur
+size_t msm_numa_nodes(void);
+
+// Fonction pour lire les statistiques d'un nœud NUMA (retourne -1 si le nœud n'existe pas)
+int msm_numa_node_stats(size_t node, msm_node_stats *stats);
+
+// Fonction pour rendre au noyau les pages libérées depuis plus longtemps que ne le permet decay_ms (MSM_CONF)
+void msm_decay(void);
+
+// Réservation : les pools de l'arène du thread sont agrandis d'avance, leurs pages fautées au démarrage plutôt qu'au premier chunk
+#define MSM_RESERVE_WILLNEED 1      // pages annoncées au noyau (MADV_WILLNEED)
+#define MSM_RESERVE_POPULATE 2      // pages fautées tout de suite (MADV_POPULATE_WRITE)
+
+// Fonction pour préparer bytes octets de chunks dans l'arène du thread (retourne -1 si son tas ne peut pas grandir)
+int msm_reserve(size_t bytes, unsigned flags);
+
+// Fonction pour lire (oldp, *oldlenp) et/ou changer (newp, newlen) un réglage, une statistique ou déclencher une action
+// par son nom : "opt.decay_ms", "arena.0.purge", "stats.arenas.0.mapped", "epoch", "heap.check"...
+// (retourne 0, ou ENOENT, EINVAL, EPERM, EIO)
+int msm_ctl(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen);
+
+// Histogrammes de latence (latency:1 dans MSM_CONF ou msm_ctl "opt.latency") : cycles (rdtsc) de chaque opération,
+// par thread puis fusionnés, selon le chemin pris. Aussi lisibles par msm_ctl "stats.latency.<op>.<chemin>.<p99|...>"
+#define MSM_OP_MALLOC 0             // malloc, aligned_alloc et posix_memalign
+#define MSM_OP_CALLOC 1
+#define MSM_OP_FREE 2               // free, free_sized et free_aligned_sized
+#define MSM_OP_REALLOC 3
+#define MSM_OPS 4
+
+#define MSM_PATH_REUSE 0            // chunk libre réutilisé en entier
+#define MSM_PATH_SPLIT 1            // chunk libre découpé
+#define MSM_PATH_TOP 2              // chunk découpé au sommet de data_pool
+#define MSM_PATH_GROW 3             // data_pool agrandi avant de découper
+#define MSM_PATH_MAPPED 4           // gros bloc : son propre mapping (allocation, munmap ou mremap)
+#define MSM_PATH_SAMPLED 5          // chunk du pool gardé
+#define MSM_PATH_RELEASE 6          // free : chunk rendu aux chunks libres (ou en quarantaine)
+#define MSM_PATH_INPLACE 7          // realloc sans déplacement
+#define MSM_PATH_MOVED 8            // realloc avec déplacement (le malloc et le free sont aussi comptés à part)
+#define MSM_PATHS 9
+
+// Histogramme log-linéaire (8 tranches par puissance de 2, 12,5 % d'erreur au plus) jusqu'à 2^40 cycles
+#define MSM_LATENCY_BUCKETS 304
+typedef struct msm_latency_hist
+{
+    uint64_t count;             // opérations mesurées
+    uint64_t total;             // somme de leurs cycles
+    uint64_t max;               // la plus lente
+    uint64_t buckets[MSM_LATENCY_BUCKETS];
+} msm_latency_hist;
+
+// Fonction pour lire l'histogramme d'une opération et d'un chemin, fusionné sur tous les threads (retourne -1 si invalide)
+int msm_latency_get(unsigned op, unsigned path, msm_latency_hist *out);
+
+// Fonction pour ajouter un histogramme à un autre (threads, chemins ou processus différents)
+void msm_latency_merge(msm_latency_hist *into, const msm_latency_hist *from);
+
+// Fonction pour lire un quantile (0.999 pour le p999) en cycles : la borne haute de sa tranche
+uint64_t msm_latency_quantile(const msm_latency_hist *hist, double quantile);
+
+// Fonction pour écrire un instantané des metadata du tas dans path (retourne 0, ou -1 en cas d'erreur)
+int msm_dump_heap(const char *path);
+
+// Tas privé, indépendant de malloc/free : ses propres pools, son secret de canary et ses statistiques
+typedef struct topchunk msm_heap_t;
+
+// Statistiques d'un tas privé
+typedef struct msm_heap_stats
+{
+    size_t data_bytes;          // taille de son data_pool
+    size_t used_bytes;          // octets de data_pool déjà distribués
+    size_t metadata_bytes;      // taille de son topchunk_pool (metadata comprises)
+    size_t allocated_chunks;    // chunks occupés dans data_pool
+    size_t free_chunks;         // chunks libres en attente de réutilisation
+    size_t mapped_chunks;       // gros blocs mappés à part
+    size_t mapped_bytes;        // taille totale des mappings des gros blocs
+} msm_heap_stats;
+
+// Fonction pour créer un tas privé
+msm_heap_t *msm_heap_create(void);
+
+// Fonction pour allouer de la mémoire dans un tas privé
+void *msm_heap_malloc(msm_heap_t *heap, size_t size);
+
+// Fonction pour allouer de la mémoire alignée dans un tas privé
+void *msm_heap_aligned_alloc(msm_heap_t *heap, size_t alignment, size_t size);
+
+// Fonction pour libérer de la mémoire d'un tas privé
+void msm_heap_free(msm_heap_t *heap, void *ptr);
+
+// Fonction pour redimensionner un bloc d'un tas privé
+void *msm_heap_realloc(msm_heap_t *heap, void *ptr, size_t size);
+
+// Fonction pour détruire un tas privé et rendre d'un coup toute sa mémoire (ses chunks encore occupés compris).
+// Aucun autre thread ne doit s'en servir pendant ni après : le détruire alors qu'il est encore utilisé est indéfini
+void msm_heap_destroy(msm_heap_t *heap);
+
+// Fonction pour lire les statistiques d'un tas privé (retourne -1 si heap ou stats est NULL)
+int msm_heap_get_stats(msm_heap_t *heap, msm_heap_stats *stats);
+
+// Tas persistant : un tas privé dont topchunk_pool, meta_pool et data_pool sont un fichier mappé (MAP_SHARED),
+// toujours à la même adresse : ses chunks et leurs pointeurs survivent au processus. Même API que les tas privés.
+#define MSM_HEAP_CREATED 0          // fichier vide : nouveau tas
+#define MSM_HEAP_REOPENED 1         // fermé proprement par msm_heap_close : repris tel quel
+#define MSM_HEAP_RECOVERED 2        // pas fermé (arrêt brutal) : listes reconstruites depuis les metadata
+
+// Fonction pour ouvrir un tas persistant, ou le créer avec size octets de data si le fichier est vide
+// (state reçoit MSM_HEAP_*, retourne NULL si le fichier est invalide, verrouillé ou si son adresse est prise)
+msm_heap_t *msm_heap_open(const char *path, size_t size, int *state);
+
+// Fonction pour fermer proprement un tas persistant : tout est écrit dans le fichier (retourne -1 en cas d'erreur)
+int msm_heap_close(msm_heap_t *heap);
+
+// Fonction pour lire le pointeur racine d'un tas persistant : d'où le programme retrouve ses objets à la réouverture
+void *msm_heap_root(msm_heap_t *heap);
+
+// Fonction pour changer le pointeur racine d'un tas persistant (retourne -1 si heap n'est pas persistant)
+int msm_heap_set_root(msm_heap_t *heap, void *root);
+
+// Tas partagé : un tas privé dans un memfd, mappé à la même adresse par chaque processus qui l'attache.
+// Chaque msm_heap_* prend un mutex robuste entre processus ; les chunks s'échangent par handle (offset dans le segment).
+#define MSM_SHM_NULL 0
+
+// Fonction pour créer un tas partagé avec size octets de data (retourne NULL en cas d'erreur)
+msm_heap_t *msm_shm_create(const char *name, size_t size);
+
+// Fonction pour obtenir le descripteur du memfd d'un tas partagé, à transmettre à un autre processus (retourne -1 sinon)
+int msm_shm_fd(msm_heap_t *heap);
+
+// Fonction pour attacher un tas partagé reçu par son descripteur (fd reste à l'appelant ; retourne NULL si invalide)
+msm_heap_t *msm_shm_attach(int fd);
+
+// Fonction pour détacher un tas partagé de ce processus : ses chunks restent aux autres processus
+int msm_shm_detach(msm_heap_t *heap);
+
+// Fonction pour convertir un chunk du tas partagé en handle (retourne MSM_SHM_NULL si ptr n'en fait pas partie)
+uint64_t msm_shm_handle(msm_heap_t *heap, const void *ptr);
+
+// Fonction pour convertir un handle en pointeur dans ce processus (retourne NULL si le handle sort du tas)
+void *msm_shm_pointer(msm_heap_t *heap, uint64_t handle);
+
+// Partitions : chaque famille d'objets a son propre tas, un débordement ne peut pas atteindre une autre famille
+#define MSM_PARTITION_DEFAULT 0     // le tas de malloc
+#define MSM_PARTITION_OBJECT 1      // objets polymorphes (avec un vptr)
+#define MSM_PARTITION_BUFFER 2      // tampons de données brutes
+#define MSM_PARTITION_STRING 3      // chaînes de caractères
+#define MSM_PARTITION_SHORT 4       // chunks à courte durée de vie : vidée et rendue au noyau à son dernier free
+#define MSM_PARTITION_LONG 5        // chunks à longue durée de vie
+#define MSM_PARTITION_COLD 6        // chunks rarement lus
+#define MSM_PARTITIONS 7
+
+// Fonction pour allouer de la mémoire dans une partition (libérée par free, retourne NULL si id n'existe pas)
+void *msm_malloc_partition(size_t size, unsigned id);
+
+// Indications de durée de vie et d'accès : les chunks éphémères ne partagent plus leurs pages avec ceux qui restent
+#define MSM_HINT_SHORT 1            // libéré bientôt : MSM_PARTITION_SHORT
+#define MSM_HINT_LONG 2             // gardé longtemps : MSM_PARTITION_LONG (MSM_PARTITION_COLD s'il est aussi froid)
+#define MSM_HINT_HOT 4              // souvent lu : avec les chunks de malloc
+#define MSM_HINT_COLD 8             // rarement lu : MSM_PARTITION_COLD
+
+// Fonction pour allouer de la mémoire dans la région de ses indications (libérée par free ;
+// retourne NULL si les indications se contredisent : SHORT et LONG, ou HOT et COLD)
+void *msm_malloc_hinted(size_t size, unsigned hints);
+
+// Arène à pointeur : allocation en avançant un curseur dans des blocs pris au tas, sans free individuel
+typedef struct msm_bump_arena msm_arena_t;
+
+// Position dans une arène à pointeur, pour y revenir avec msm_arena_rewind
+typedef struct msm_arena_mark
+{
+    void *block;
+    void *cursor;
+} msm_arena_mark_t;
+
+// Option de msm_arena_create : un canary à la fin de chaque bloc, vérifié au rewind, au reset et à la destruction
+#define MSM_ARENA_CANARY 1
+
+// Fonction pour créer une arène à pointeur (block_size 0 : 64 Ko par bloc)
+msm_arena_t *msm_arena_create(size_t block_size, unsigned flags);
+
+// Fonction pour allouer size octets alignés sur align (puissance de 2, 0 : alignement par défaut)
+void *msm_arena_alloc(msm_arena_t *arena, size_t size, size_t align);
+
+// Fonction pour retenir la position courante d'une arène
+msm_arena_mark_t msm_arena_mark(msm_arena_t *arena);
+
+// Fonction pour abandonner tout ce qui a été alloué depuis mark
+void msm_arena_rewind(msm_arena_t *arena, msm_arena_mark_t mark);
+
+// Fonction pour abandonner tout ce qui a été alloué dans l'arène (ses blocs sont gardés)
+void msm_arena_reset(msm_arena_t *arena);
+
+// Fonction pour détruire une arène et rendre ses blocs au tas
+void msm_arena_destroy(msm_arena_t *arena);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
\ No newline at end of file
@@ -2,9 +2,37 @@
 #define _SECMALLOC_PRIVATE_H
 
 #include "my_secmalloc.h"
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Directives de préprocesseur pour l'alignement sur 8 octets / 4 octets selon l'architecture */
+#if defined(__x86_64__) || defined(_M_X64) || defined(__aarch64__) || defined(__ppc64__)
+    #define ALIGNMENT 8
+#elif defined(__i386__) || defined(_M_IX86) || defined(__arm__) || defined(__PPC__)
+    #define ALIGNMENT 4
+#else
+    #define ALIGNMENT 8
+#endif
+
+/* Niveau de durcissement choisi à la compilation (make hardening0 ... hardening3, 3 par défaut) :
+   0 : ni canary ni message, le chemin le plus court
+   1 : canary tirés du secret, vérifiés au free
+   2 : + quarantaine des chunks libérés (quarantine dans MSM_CONF)
+   3 : + allocations échantillonnées dans le pool gardé (sample_rate dans MSM_CONF) */
+#ifndef MSM_HARDENING
+    #define MSM_HARDENING 3
+#endif
+
+#define MY_PAGE_SIZE (size_t)4096
 
 #define MY_IS_FREE (size_t)0
 #define MY_IS_BUSY (size_t)1
+#define MY_IS_MAPPED (size_t)2   // chunk servi par son propre mapping (gros bloc)
+#define MY_IS_UNUSED (size_t)3   // meta sans chunk, en attente de réutilisation
+#define MY_IS_QUARANTINED (size_t)4   // chunk libéré, pas encore réutilisable
 
 typedef struct metadata {
     size_t canary_chunk;           // canary qui compare celui du chunk [ A PLACER A LA FIN D'UN BLOC ]
@@ -15,8 +43,16 @@ typedef struct metadata {
     struct metadata *next;         // pointeur vers la metadata suivante qui est allouée
     struct metadata *next_waiting; // pointeur vers la metadata suivante qui est en attente de se lier
     size_t canary;                  // canary qui sera comparé à celui du top_chunk
+    size_t zero;                    // chunk libre dont le contenu est connu à zéro (jamais écrit ou purgé)
 }metadata;
 
+/* Tas dont les pools sont un seul mapping MAP_SHARED (topchunk->persistent, 0 pour un tas ordinaire) */
+#define MY_HEAP_FILE (size_t)1     // fichier persistant (msm_heap_open)
+#define MY_HEAP_SHARED (size_t)2   // memfd partagé entre processus (msm_shm_create), protégé par un verrou inter-processus
+
+/* Nombre d'époques de la courbe de decay (chacune dure decay_ms / MSM_DECAY_EPOCHS) */
+#define MSM_DECAY_EPOCHS 16
+
 typedef struct topchunk
 {
     size_t canary;                    // canary qui compare les metadata (le même pour chacun des metadata)
@@ -26,16 +62,112 @@ typedef struct topchunk
     size_t current_size_data;           // taille courrante des data 
     size_t number_of_elements_allocated;  // nombre d'éléments alloués
     size_t number_of_elements_freed;       // nombre d'éléments libérés
-    metadata *free_metadata;             // liste des metadatas qui ont servi à free
+    metadata *free_metadata;             // liste des metadatas qui ont servi à free (petits chunks libres)
+    metadata *free_tree;                 // arbre des gros chunks libres, ordonné par (taille, adresse)
+    metadata *quarantine_head;           // chunks libérés en quarantaine, du plus ancien (liés par next_waiting)
+    metadata *quarantine_tail;           // dernier chunk mis en quarantaine
+    size_t quarantine_bytes;             // taille totale des chunks en quarantaine
     metadata *metadata_allocated;   // pointeur vers dernier metadata alloué
+    metadata *mapped_allocated;     // liste des meta des gros blocs mappés à part (liés par next)
+    metadata *unused_metadata;      // liste des meta sans chunk, réutilisables (liés par next_waiting)
+    size_t number_of_elements_mapped;  // nombre de gros blocs mappés
+    size_t total_size_mapped;          // taille totale des mappings des gros blocs
+    void *data_pool;                   // data_pool de ce tas (une arène par nœud NUMA, chacune avec ses pools)
+    size_t node;                       // nœud NUMA préféré pour les pages de ce tas
+    size_t canary_secret[2];           // secret dont sont dérivés les canary de ce tas
+    size_t canary_counter;             // nombre de canary déjà tirés de ce secret
+    size_t decay_epoch;                // début de l'époque de decay en cours (ms, horloge monotone)
+    size_t decay_index;                // époque en cours dans decay_backlog
+    size_t decay_backlog[MSM_DECAY_EPOCHS]; // octets salis pendant chacune des dernières époques (anneau)
+    size_t persistent;                 // MY_HEAP_FILE ou MY_HEAP_SHARED : taille fixe, aucun gros bloc mappé à part
+    pthread_mutex_t lock;              // verrou du tas entre les threads (un tas partagé prend celui de son segment)
 }topchunk;
 
-extern metadata *meta_pool;
-extern topchunk *topchunk_pool;
+/* Nombre maximal d'arènes (narenas) */
+#define MSM_MAX_ARENAS 64
+
+/* Réglages de l'allocateur, lus une seule fois dans MSM_CONF="clé:valeur,..." avant la création des pools */
+typedef struct msm_conf
+{
+    size_t data_pool_size;      // taille initiale de data_pool
+    size_t meta_pool_size;      // taille initiale de topchunk_pool / meta_pool
+    size_t growth;              // croissance minimale des pools, en pourcentage de leur taille (0 : au plus juste)
+    size_t hugepages;           // pools adossés à des huge pages de 2 Mo (MAP_HUGETLB, sinon THP)
+    size_t mapped_threshold;    // taille à partir de laquelle un bloc a son propre mapping
+    size_t alignment;           // alignement des chunks (puissance de 2, au moins sizeof(size_t))
+    size_t narenas;             // nombre d'arènes (0 : une par nœud NUMA)
+    size_t purge_threshold;     // pages entières à partir desquelles un chunk libéré est rendu au noyau
+    size_t decay_ms;            // délai avant de rendre au noyau les pages libérées (0 : tout de suite)
+    size_t quarantine;          // octets libérés gardés en quarantaine avant réutilisation
+    size_t hardening;           // niveau de durcissement à l'exécution (plafonné par MSM_HARDENING)
+    size_t meta_aslr;           // décalage aléatoire maximal de topchunk_pool, en pages
+    size_t data_aslr;           // décalage aléatoire maximal de data_pool, en pages
+    size_t dump_signal;         // signal qui déclenche msm_dump_heap() (0 : aucun)
+    size_t sample_rate;         // une allocation sur sample_rate en moyenne va dans le pool gardé (0 : jamais)
+    size_t guarded_slots;       // nombre de slots (une page de data + une page de garde) du pool gardé
+    size_t latency;             // histogrammes de latence par opération et par chemin (msm_latency_get)
+    size_t reserve;             // octets de chunks préparés dans chaque arène à sa création (msm_reserve)
+    size_t prefault;            // pages de reserve : 0 seulement réservées, 1 MADV_WILLNEED, 2 fautées d'avance
+    size_t mapped_cache;        // octets de mappings de gros blocs libérés gardés pour être réutilisés (0 : aucun)
+}msm_conf;
+
+extern msm_conf msm_config;
+extern size_t msm_conf_generation;
+
+/* Tas sélectionné par le thread : chaque thread travaille sur le sien, sous son verrou */
+extern __thread metadata *meta_pool;
+extern __thread topchunk *topchunk_pool;
+
+/* Descripteur des messages (MSM_OUTPUT), -1 sans journal */
+extern int report_file;
+void    logfile(const char *format, ...);
+size_t  get_random_canary(void);
+size_t  generate_random_value(size_t min, size_t max);
+
+void    msm_conf_init(void);
+size_t  msm_conf_parse(const char *conf);
+
+size_t  msm_arena_count(void);
+topchunk *msm_arena(size_t index);
+topchunk *msm_partition(size_t id);
+size_t  msm_heap_purge(topchunk *heap);
+size_t  msm_heap_drain_quarantine(topchunk *heap);
+size_t  msm_heap_check(topchunk *heap);
+int     msm_conf_set(const char *key, size_t value);
+void    msm_heap_format(topchunk *heap, size_t meta_pool_size, void *data_pool, size_t data_pool_size);
+size_t  msm_heap_reattach(topchunk *heap, int rebuild);
+void    msm_shm_lock(topchunk *heap);
+void    msm_shm_unlock(topchunk *heap);
+void    msm_heap_lock(topchunk *heap);
+void    msm_heap_unlock(topchunk *heap);
+
+void    msm_latency_record(unsigned op, unsigned path, uint64_t cycles);
+
+void    *msm_mapcache_take(size_t length, size_t node);
+int     msm_mapcache_put(void *mapping, size_t length, size_t node, size_t now);
+void    msm_mapcache_decay(size_t now);
+size_t  msm_mapcache_bytes(void);
+
+extern __thread size_t msm_sample_countdown;
+void    *msm_sampled_malloc(size_t size);
+int     msm_guarded_owns(void *ptr);
+size_t  msm_guarded_size(void *ptr);
+void    msm_guarded_free(void *ptr);
+
+size_t  msm_numa_node_count(void);
+size_t  msm_numa_current_node(void);
+void    msm_numa_bind(void *address, size_t length, size_t node);
 
 void    *my_malloc(size_t size);   
 void    my_free(void *ptr);        
 void    *my_calloc(size_t nmemb, size_t size); 
 void    *my_realloc(void *ptr, size_t size);  
+void    *my_aligned_alloc(size_t alignment, size_t size);
+void    my_free_sized(void *ptr, size_t size);
+void    my_free_aligned_sized(void *ptr, size_t alignment, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
\ No newline at end of file
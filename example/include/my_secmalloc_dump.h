@@ -0,0 +1,45 @@
+#ifndef _SECMALLOC_DUMP_H
+#define _SECMALLOC_DUMP_H
+
+#include <stdint.h>
+
+/* Format des instantanés écrits par msm_dump_heap() et lus par tools/msm_heap_analyze.
+   Seules les metadata sont copiées, jamais les data des chunks :
+       msm_dump_header
+       puis pour chaque arène : msm_dump_arena suivi de ses msm_dump_chunk
+   Tous les champs sont dans l'ordre des octets de la machine qui a écrit l'instantané. */
+
+#define MSM_DUMP_MAGIC "MSMHEAP"
+#define MSM_DUMP_VERSION 1
+
+typedef struct msm_dump_header
+{
+    char magic[8];              // MSM_DUMP_MAGIC, terminé par un 0
+    uint32_t version;           // MSM_DUMP_VERSION
+    uint32_t page_size;         // taille d'une page de l'allocateur
+    uint64_t alignment;         // alignement des chunks
+    uint64_t arenas;            // nombre de msm_dump_arena qui suivent
+} msm_dump_header;
+
+typedef struct msm_dump_arena
+{
+    uint64_t index;             // numéro de l'arène
+    uint64_t node;              // nœud NUMA préféré
+    uint64_t data_pool;         // adresse de data_pool : les offsets des chunks en partent
+    uint64_t total_size_data;   // taille de data_pool
+    uint64_t current_size_data; // octets de data_pool déjà distribués (au-delà : jamais touché)
+    uint64_t chunks;            // nombre de msm_dump_chunk qui suivent
+} msm_dump_arena;
+
+typedef struct msm_dump_chunk
+{
+    uint64_t offset;            // offset dans data_pool, ou adresse d'un gros bloc mappé à part
+    uint64_t size;              // taille du chunk (canary compris pour un chunk libre)
+    uint8_t state;              // MY_IS_FREE, MY_IS_BUSY, MY_IS_MAPPED ou MY_IS_QUARANTINED
+    uint8_t zero;               // chunk libre connu à zéro (rien à purger)
+    uint8_t size_class;         // log2 de la taille
+    uint8_t reserved;
+    uint32_t arena;             // numéro de l'arène
+} msm_dump_chunk;
+
+#endif
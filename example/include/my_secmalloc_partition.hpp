@@ -0,0 +1,104 @@
+#ifndef _SECMALLOC_PARTITION_HPP
+#define _SECMALLOC_PARTITION_HPP
+
+/* operator new par type : les objets polymorphes, les tampons et les chaînes vont chacun dans leur partition.
+   Un débordement d'un tampon ne peut plus écraser le vptr de l'objet voisin : ils ne sont plus dans le même tas.
+   À lier avec libmy_secmalloc.so (make dynamic) : delete passe par free, qui retrouve la partition du chunk.
+
+       class File : public IFile, public msm::partitioned<File> { ... };   // new File -> MSM_PARTITION_OBJECT
+       msm::string name;                                                  // caractères -> MSM_PARTITION_STRING
+       std::vector<char, msm::partition_allocator<char>> data;            // tampon -> MSM_PARTITION_BUFFER */
+
+#include "my_secmalloc.h"
+#include <cstddef>
+#include <new>
+#include <string>
+#include <type_traits>
+
+namespace msm {
+
+/* Partition d'un type : polymorphe (vptr), caractère (chaînes), trivialement copiable (tampon), sinon le tas de malloc */
+template<typename T>
+constexpr unsigned partition_for()
+{
+    if constexpr(std::is_polymorphic_v<T>)
+        return MSM_PARTITION_OBJECT;
+    else if constexpr(std::is_same_v<T, char> || std::is_same_v<T, wchar_t> || std::is_same_v<T, char16_t> || std::is_same_v<T, char32_t>)
+        return MSM_PARTITION_STRING;
+    else if constexpr(std::is_trivially_copyable_v<T>)
+        return MSM_PARTITION_BUFFER;
+    else
+        return MSM_PARTITION_DEFAULT;
+}
+
+inline void *partition_allocate(std::size_t size, unsigned id)
+{
+    void *ptr = msm_malloc_partition(size, id);
+    if(ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+/* Base (CRTP) qui donne à Derived un operator new dans sa partition ; les classes dérivées en héritent */
+template<typename Derived, unsigned Partition = MSM_PARTITION_OBJECT>
+struct partitioned
+{
+    static void *operator new(std::size_t size)
+    {
+        /* Les partitions ne servent que l'alignement de malloc */
+        static_assert(alignof(Derived) <= sizeof(void*), "over-aligned types cannot be partitioned");
+        return partition_allocate(size, Partition);
+    }
+    static void *operator new[](std::size_t size) { return partition_allocate(size, Partition); }
+    static void operator delete(void *ptr) noexcept { free(ptr); }
+    static void operator delete[](void *ptr) noexcept { free(ptr); }
+    static void operator delete(void *ptr, std::size_t size) noexcept { free_sized(ptr, size); }
+};
+
+/* Allocateur STL dont tous les chunks vont dans la partition Partition (par défaut : celle de T) */
+template<typename T, unsigned Partition = partition_for<T>()>
+class partition_allocator
+{
+public:
+    using value_type = T;
+    using is_always_equal = std::true_type;
+
+    template<typename U>
+    struct rebind
+    {
+        using other = partition_allocator<U, Partition>;
+    };
+
+    partition_allocator() noexcept = default;
+    template<typename U>
+    partition_allocator(const partition_allocator<U, Partition> &) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+        if(n > static_cast<std::size_t>(-1) / sizeof(T)) throw std::bad_array_new_length();
+        return static_cast<T*>(partition_allocate(n * sizeof(T), Partition));
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept
+    {
+        free_sized(ptr, n * sizeof(T));
+    }
+};
+
+template<typename T, typename U, unsigned Partition>
+bool operator==(const partition_allocator<T, Partition> &, const partition_allocator<U, Partition> &) noexcept
+{
+    return true;
+}
+
+template<typename T, typename U, unsigned Partition>
+bool operator!=(const partition_allocator<T, Partition> &, const partition_allocator<U, Partition> &) noexcept
+{
+    return false;
+}
+
+/* Chaîne dont les caractères sont dans la partition des chaînes */
+using string = std::basic_string<char, std::char_traits<char>, partition_allocator<char, MSM_PARTITION_STRING>>;
+
+}
+
+#endif
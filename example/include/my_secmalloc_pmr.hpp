@@ -0,0 +1,237 @@
+#ifndef _SECMALLOC_PMR_HPP
+#define _SECMALLOC_PMR_HPP
+
+/* Couche C++17 (uniquement des en-têtes) : conteneurs std::pmr et allocateurs STL servis par les tas privés,
+   les arènes à pointeur et le tas principal, sans passer par operator new.
+   À lier avec libmy_secmalloc.so (make dynamic). */
+
+#include "my_secmalloc.h"
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+namespace msm {
+
+/* Alignement toujours garanti par le tas (ALIGNMENT, la taille d'un pointeur) : au-delà, il faut une allocation alignée */
+constexpr std::size_t default_alignment = sizeof(void*);
+
+/* memory_resource sur un tas privé. Créé avec son propre tas (détruit avec la ressource),
+   ou posé sur un tas existant sans en prendre possession. Deux ressources sont égales si elles servent le même tas :
+   ce qui est alloué par l'une peut être rendu à l'autre, y compris après un déplacement. */
+class heap_resource : public std::pmr::memory_resource
+{
+public:
+    heap_resource() : heap_(msm_heap_create()), owned_(true)
+    {
+        if(heap_ == nullptr) throw std::bad_alloc();
+    }
+
+    explicit heap_resource(msm_heap_t *heap) noexcept : heap_(heap), owned_(false) {}
+
+    heap_resource(const heap_resource &) = delete;
+    heap_resource &operator=(const heap_resource &) = delete;
+
+    heap_resource(heap_resource &&other) noexcept : heap_(std::exchange(other.heap_, nullptr)), owned_(std::exchange(other.owned_, false)) {}
+
+    heap_resource &operator=(heap_resource &&other) noexcept
+    {
+        if(this != &other)
+        {
+            release();
+            heap_ = std::exchange(other.heap_, nullptr);
+            owned_ = std::exchange(other.owned_, false);
+        }
+        return *this;
+    }
+
+    ~heap_resource() override { release(); }
+
+    msm_heap_t *heap() const noexcept { return heap_; }
+
+    msm_heap_stats stats() const noexcept
+    {
+        msm_heap_stats result{};
+        msm_heap_get_stats(heap_, &result);
+        return result;
+    }
+
+private:
+    void release() noexcept
+    {
+        if(owned_) msm_heap_destroy(heap_);
+        heap_ = nullptr;
+        owned_ = false;
+    }
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        void *ptr = (alignment <= default_alignment) ? msm_heap_malloc(heap_, bytes) : msm_heap_aligned_alloc(heap_, alignment, bytes);
+        if(ptr == nullptr) throw std::bad_alloc();
+        return ptr;
+    }
+
+    void do_deallocate(void *ptr, std::size_t, std::size_t) override
+    {
+        msm_heap_free(heap_, ptr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        if(this == &other) return true;
+        const heap_resource *resource = dynamic_cast<const heap_resource*>(&other);
+        return resource != nullptr && heap_ != nullptr && resource->heap_ == heap_;
+    }
+
+    msm_heap_t *heap_;
+    bool owned_;
+};
+
+/* Ressource monotone sur une arène à pointeur : deallocate ne fait rien, release() rend tout d'un coup
+   (les blocs de l'arène sont gardés pour resservir). Seule une ressource est égale à elle-même,
+   sauf celle qui a reçu l'arène d'une autre par déplacement. */
+class monotonic_resource : public std::pmr::memory_resource
+{
+public:
+    explicit monotonic_resource(std::size_t block_size = 0, unsigned flags = MSM_ARENA_CANARY)
+        : arena_(msm_arena_create(block_size, flags))
+    {
+        if(arena_ == nullptr) throw std::bad_alloc();
+    }
+
+    monotonic_resource(const monotonic_resource &) = delete;
+    monotonic_resource &operator=(const monotonic_resource &) = delete;
+
+    monotonic_resource(monotonic_resource &&other) noexcept : arena_(std::exchange(other.arena_, nullptr)) {}
+
+    monotonic_resource &operator=(monotonic_resource &&other) noexcept
+    {
+        if(this != &other)
+        {
+            msm_arena_destroy(arena_);
+            arena_ = std::exchange(other.arena_, nullptr);
+        }
+        return *this;
+    }
+
+    ~monotonic_resource() override { msm_arena_destroy(arena_); }
+
+    msm_arena_t *arena() const noexcept { return arena_; }
+
+    void release() noexcept { msm_arena_reset(arena_); }
+
+    msm_arena_mark_t mark() const noexcept { return msm_arena_mark(arena_); }
+
+    void rewind(msm_arena_mark_t mark) noexcept { msm_arena_rewind(arena_, mark); }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        void *ptr = msm_arena_alloc(arena_, bytes, alignment);
+        if(ptr == nullptr) throw std::bad_alloc();
+        return ptr;
+    }
+
+    void do_deallocate(void *, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        if(this == &other) return true;
+        const monotonic_resource *resource = dynamic_cast<const monotonic_resource*>(&other);
+        return resource != nullptr && arena_ != nullptr && resource->arena_ == arena_;
+    }
+
+    msm_arena_t *arena_;
+};
+
+/* Ressource sur le tas principal (arène du thread) : les petits chunks sont repris dans ses listes de chunks libres,
+   et deallocate passe la taille connue du conteneur au free dimensionné. Toutes ces ressources sont égales. */
+class pool_resource : public std::pmr::memory_resource
+{
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        void *ptr = (alignment <= default_alignment) ? malloc(bytes) : aligned_alloc(alignment, bytes);
+        if(ptr == nullptr) throw std::bad_alloc();
+        return ptr;
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override
+    {
+        if(alignment <= default_alignment) free_sized(ptr, bytes);
+        else free_aligned_sized(ptr, alignment, bytes);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return dynamic_cast<const pool_resource*>(&other) != nullptr;
+    }
+};
+
+/* Ressource partagée sur le tas principal, comme std::pmr::new_delete_resource() */
+inline pool_resource *default_pool_resource() noexcept
+{
+    static pool_resource resource;
+    return &resource;
+}
+
+/* Allocateur compatible std::allocator : le tas principal (heap nul) ou un tas privé.
+   Il suit le conteneur quand celui-ci est déplacé ou échangé : un déplacement ne recopie jamais les éléments. */
+template<typename T>
+class allocator
+{
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    allocator() noexcept : heap_(nullptr) {}
+    explicit allocator(msm_heap_t *heap) noexcept : heap_(heap) {}
+    template<typename U>
+    allocator(const allocator<U> &other) noexcept : heap_(other.heap()) {}
+
+    T *allocate(std::size_t n)
+    {
+        if(n > static_cast<std::size_t>(-1) / sizeof(T)) throw std::bad_array_new_length();
+        std::size_t bytes = n * sizeof(T);
+        void *ptr;
+        if(heap_ == nullptr)
+            ptr = (alignof(T) <= default_alignment) ? malloc(bytes) : aligned_alloc(alignof(T), bytes);
+        else
+            ptr = (alignof(T) <= default_alignment) ? msm_heap_malloc(heap_, bytes) : msm_heap_aligned_alloc(heap_, alignof(T), bytes);
+        if(ptr == nullptr) throw std::bad_alloc();
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept
+    {
+        if(heap_ != nullptr)
+            msm_heap_free(heap_, ptr);
+        else if(alignof(T) <= default_alignment)
+            free_sized(ptr, n * sizeof(T));
+        else
+            free_aligned_sized(ptr, alignof(T), n * sizeof(T));
+    }
+
+    msm_heap_t *heap() const noexcept { return heap_; }
+
+private:
+    msm_heap_t *heap_;
+};
+
+template<typename T, typename U>
+bool operator==(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.heap() == b.heap();
+}
+
+template<typename T, typename U>
+bool operator!=(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.heap() != b.heap();
+}
+
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef _SECMALLOC_PROBES_H
+#define _SECMALLOC_PROBES_H
+
+/* Points de trace USDT (fournisseur my_secmalloc) pour bpftrace, perf et SystemTap.
+   Non attaché, un point ne coûte qu'un nop : ses arguments sont décrits dans la section .note.stapsdt
+   et ne sont lus que par l'outil qui s'y attache. Sans <sys/sdt.h> (paquet systemtap-sdt-dev)
+   ou avec -DMSM_NO_PROBES, les points disparaissent à la compilation.
+
+       malloc_entry(size)              malloc_return(ptr, size)
+       free_entry(ptr)                 free_return(ptr)
+       realloc_entry(ptr, size)        realloc_return(old, new, size)
+       carve(chunk, size)              chunk découpé au sommet de data_pool : aucun chunk libre ne convenait
+       grow_data(pool, old, new)       agrandissement de data_pool
+       grow_meta(pool, old, new)       agrandissement de meta_pool
+       purge(chunk, bytes)             pages d'un chunk libre rendues au noyau
+       canary_corrupt(chunk)           canary écrasé, juste avant exit(1)
+
+   Lister les points : readelf -n libmy_secmalloc.so | grep -A2 stapsdt
+   Exemples : tools/bpftrace/ */
+
+#if !defined(MSM_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MSM_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef MSM_HAVE_PROBES
+#define MSM_PROBE1(name, a) DTRACE_PROBE1(my_secmalloc, name, a)
+#define MSM_PROBE2(name, a, b) DTRACE_PROBE2(my_secmalloc, name, a, b)
+#define MSM_PROBE3(name, a, b, c) DTRACE_PROBE3(my_secmalloc, name, a, b, c)
+#else
+/* Les arguments restent évalués pour ne pas laisser de variable inutilisée (-Werror) */
+#define MSM_PROBE1(name, a) ((void)(a))
+#define MSM_PROBE2(name, a, b) ((void)(a), (void)(b))
+#define MSM_PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#endif
+
+#endif
@@ -1,5 +1,7 @@
 #define _GNU_SOURCE
 #include "my_secmalloc.private.h"
+#include "my_secmalloc_dump.h"
+#include "my_secmalloc_probes.h"
 #include <stdio.h>
 #include <alloca.h>
 #include <unistd.h>
@@ -8,26 +10,47 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <x86intrin.h>
-
-/* Directives de préprocesseur pour l'alignement sur 8 octets / 4 octets selon l'architecture */
-#if defined(__x86_64__) || defined(_M_X64) || defined(__aarch64__) || defined(__ppc64__)
-    #define ALIGNMENT 8
-#elif defined(__i386__) || defined(_M_IX86) || defined(__arm__) || defined(__PPC__)
-    #define ALIGNMENT 4
-#else
-    #define ALIGNMENT 8
-#endif
-
-#define MY_PAGE_SIZE (size_t)4096
-#define INITIAL_MMAP_SIZE (MY_PAGE_SIZE * 1000) // 4 Mo
-#define ALIGN(size) (size_t)((size + (ALIGNMENT - 1)) & (~(ALIGNMENT - 1)))
-
-metadata *meta_pool = NULL;
-topchunk *topchunk_pool = NULL;
-void *data_pool = NULL;
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+
+/* L'alignement des chunks est réglable (MSM_CONF) : ALIGNMENT n'en est que la valeur minimale */
+#define ALIGN(size) (size_t)((size + (msm_config.alignment - 1)) & (~(msm_config.alignment - 1)))
+#define PAGE_ALIGN(size) (size_t)(((size) + (MY_PAGE_SIZE - 1)) & (~(MY_PAGE_SIZE - 1)))
+/* Avec les huge pages, les pools sont gérés par tranches de 2 Mo pour ne jamais couper une huge page */
+#define HUGE_PAGE_SIZE (size_t)(2 * 1024 * 1024)
+#define POOL_GRANULARITY (msm_config.hugepages ? HUGE_PAGE_SIZE : MY_PAGE_SIZE)
+#define POOL_ALIGN(size) (size_t)(((size) + (POOL_GRANULARITY - 1)) & (~(POOL_GRANULARITY - 1)))
+/* Au-delà de ce seuil, le bloc est servi par son propre mapping (comme le seuil mmap de la glibc) */
+#define MAPPED_THRESHOLD msm_config.mapped_threshold
+/* Un chunk libéré dont l'intérieur couvre au moins ce nombre d'octets en pages entières est rendu au noyau */
+#define PURGE_THRESHOLD msm_config.purge_threshold
+/* Nombre de meta présentes dans meta_pool (allouées, libérées ou de gros blocs) */
+#define NUMBER_OF_METADATA (topchunk_pool->current_size_metadata / ALIGN(sizeof(metadata)))
+
+/* Tas sélectionné : propre à chaque thread, qui n'y touche qu'en tenant son verrou (use_heap) */
+__thread metadata *meta_pool = NULL;
+__thread topchunk *topchunk_pool = NULL;
+__thread void *data_pool = NULL;
 int report_file = -1;
 
+/* Arènes : des tas complets, créés à la demande. L'arène i préfère le nœud NUMA i % nœuds.
+   Une arène (ou une partition) est créée sous arenas_lock puis publiée : elle est lue sans verrou. */
+static topchunk *arenas[MSM_MAX_ARENAS];
+static size_t number_of_arenas = 0;
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t next_thread_slot = 0;
+static __thread size_t thread_slot = (size_t)-1;
+
+/* Histogrammes de latence (latency dans MSM_CONF) : rdtsc au début et à la fin de chaque opération publique,
+   le chemin pris est noté en route. Désactivés, ils ne coûtent qu'un test de msm_config.latency. */
+static __thread unsigned char latency_path = MSM_PATH_TOP;
+#define LATENCY_START() (__builtin_expect(msm_config.latency != 0, 0) ? __rdtsc() : 0)
+#define LATENCY_PATH(path) do { if(__builtin_expect(msm_config.latency != 0, 0)) latency_path = (path); } while(0)
+#define LATENCY_STOP(op, start) do { if(__builtin_expect((start) != 0, 0)) msm_latency_record((op), latency_path, __rdtsc() - (start)); } while(0)
+
 void logfile(const char *format, ...) {
     if(report_file == -1) return;
 
@@ -60,12 +83,49 @@ void logfile(const char *format, ...) {
     va_end(args);
 }
 
+#if MSM_HARDENING == 0
+/* Niveau 0 : aucun message, les arguments ne sont même plus évalués */
+#define logfile(...) do { if(0) logfile(__VA_ARGS__); } while(0)
+#endif
+
+/* Instantané du tas sur signal (dump_signal dans MSM_CONF) : dans MSM_DUMP, sinon msm_heap.<pid>.dump.
+   Le chemin est construit dans le handler (le pid change après un fork), sans snprintf ni malloc. */
+static const char *dump_file = NULL;
+
+static void dump_on_signal(int signum)
+{
+    (void)signum;
+    int saved_errno = errno;
+    if(dump_file != NULL)
+    {
+        msm_dump_heap(dump_file);
+    }
+    else
+    {
+        char path[64] = "msm_heap.";
+        char digits[24];
+        size_t length = 0;
+        size_t pid = (size_t)getpid();
+        do
+        {
+            digits[length++] = (char)('0' + pid % 10);
+            pid /= 10;
+        } while(pid != 0);
+        size_t position = strlen(path);
+        while(length > 0) path[position++] = digits[--length];
+        memcpy(path + position, ".dump", sizeof(".dump"));
+        msm_dump_heap(path);
+    }
+    errno = saved_errno;
+}
+
 __attribute__((constructor))
 /* report_file utilise fopen, qui utilise malloc ! 
         puisque le malloc initialise le topchunk_pool et la meta_pool, FILE sera mappé au debut de metapool...
         apparemment le malloc du fopen alloue 0x1d8 octets.
         on utilise alors open / write qui n'utilisent pas malloc */
 void initialize_report() {
+    msm_conf_init();
     const char *filename = getenv("MSM_OUTPUT");
     if (filename != NULL) {
         report_file = open(filename, O_WRONLY | O_CREAT, 0644);
@@ -74,6 +134,19 @@ void initialize_report() {
             exit(EXIT_FAILURE);
         }
     }
+    if(msm_config.dump_signal != 0)
+    {
+        dump_file = getenv("MSM_DUMP");
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = dump_on_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if(sigaction((int)msm_config.dump_signal, &action, NULL) == -1)
+        {
+            logfile("*** ERROR *** : heap dump handler for signal %zu not installed\n",msm_config.dump_signal);
+        }
+    }
 }
 
 __attribute__((destructor))
@@ -84,43 +157,188 @@ void close_report() {
     }
 }
 
-size_t get_random_canary(void)
+/* Secret tiré une seule fois de /dev/urandom : les canary en sont dérivés par un compteur mélangé (splitmix64).
+   Plus d'ouverture de /dev/urandom (ni de descripteur perdu) à chaque canary.
+   Chaque tas a son propre secret ; celui du processus ne sert qu'avant le premier tas. */
+static size_t canary_secret[2];
+static size_t canary_counter = 0;
+static pthread_once_t canary_secret_once = PTHREAD_ONCE_INIT;
+
+static void init_canary_secret(size_t *secret)
 {
-    int fd = open("/dev/urandom", O_RDONLY, 0);
-    size_t canary_value = 0xdeadbe00cafeba00;
-    if(fd != -1)
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC, 0);
+    if(fd == -1 || read(fd, secret, 2 * sizeof(size_t)) != (ssize_t)(2 * sizeof(size_t)))
     {
-        /* Si l'ouverture du fichier /dev/urandom n'a pas marché, le canary est généré par rdtsc.
-           Pour éviter du leak d'infos dans la heap, on finit le canary par 00*/
-        canary_value = __rdtsc();
+        /* Si la lecture de /dev/urandom n'a pas marché, le secret est généré par rdtsc (Plus dangereux car réduit l'entropie) */
+        secret[0] = __rdtsc();
+        secret[1] = __rdtsc() * 0x9e3779b97f4a7c15;
     }
-    else
+    if(fd != -1) close(fd);
+}
+
+static void init_process_secret(void)
+{
+    init_canary_secret(canary_secret);
+}
+
+/* Remplit out avec n canary en un seul appel : chaque valeur ne dépend que du secret et de son indice,
+   les itérations sont indépendantes et la boucle peut être vectorisée par le compilateur.
+   Le compteur est pris atomiquement : deux threads ne tirent jamais le même canary. */
+static void draw_canaries(const size_t *secret, size_t *counter, size_t *out, size_t n)
+{
+    uint64_t base = __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+    for(size_t i = 0; i < n; i++)
+    {
+        uint64_t z = secret[0] + (base + i) * 0x9e3779b97f4a7c15;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        z = (z ^ (z >> 31)) ^ secret[1];
+        /* Pour éviter du leak d'infos dans la heap, on finit le canary par 00*/
+        out[i] = (size_t)(z & ~(uint64_t)0xff);
+    }
+}
+
+/* Canary du tas courant */
+void fill_random_canaries(size_t *out, size_t n)
+{
+    if(topchunk_pool != NULL)
+    {
+        draw_canaries(topchunk_pool->canary_secret, &topchunk_pool->canary_counter, out, n);
+        return;
+    }
+    pthread_once(&canary_secret_once, init_process_secret);
+    draw_canaries(canary_secret, &canary_counter, out, n);
+}
+
+size_t get_random_canary(void)
+{
+    size_t canary_value;
+    fill_random_canaries(&canary_value, 1);
+    return canary_value;
+}
+
+#if MSM_HARDENING >= 1
+#define ARM_META_CANARY(meta) ((meta)->canary = get_random_canary())
+#define DRAW_CHUNK_CANARY(meta) ((meta)->canary_chunk = get_random_canary())
+
+/* Canary de fin d'un chunk : tiré du secret, gardé dans la meta (hors bande) et recopié juste après les data */
+static void arm_chunk_canary(metadata *meta)
+{
+    meta->canary_chunk = get_random_canary();
+    *(size_t*)((size_t)meta->chunk + meta->size_of_chunk) = meta->canary_chunk;
+}
+
+/* Un canary de fin écrasé veut dire que les data ont débordé : le chunk n'est pas rendu */
+static void check_chunk_canary(metadata *meta)
+{
+    if(msm_config.hardening >= 1 && *(size_t*)((size_t)meta->chunk + meta->size_of_chunk) != meta->canary_chunk)
     {
-        read(fd,&canary_value,ALIGNMENT);
+        MSM_PROBE1(canary_corrupt, meta->chunk);
+        logfile("!!! VULN !!! : Heap overflow detected, canary of chunk @ %p is corrupted\n",meta->chunk);
+        exit(1);
     }
-    /* Pour éviter du leak d'infos dans la heap, on finit le canary par 00*/
-    return canary_value ^ (canary_value & 0xff);
 }
+#else
+/* Niveau 0 : aucun canary tiré, écrit ni vérifié. Leur place reste réservée : les chunks gardent la même disposition. */
+#define ARM_META_CANARY(meta) ((void)(meta))
+#define DRAW_CHUNK_CANARY(meta) ((void)(meta))
+#define arm_chunk_canary(meta) ((void)(meta))
+#define check_chunk_canary(meta) ((void)(meta))
+#endif
 
-unsigned char generate_random_value(size_t min, size_t max)
+size_t generate_random_value(size_t min, size_t max)
 {
-    int fd = open("/dev/urandom", O_RDONLY, 0);
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC, 0);
     size_t random_value = 0xdeadbe00cafeba00;
-    if(fd != -1)
+    if(fd == -1 || read(fd,&random_value,sizeof(random_value)) != (ssize_t)sizeof(random_value))
     {
-        /* Si l'ouverture du fichier /dev/urandom n'a pas marché, génération par rdtsc (Plus dangereux car réduit l'entropie) */
+        /* Si la lecture de /dev/urandom n'a pas marché, génération par rdtsc (Plus dangereux car réduit l'entropie) */
         random_value = __rdtsc();
     }
+    if(fd != -1) close(fd);
+
+    /* Permet de choisir un nombre aléatoire entre min et max */
+    if(max - min == ~(size_t)0) return random_value;
+    return min + (random_value % (max - min + 1));
+}
+
+/* Horloge monotone en millisecondes (grossière : lue dans le vDSO sans appel système) */
+static size_t now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (size_t)now.tv_sec * 1000 + (size_t)now.tv_nsec / 1000000;
+}
+
+/* mmap d'un pool. Avec l'option hugepages : MAP_HUGETLB si des huge pages sont réservées,
+   sinon réservation alignée sur 2 Mo et MADV_HUGEPAGE pour que le noyau y mette des THP */
+static void *map_pool(size_t address, size_t size)
+{
+    if(!msm_config.hugepages)
+    {
+        return mmap((void*)address, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+
+    address &= ~(HUGE_PAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+    void *pool = mmap((void*)address, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(pool != MAP_FAILED)
+    {
+        logfile("[+] %zu bytes pool backed by hugetlb pages @ %p\n",size,pool);
+        return pool;
+    }
+#endif
+    void *mapping = mmap((void*)address, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mapping == MAP_FAILED) return MAP_FAILED;
+    size_t aligned = ((size_t)mapping + HUGE_PAGE_SIZE - 1) & (~(HUGE_PAGE_SIZE - 1));
+    size_t head = aligned - (size_t)mapping;
+    if(head != 0) munmap(mapping, head);
+    munmap((void*)(aligned + size), HUGE_PAGE_SIZE - head);
+    if(madvise((void*)aligned, size, MADV_HUGEPAGE) == -1)
+    {
+        logfile("*** ERROR *** : madvise(MADV_HUGEPAGE) of pool @ %p failed, transparent huge pages are disabled\n",(void*)aligned);
+    }
     else
     {
-        read(fd,&random_value,ALIGNMENT);
+        logfile("[+] %zu bytes pool aligned for transparent huge pages @ %p\n",size,(void*)aligned);
     }
+    return (void*)aligned;
+}
 
-    /* Permet de choisir un nombre aléatoire entre min et max */
-    return min + (random_value % (max - min + 1));
+/* Initialise un tas vide dans des pools déjà mappés (ceux de create_heap, ou le fichier d'un tas persistant) */
+void msm_heap_format(topchunk *heap, size_t meta_pool_size, void *data_pool, size_t data_pool_size)
+{
+    /* Secret propre au tas : les canary d'un tas ne disent rien de ceux d'un autre */
+    init_canary_secret(heap->canary_secret);
+    heap->canary_counter = 0;
+    draw_canaries(heap->canary_secret, &heap->canary_counter, &heap->canary, 1);
+    heap->total_size_metadata = meta_pool_size;
+    heap->current_size_metadata = 0;
+    heap->number_of_elements_allocated = 0;
+    heap->number_of_elements_freed = 0;
+    heap->free_metadata = NULL;
+    heap->free_tree = NULL;
+    heap->quarantine_head = NULL;
+    heap->quarantine_tail = NULL;
+    heap->quarantine_bytes = 0;
+    heap->metadata_allocated = NULL;
+    heap->mapped_allocated = NULL;
+    heap->unused_metadata = NULL;
+    heap->number_of_elements_mapped = 0;
+    heap->total_size_mapped = 0;
+    heap->data_pool = data_pool;
+    heap->current_size_data = 0;
+    heap->total_size_data = data_pool_size;
+    heap->node = 0;
+    heap->decay_epoch = now_ms();
+    heap->decay_index = 0;
+    memset(heap->decay_backlog, 0, sizeof(heap->decay_backlog));
+    heap->persistent = 0;
+    pthread_mutex_init(&heap->lock, NULL);
 }
 
-static void init_pools(void) {
+/* Crée un tas complet : topchunk_pool et meta_pool, puis son data_pool, avec des pages préférées sur node */
+static topchunk *create_heap(size_t node) {
     /* Construction du top_chunk */
     /* Mapping de 4 Mo partout */
 
@@ -170,582 +388,1697 @@ static void init_pools(void) {
         Nombre d'adresses à bruteforce : 0xffff (65535)
       */
     size_t base_address;
-    
-    if(ALIGNMENT == 8)
-    {
-        base_address = MY_PAGE_SIZE * 100;
-        size_t aslr = generate_random_value(0,0x26ac) * MY_PAGE_SIZE;
-        topchunk_pool = mmap((size_t*)(base_address + aslr), INITIAL_MMAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    }
-    else
-    {
-        base_address = MY_PAGE_SIZE * 100;
-        size_t aslr = generate_random_value(0,0xf9c) * MY_PAGE_SIZE;
-        topchunk_pool = mmap((size_t*)(base_address + aslr), INITIAL_MMAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    }
-    if(topchunk_pool == MAP_FAILED)
+
+    /* Tailles initiales et plages ASLR viennent de MSM_CONF (par défaut : les valeurs ci-dessus) */
+    size_t meta_pool_size = POOL_ALIGN(msm_config.meta_pool_size);
+    size_t data_pool_size = POOL_ALIGN(msm_config.data_pool_size);
+
+    base_address = MY_PAGE_SIZE * 100;
+    size_t aslr = generate_random_value(0,msm_config.meta_aslr) * MY_PAGE_SIZE;
+    topchunk *heap = map_pool(base_address + aslr, meta_pool_size);
+    if(heap == MAP_FAILED)
     {
         logfile("*** ERROR *** : mmap topchunk_pool failed.\nExit !\n");
         perror("mmap meta_pool");
         exit(1);
     }
 
-    /* TODO : topchunk_pool canary */
-    topchunk_pool->canary = get_random_canary();
-    topchunk_pool->total_size_metadata = INITIAL_MMAP_SIZE;
-    topchunk_pool->current_size_metadata = 0;
-    topchunk_pool->number_of_elements_allocated = 0;
-    topchunk_pool->number_of_elements_freed = 0;
-    topchunk_pool->free_metadata = NULL;
-    topchunk_pool->metadata_allocated = NULL;
-
     if(ALIGNMENT == 8)
     {
         base_address = MY_PAGE_SIZE * 1048575;
-        size_t aslr = generate_random_value(0,0x4f00001) * MY_PAGE_SIZE;
-        data_pool = mmap((size_t*)(base_address + aslr), INITIAL_MMAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     }
     else
     {
         base_address = MY_PAGE_SIZE * 131072;
-        size_t aslr = generate_random_value(0,0xffff) * MY_PAGE_SIZE;
-        data_pool = mmap((size_t*)(base_address + aslr), INITIAL_MMAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     }
-    if(data_pool == MAP_FAILED)
+    aslr = generate_random_value(0,msm_config.data_aslr) * MY_PAGE_SIZE;
+    void *data = map_pool(base_address + aslr, data_pool_size);
+    if(data == MAP_FAILED)
     {
         logfile("*** ERROR *** : mmap data_pool failed.\nExit !\n");
         perror("mmap meta_pool");
         exit(1);
     }
+    msm_heap_format(heap, meta_pool_size, data, data_pool_size);
+    heap->node = node;
 
-    topchunk_pool->current_size_data = 0;
-    topchunk_pool->total_size_data = INITIAL_MMAP_SIZE;
+    /* Une arène par nœud : ses pages doivent être touchées sur son nœud, même par le premier thread venu */
+    if(number_of_arenas > 1)
+    {
+        msm_numa_bind(heap, meta_pool_size, node);
+        msm_numa_bind(heap->data_pool, data_pool_size, node);
+    }
 
-    meta_pool = (metadata*)((size_t)topchunk_pool + ALIGN(sizeof(topchunk)));
+    logfile("[+] topchunk_pool mapped @ %p (node %zu)\n",heap,node);
+    logfile("[+] meta_pool mapped @ %p\n",(void*)((size_t)heap + ALIGN(sizeof(topchunk))));
+    logfile("[+] data_pool mapped @ %p\n",heap->data_pool);
+    return heap;
+}
 
-    logfile("==============================[ Start Pools Initialisation ]==============================\n");
-    logfile("[+] topchunk_pool mapped @ %p\n",topchunk_pool);
-    logfile("[+] meta_pool mapped @ %p\n",meta_pool);
-    logfile("==============================[ End Pools Initialisation ]==============================\n\n");
+/* Tas privé choisi par l'appelant (msm_heap_*) : le temps de l'appel, il remplace l'arène du thread appelant
+   seulement. Un même tas privé peut servir plusieurs threads, son verrou les met à la suite. */
+static __thread topchunk *private_heap = NULL;
+
+/* Partitions (msm_malloc_partition) : un tas par famille d'objets, créé à son premier chunk.
+   La partition MSM_PARTITION_DEFAULT est le tas de malloc, elle n'a pas d'entrée ici. */
+static topchunk *partitions[MSM_PARTITIONS];
+static size_t number_of_partitions = 0;
+
+/* Le tas courant : toutes les fonctions de l'allocateur travaillent sur topchunk_pool, meta_pool et data_pool */
+static void select_heap(topchunk *heap)
+{
+    topchunk_pool = heap;
+    meta_pool = (metadata*)((size_t)heap + ALIGN(sizeof(topchunk)));
+    data_pool = heap->data_pool;
 }
 
-size_t *verify_freed_block(size_t size)
+/* Verrou d'un tas : celui du segment pour un tas partagé (entre processus), sinon celui du topchunk */
+void msm_heap_lock(topchunk *heap)
 {
-    if(topchunk_pool->number_of_elements_freed == 0) return NULL;
-    void * chunk_to_free = NULL;
-    metadata *meta_linked_to_chunk_to_free = NULL;
-    metadata *_ = meta_pool;
-    for(size_t i=0;i<(topchunk_pool->number_of_elements_allocated + topchunk_pool->number_of_elements_freed);i++)
+    if(heap->persistent == MY_HEAP_SHARED)
     {
-        /* Pour chaque bloc indépendemment de leur ordre, on récupère le meta qui est free et qui a une taille de data suffisante */
-        metadata *m = (metadata*)((size_t)_ + (i * ALIGN(sizeof(metadata))));
-        if(m->size_of_chunk + ALIGN(sizeof(size_t)) >= size + ALIGN(sizeof(size_t)) && m->free == MY_IS_FREE)
-        {
-            chunk_to_free = m->chunk;
-            meta_linked_to_chunk_to_free = m;
-            break;
-        }
+        msm_shm_lock(heap);
+        return;
     }
-    if(meta_pool != NULL)
+    pthread_mutex_lock(&heap->lock);
+}
+
+void msm_heap_unlock(topchunk *heap)
+{
+    if(heap->persistent == MY_HEAP_SHARED)
     {
-        metadata *current_meta = topchunk_pool->free_metadata;
-        while(current_meta != NULL)
-        {
-            /* Si un bloc libre a une taille suffisante
-                    Si la taille est supérieure alors on fragmente
-                        Si présence de free_metadata alors on utilise jusqu'à épuisement sinon on crée des meta à la fin
-                    Si la taille est parfaite
-                        Si présence de free_metadata alors on utilise jusqu'à épuisement sinon on crée des meta à la fin
-                Sinon on retourne NULL
-            */
-
-           /*
-            On a la liste des meta qui sont seuls
-            Il faut la liste des free et raccrocher la liste des meta a la liste des free
-           */
-
-           if(chunk_to_free != NULL)
-           {
-                /* On a trouvé un data qui a été free et qui a une taille convenable pour allouer à nouveau */
-                void* current_chunk = chunk_to_free;
-                /* Si un chunk est partagé par deux meta qui ont été free, intervertir les pointeurs de chunk */
-                if(current_meta != meta_linked_to_chunk_to_free)
-                {
-                    void *tmp_chunk = current_meta->chunk;
-                    current_meta->chunk = meta_linked_to_chunk_to_free->chunk;
-                    meta_linked_to_chunk_to_free->chunk = tmp_chunk;
-                }
-                if(current_meta->size_of_chunk > size + ALIGN(sizeof(size_t)))
-                {
-                    /* Le bloc trouvé a une taille supérieure à la taille demandée : fragmentation du bloc */
-                    /* Priorité aux meta qui attendent */
-                    metadata *new_frag;
-                    if(topchunk_pool->free_metadata != NULL)
-                    {
-                        /* Si au moins un meta est free alors on le libère pour en faire un occuppé */
-                        new_frag = topchunk_pool->free_metadata;
-                        metadata *_ = topchunk_pool->free_metadata;
-                        metadata *previous = NULL;
-                        while(_ != NULL)
-                        {
-                            if(_->next_waiting == new_frag)   
-                            {
-                                previous = _;
-                                break;
-                            }
-                            _ = _->next_waiting;
-                        }
-                        /* Si le bloc avait un suivant alors raccrocher son précédent avec son suivant pour l'enlever de la liste des éléments alloués */
-                        if(previous != NULL)
-                        {
-                            /* Le bloc avait un meta free précédent */
-                            if(new_frag->next_waiting != NULL)
-                            {
-                                /* Le bloc avait un meta free suivant et précédent */
-                                metadata *next_one = new_frag->next_waiting;
-                                previous->next_waiting = next_one;
-                            }
-                            else
-                            {
-                                /* Le bloc n'avait qu'un meta free précédent */
-                                previous->next_waiting = NULL;
-                            }
-                        }
-                        else
-                        {
-                            /* Le bloc n'avait pas de meta free précédent */
-                            if(new_frag->next_waiting != NULL)
-                            {
-                                /* Le bloc n'avait qu'un meta free suivant */
-                                metadata *next_one = new_frag->next_waiting;
-                                topchunk_pool->free_metadata = next_one;
-                                next_one->next_waiting = NULL;
-                            }
-                            else
-                            {
-                                /* Le bloc n'avait ni de meta free suivant ni précédent */
-                                topchunk_pool->free_metadata = NULL;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        /* new_frag_next sera contigu dans la mémoire car toutes les meta sont occuppées */
-                        new_frag = (metadata*)((size_t)meta_pool + ALIGN(sizeof(metadata)) * (topchunk_pool->number_of_elements_allocated + topchunk_pool->number_of_elements_freed));
-                        topchunk_pool->current_size_metadata += ALIGN(sizeof(metadata));
-                    }
-                    // TODO : canary
-                    size_t *canary = (size_t*)((size_t)current_chunk + size);
-                    *canary = get_random_canary();
-                    new_frag->canary = get_random_canary();
-                    new_frag->canary_chunk = get_random_canary();
-                    new_frag->free = MY_IS_BUSY;
-                    new_frag->next_waiting = NULL;
-                    new_frag->chunk = current_chunk;
-                    new_frag->next = NULL;
-                    /* Si au moins un élément est déjà alloué, mettre le nouveau meta alloué à la suite */
-                    if(topchunk_pool->metadata_allocated != NULL)
-                    {
-                        metadata *n = topchunk_pool->metadata_allocated;
-                        while(n->next != NULL){n = n->next;}
-                        n->next = new_frag;
-                    }
-                    else
-                    {
-                        topchunk_pool->metadata_allocated = new_frag;
-                    }
-                    size_t remaining_size = new_frag->size_of_chunk - (size + ALIGN(sizeof(size_t)));
-                    new_frag->size_of_chunk = size;
-                    metadata *new_frag_next;
-                    if(topchunk_pool->free_metadata != NULL)
-                    {
-                        /* Si au moins un meta est free alors on le libère pour en faire un occuppé */
-                        new_frag_next = topchunk_pool->free_metadata;
-                        metadata *_ = topchunk_pool->free_metadata;
-                        metadata *previous = NULL;
-                        while(_ != NULL)
-                        {
-                            if(_->next_waiting == new_frag_next)   
-                            {
-                                previous = _;
-                                break;
-                            }
-                            _ = _->next_waiting;
-                        }
-                        /* Si le bloc avait un suivant alors raccrocher son précédent avec son suivant pour l'enlever de la liste des éléments alloués */
-                        if(previous != NULL)
-                        {
-                            /* Le bloc avait un meta free précédent */
-                            if(new_frag_next->next_waiting != NULL)
-                            {
-                                /* Le bloc avait un meta free suivant et précédent */
-                                metadata *next_one = new_frag_next->next_waiting;
-                                previous->next_waiting = next_one;
-                            }
-                            else
-                            {
-                                /* Le bloc n'avait qu'un meta free précédent */
-                                previous->next_waiting = NULL;
-                            }
-                        }
-                        else
-                        {
-                            /* Le bloc n'avait pas de meta free précédent */
-                            if(new_frag_next->next_waiting != NULL)
-                            {
-                                /* Le bloc n'avait qu'un meta free suivant */
-                                metadata *next_one = new_frag_next->next_waiting;
-                                topchunk_pool->free_metadata = next_one;
-                                next_one->next_waiting = NULL;
-                            }
-                            else
-                            {
-                                /* Le bloc n'avait ni de meta free suivant ni précédent */
-                                topchunk_pool->free_metadata = NULL;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        /* Si aucun meta n'est free, alors new_frag_next se colle à new_frag */
-                        new_frag_next = (metadata*)((size_t)meta_pool + topchunk_pool->current_size_metadata);
-                        topchunk_pool->current_size_metadata += ALIGN(sizeof(metadata));
-                    }
-
-                    // TODO : canary
-                    new_frag_next->canary = get_random_canary();
-                    new_frag_next->canary_chunk = get_random_canary();
-                    new_frag_next->free = MY_IS_FREE;
-                    new_frag_next->size_of_chunk = remaining_size;
-                    new_frag_next->next = NULL;
-                    new_frag_next->next_waiting = NULL;
-                    new_frag_next->chunk = (void*)((size_t)current_chunk + size + ALIGN(sizeof(size_t)));
-                    if(topchunk_pool->free_metadata != NULL)
-                    {
-                        metadata *n = topchunk_pool->metadata_allocated;
-                        while(n->next != NULL){n = n->next;}
-                        n->next = new_frag_next;
-                    }
-                    else
-                    {
-                        topchunk_pool->free_metadata = new_frag_next;
-                    }
-                    topchunk_pool->number_of_elements_allocated++;
-                    logfile("[+] %zu bytes allocated @ %p\n └──> ",size,new_frag->chunk);
-                    logfile("Chunk @ %p fragmented => new freed chunk created @ %p\n",new_frag,new_frag_next->chunk);
-                }
-                else
-                {
-                    /* Le bloc trouvé a la taille parfaite : pas de fragmentation de bloc */
-                    /* Priorité aux meta qui attendent */
-                    metadata *new_frag;
-                    if(topchunk_pool->free_metadata != NULL)
-                    {
-                        /* Si au moins un meta a été libéré, l'allouer */
-                        new_frag = topchunk_pool->free_metadata;
-                        if(topchunk_pool->free_metadata->next_waiting != NULL)
-                        {
-                            /* Si le meta libéré a un suivant, le mettre en tête de liste */
-                            topchunk_pool->free_metadata = topchunk_pool->free_metadata->next_waiting;
-                        }
-                        else
-                        {
-                            topchunk_pool->free_metadata = NULL;
-                        }
-                    }
-                    else
-                    {
-                        /* Aucun meta libre n'est trouvé : ajouter le meta à la fin */
-                        new_frag = (metadata*)((size_t)current_meta + ALIGN(sizeof(metadata)));
-                    }
-
-                    // TODO : canary
-                    size_t *canary = (size_t*)((size_t)current_chunk + size);
-                    *canary = get_random_canary();
-                    new_frag->canary = get_random_canary();
-                    new_frag->canary_chunk = get_random_canary();
-                    new_frag->free = MY_IS_BUSY;
-                    new_frag->size_of_chunk = size;
-                    new_frag->next_waiting = NULL;
-                    new_frag->next = NULL;
-                    new_frag->chunk = current_chunk;
-                    /* Si au moins un élément est déjà alloué, mettre le nouveau meta alloué à la suite */
-                    if(topchunk_pool->metadata_allocated != NULL)
-                    {
-                        metadata *n = topchunk_pool->metadata_allocated;
-                        while(n->next != NULL){n = n->next;}
-                        n->next = new_frag;
-                    }
-                    else
-                    {
-                        topchunk_pool->metadata_allocated = new_frag;
-                    }
-                    topchunk_pool->number_of_elements_allocated++;
-                    topchunk_pool->number_of_elements_freed--;
-                    logfile("[+] %zu bytes allocated @ %p\n",size,new_frag->chunk);
-                }
-                
-                return current_chunk;
-           }
-           current_meta = current_meta->next_waiting;
-        }
+        msm_shm_unlock(heap);
+        return;
     }
-    return NULL;
+    pthread_mutex_unlock(&heap->lock);
+}
+
+/* Un thread tient au plus un verrou de tas à la fois : pas d'ordre entre les verrous, donc pas d'interblocage.
+   Il est gardé jusqu'à la sortie de la fonction publique la plus externe (begin_call / end_call),
+   un appel imbriqué (malloc dans realloc, free dans msm_heap_free...) ne le rend pas. */
+static __thread topchunk *locked_heap = NULL;
+static __thread size_t nested_calls = 0;
+
+static void release_heap(void)
+{
+    if(locked_heap == NULL) return;
+    msm_heap_unlock(locked_heap);
+    locked_heap = NULL;
 }
 
-void get_more_memory_mmap_metadata(void)
+/* Sélectionne heap sous son verrou (celui du tas tenu jusque-là est rendu d'abord) */
+static void use_heap(topchunk *heap)
 {
-    /* Augmenter de la taille d'une page */
-    void *ptr = mremap(topchunk_pool,topchunk_pool->total_size_metadata, topchunk_pool->total_size_metadata + MY_PAGE_SIZE, MREMAP_MAYMOVE);
-    if(topchunk_pool == MAP_FAILED || ptr != topchunk_pool)
+    if(locked_heap != heap)
     {
-        logfile("*** ERROR *** : mremap for topchunk_pool failed\n");
-        perror("mmap meta_pool");
-        exit(1);
+        release_heap();
+        msm_heap_lock(heap);
+        locked_heap = heap;
     }
-    topchunk_pool->total_size_metadata = topchunk_pool->total_size_metadata + MY_PAGE_SIZE;
-    logfile("[+] Not enough memory for topchunk_pool @ %p : successfully mapped %zu more bytes\n",topchunk_pool,MY_PAGE_SIZE);
+    select_heap(heap);
+}
+
+static void begin_call(void)
+{
+    nested_calls++;
+}
+
+static void end_call(void)
+{
+    if(--nested_calls == 0) release_heap();
 }
 
-void get_more_memory_mmap_data(size_t size)
+/* Remet le tas sélectionné avant (aucun si l'allocateur n'a encore jamais servi) */
+static void restore_heap(topchunk *previous)
 {
-    /* Augmenter de size + ALIGN(sizeof(size_t)) pour le canary (aligné sur une page !) */
-    size_t new_aligned_size = (size_t)(((topchunk_pool->total_size_data + size + ALIGN(sizeof(size_t))) + (MY_PAGE_SIZE - 1)) & (~(MY_PAGE_SIZE - 1)));
-    void *ptr = mremap(data_pool,topchunk_pool->total_size_data, new_aligned_size, MREMAP_MAYMOVE);
-    if(topchunk_pool == MAP_FAILED || ptr != data_pool)
+    if(previous != NULL)
     {
-        logfile("*** ERROR *** : mremap for data_pool failed\n");
-        perror("mmap meta_pool");
-        exit(1);
+        select_heap(previous);
+        return;
     }
-    topchunk_pool->total_size_data = new_aligned_size;
-    logfile("[+] Not enough memory for data_pool @ %p : successfully mapped %zu more bytes\n",data_pool,MY_PAGE_SIZE);
+    topchunk_pool = NULL;
+    meta_pool = NULL;
+    data_pool = NULL;
 }
 
-void *my_malloc(size_t size) {
-    /* Si la taille dépasse la taille maximale d'un objet allouable avec l'alignement derrière */
-    if(size > 0x8000000000000000 - ALIGNMENT) return NULL;
-    /* Permet d'aligner la taille sur 8 ou 4 octets, et permet d'allouer au minimum 8 ou 4 octets pour une taille nulle */
-    size = (size == 0) ? ALIGN(1) : ALIGN(size);
+/* L'arène 0 est publiée en dernier par init_pools : tant qu'elle n'existe pas, rien n'a été alloué */
+static int pools_ready(void)
+{
+    return __atomic_load_n(&arenas[0], __ATOMIC_ACQUIRE) != NULL;
+}
 
-    /* Si le top_chunk n'a jamais été crée, alors le créer.
-     Cela signifie que c'est le tout premier malloc du programme */
-    if (topchunk_pool == NULL) {
-        init_pools();
-    }
+static topchunk *arena_heap(size_t index)
+{
+    return __atomic_load_n(&arenas[index], __ATOMIC_ACQUIRE);
+}
+
+static topchunk *partition_heap(size_t id)
+{
+    return __atomic_load_n(&partitions[id], __ATOMIC_ACQUIRE);
+}
 
-    if(topchunk_pool->current_size_metadata + 2 * ALIGN(sizeof(metadata)) > topchunk_pool->total_size_metadata)
+/* fork : aucun verrou d'arène ou de partition ne doit être tenu par un thread qui n'existera pas dans le fils.
+   arenas_lock est pris d'abord, les verrous des tas ensuite (jamais dans l'autre ordre ailleurs).
+   Les tas privés restent à la charge de l'appelant. */
+static void prepare_fork(void)
+{
+    pthread_mutex_lock(&arenas_lock);
+    for(size_t i = 0; i < number_of_arenas; i++)
     {
-        /* on demande + de mémoire pour meta_pool avec mremap dans le cas extrême de 2 allocs pour fragmentation de data */
-        get_more_memory_mmap_metadata();
+        if(arenas[i] != NULL) msm_heap_lock(arenas[i]);
     }
-
-    if(topchunk_pool->current_size_data + ALIGN(sizeof(size_t)) + size > topchunk_pool->total_size_data)
+    for(size_t id = 1; id < MSM_PARTITIONS; id++)
     {
-        /* on demande + de mémoire pour data_pool avec mremap */
-        get_more_memory_mmap_data(size);
+        if(partitions[id] != NULL) msm_heap_lock(partitions[id]);
     }
+}
 
-    size_t *freed_block = verify_freed_block(size);
-    if(freed_block != NULL)
+static void after_fork(void)
+{
+    for(size_t id = MSM_PARTITIONS - 1; id > 0; id--)
     {
-        return freed_block;
+        if(partitions[id] != NULL) msm_heap_unlock(partitions[id]);
     }
-
-    /* Ajout du metadata à la fin de la liste */
-    metadata *new_meta = (metadata*)((size_t)meta_pool + topchunk_pool->current_size_metadata);
-    /* TODO : canary */
-    new_meta->canary_chunk = get_random_canary();
-    new_meta->canary = get_random_canary();
-    new_meta->chunk = data_pool + topchunk_pool->current_size_data;
-    new_meta->free = MY_IS_BUSY;
-    new_meta->next = NULL;
-    new_meta->next_waiting = NULL;
-    new_meta->size_of_chunk = size; /* data sans le canary */
-    topchunk_pool->current_size_data += size + ALIGN(sizeof(size_t));
-
-    /* Si au moins un élément est déjà alloué, mettre le nouveau meta alloué à la suite */
-    if(topchunk_pool->metadata_allocated != NULL)
+    for(size_t i = number_of_arenas; i > 0; i--)
     {
-        metadata *n = topchunk_pool->metadata_allocated;
-        while(n->next != NULL){n = n->next;}
-        n->next = new_meta;
+        if(arenas[i - 1] != NULL) msm_heap_unlock(arenas[i - 1]);
     }
-    else
+    pthread_mutex_unlock(&arenas_lock);
+}
+
+/* Retourne 1 pour le thread qui a créé l'arène 0 (0 si un autre thread l'a déjà fait) */
+static int init_pools(void) {
+    /* Aucun verrou de tas n'est tenu en prenant arenas_lock (voir prepare_fork) */
+    release_heap();
+    pthread_mutex_lock(&arenas_lock);
+    if(arenas[0] != NULL)
     {
-        /* Si aucun élément n'a été alloué depuis */
-        topchunk_pool->metadata_allocated = new_meta;
+        pthread_mutex_unlock(&arenas_lock);
+        return 0;
     }
+    /* Tailles initiales, alignement et plages ASLR viennent de MSM_CONF */
+    msm_conf_init();
+    number_of_arenas = (msm_config.narenas != 0) ? msm_config.narenas : msm_numa_node_count();
+    if(number_of_arenas > MSM_MAX_ARENAS) number_of_arenas = MSM_MAX_ARENAS;
+
+    logfile("==============================[ Start Pools Initialisation ]==============================\n");
+    pthread_atfork(prepare_fork, after_fork, after_fork);
+    __atomic_store_n(&arenas[0], create_heap(0), __ATOMIC_RELEASE);
+    logfile("[+] %zu arenas for %zu NUMA nodes\n",number_of_arenas,msm_numa_node_count());
+    logfile("[+] conf : data_pool_size=%zu meta_pool_size=%zu growth=%zu%% hugepages=%zu mapped_threshold=%zu alignment=%zu narenas=%zu purge_threshold=%zu decay_ms=%zu quarantine=%zu hardening=%zu sample_rate=%zu reserve=%zu prefault=%zu\n",
+            msm_config.data_pool_size,msm_config.meta_pool_size,msm_config.growth,msm_config.hugepages,msm_config.mapped_threshold,msm_config.alignment,
+            msm_config.narenas,msm_config.purge_threshold,msm_config.decay_ms,msm_config.quarantine,msm_config.hardening,msm_config.sample_rate,msm_config.reserve,msm_config.prefault);
+    logfile("==============================[ End Pools Initialisation ]==============================\n\n");
+    pthread_mutex_unlock(&arenas_lock);
+    return 1;
+}
 
+/* Récupère une meta sans chunk : d'abord parmi les meta inutilisées, sinon à la fin de meta_pool */
+static metadata *get_unused_metadata(void)
+{
+    metadata *meta = topchunk_pool->unused_metadata;
+    if(meta != NULL)
+    {
+        topchunk_pool->unused_metadata = meta->next_waiting;
+        return meta;
+    }
+    meta = (metadata*)((size_t)meta_pool + topchunk_pool->current_size_metadata);
     topchunk_pool->current_size_metadata += ALIGN(sizeof(metadata));
+    return meta;
+}
+
+/* Une meta qui n'a plus de chunk est mise de côté pour être réutilisée */
+static void release_metadata(metadata *meta)
+{
+    meta->free = MY_IS_UNUSED;
+    meta->chunk = NULL;
+    meta->size_of_chunk = 0;
+    meta->zero = 0;
+    meta->next = NULL;
+    meta->next_waiting = topchunk_pool->unused_metadata;
+    topchunk_pool->unused_metadata = meta;
+}
+
+/* Met un chunk occupé en tête de la liste des éléments alloués */
+static void link_allocated_metadata(metadata *meta)
+{
+    meta->free = MY_IS_BUSY;
+    meta->next_waiting = NULL;
+    meta->next = topchunk_pool->metadata_allocated;
+    topchunk_pool->metadata_allocated = meta;
     topchunk_pool->number_of_elements_allocated++;
-    // TODO : canary
-    // size_t *chunk = new_meta->chunk;
-    // chunk[new_meta->size_of_chunk] = (size_t)0xaabbccddddccbbaa;
-    size_t *canary = (size_t*)((size_t)new_meta->chunk + new_meta->size_of_chunk);
-    
-    *canary = get_random_canary();
-    logfile("[+] %zu bytes allocated @ %p\n",size,new_meta->chunk);
+}
 
-    return new_meta->chunk;
+/* Les gros chunks libres sont rangés dans un treap ordonné par (taille, adresse) : le best-fit y est en O(log n).
+   Un chunk libre n'est dans aucune liste d'éléments alloués : next et next_waiting servent de fils gauche et droit. */
+#define BEST_FIT_THRESHOLD (size_t)1024
+#define TREE_LEFT(meta) ((meta)->next)
+#define TREE_RIGHT(meta) ((meta)->next_waiting)
+
+/* Priorité du treap tirée de l'adresse du chunk : rien à stocker dans la meta */
+static size_t tree_priority(metadata *meta)
+{
+    size_t x = (size_t)meta->chunk;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
 }
 
-unsigned char find_element_to_free(void *ptr)
+static int tree_less(metadata *a, metadata *b)
 {
-    metadata *current_meta = topchunk_pool->metadata_allocated;
-    void *current_chunk;
+    if(a->size_of_chunk != b->size_of_chunk) return a->size_of_chunk < b->size_of_chunk;
+    return (size_t)a->chunk < (size_t)b->chunk;
+}
 
-    /* Pour chaque élément indépendamment de l'ordre, on regarde s'il existe un meta déjà libéré */
-    while(current_meta != NULL)
+static metadata *tree_insert(metadata *root, metadata *meta)
+{
+    if(root == NULL)
+    {
+        TREE_LEFT(meta) = NULL;
+        TREE_RIGHT(meta) = NULL;
+        return meta;
+    }
+    if(tree_less(meta, root))
+    {
+        TREE_LEFT(root) = tree_insert(TREE_LEFT(root), meta);
+        if(tree_priority(TREE_LEFT(root)) > tree_priority(root))
+        {
+            /* Rotation à droite */
+            metadata *left = TREE_LEFT(root);
+            TREE_LEFT(root) = TREE_RIGHT(left);
+            TREE_RIGHT(left) = root;
+            return left;
+        }
+    }
+    else
     {
-        //current_meta = (metadata*)((size_t)meta_pool + i*ALIGN(sizeof(metadata))); 
-        current_chunk = current_meta->chunk;
-        
-        if(current_chunk == ptr)
+        TREE_RIGHT(root) = tree_insert(TREE_RIGHT(root), meta);
+        if(tree_priority(TREE_RIGHT(root)) > tree_priority(root))
         {
-            /* Si le bloc était occupé il devient libre */
-            current_meta->free = MY_IS_FREE;
+            /* Rotation à gauche */
+            metadata *right = TREE_RIGHT(root);
+            TREE_RIGHT(root) = TREE_LEFT(right);
+            TREE_LEFT(right) = root;
+            return right;
+        }
+    }
+    return root;
+}
 
-            /* Ajouter à la taille du bloc free le canary de fin */
-            current_meta->size_of_chunk += ALIGN(sizeof(size_t));
+/* Fusionne deux treaps dont toutes les clés de left précèdent celles de right */
+static metadata *tree_merge(metadata *left, metadata *right)
+{
+    if(left == NULL) return right;
+    if(right == NULL) return left;
+    if(tree_priority(left) > tree_priority(right))
+    {
+        TREE_RIGHT(left) = tree_merge(TREE_RIGHT(left), right);
+        return left;
+    }
+    TREE_LEFT(right) = tree_merge(left, TREE_LEFT(right));
+    return right;
+}
 
-            /* Si au moins un élément est déjà libéré, mettre le nouveau meta libéré à la suite */
-            if(topchunk_pool->free_metadata != NULL)
-            {
-                /* Si au moins un élément est libéré, faire suivre la meta */
-                metadata *n = topchunk_pool->free_metadata;
-                while(n->next_waiting != NULL){n = n->next_waiting;}
-                n->next_waiting = current_meta;
-            }
-            else
-            {
-                /* Si aucun élément n'est libéré, alors initialiser la liste */
-                topchunk_pool->free_metadata = current_meta;
-            }
-            current_meta->next_waiting = NULL;
-            if(topchunk_pool->metadata_allocated != NULL)
-            {
-                /* Si au moins un élément est alloué, supprimer le bloc de la liste et passer à son suivant */
-                metadata *_ = topchunk_pool->metadata_allocated;
-                metadata *previous = NULL;
-                while(_ != NULL)
-                {
-                    if(_->next == current_meta)   
-                    {
-                        previous = _;
-                        break;
-                    }
-                    _ = _->next;
-                }
-                /* Si le bloc avait un suivant alors raccrocher son précédent avec son suivant pour l'enlever de la liste des éléments alloués */
-                if(previous != NULL)
-                {
-                    /* Le bloc avait un meta alloué précédent */
-                    if(current_meta->next != NULL)
-                    {
-                        /* Le bloc avait un meta alloué suivant et précédent */
-                        metadata *next_one = current_meta->next;
-                        previous->next = next_one;
-                    }
-                    else
-                    {
-                        /* Le bloc n'avait qu'un meta alloué précédent */
-                        topchunk_pool->metadata_allocated = previous;
-                        topchunk_pool->metadata_allocated->next = NULL;
-                    }
-                }
-                else
-                {
-                    /* Le bloc n'avait pas de meta alloué précédent */
-                    if(current_meta->next != NULL)
-                    {
-                        /* Le bloc n'avait qu'un meta alloué suivant */
-                        metadata *next_one = current_meta->next;
-                        topchunk_pool->metadata_allocated = next_one;
-                        next_one->next = NULL;
-                    }
-                    else
-                    {
-                        /* Le bloc n'avait ni de meta alloué suivant ni précédent */
-                        topchunk_pool->metadata_allocated = NULL;
-                    }
-                }
-            }
-            topchunk_pool->number_of_elements_allocated--;
-            topchunk_pool->number_of_elements_freed++;
-            return 1;
+static metadata *tree_remove(metadata *root, metadata *meta)
+{
+    if(root == meta) return tree_merge(TREE_LEFT(root), TREE_RIGHT(root));
+    if(tree_less(meta, root))
+        TREE_LEFT(root) = tree_remove(TREE_LEFT(root), meta);
+    else
+        TREE_RIGHT(root) = tree_remove(TREE_RIGHT(root), meta);
+    return root;
+}
+
+/* Le plus petit chunk d'au moins footprint octets, à l'adresse la plus basse à taille égale */
+static metadata *tree_best_fit(size_t footprint)
+{
+    metadata *best = NULL;
+    metadata *node = topchunk_pool->free_tree;
+    while(node != NULL)
+    {
+        if(node->size_of_chunk >= footprint)
+        {
+            best = node;
+            node = TREE_LEFT(node);
+        }
+        else
+        {
+            node = TREE_RIGHT(node);
         }
-    current_meta = current_meta->next;
     }
-    /* Not found or double free */
-    metadata *_ = topchunk_pool->free_metadata;
-    while(_ != NULL)
+    return best;
+}
+
+/* L'arbre est ordonné par taille : chercher une adresse revient à le parcourir. Parcours de Morris, sans pile ni
+   récursion quelle que soit la profondeur : le fils droit vide du prédécesseur pointe un temps vers le noeud à reprendre,
+   et chaque lien ainsi emprunté est remis à NULL avant la fin du parcours (on va donc toujours jusqu'au bout). */
+static metadata *tree_find_chunk(void *ptr)
+{
+    metadata *found = NULL;
+    metadata *node = topchunk_pool->free_tree;
+    while(node != NULL)
     {
-        if(_->chunk == ptr)
+        if(TREE_LEFT(node) != NULL)
         {
-            return 2;
+            metadata *predecessor = TREE_LEFT(node);
+            while(TREE_RIGHT(predecessor) != NULL && TREE_RIGHT(predecessor) != node) predecessor = TREE_RIGHT(predecessor);
+            if(TREE_RIGHT(predecessor) == NULL)
+            {
+                TREE_RIGHT(predecessor) = node;
+                node = TREE_LEFT(node);
+                continue;
+            }
+            TREE_RIGHT(predecessor) = NULL;
         }
-        _ = _->next_waiting;
+        if(node->chunk == ptr) found = node;
+        node = TREE_RIGHT(node);
     }
-    return 0;
+    return found;
 }
 
-void my_free(void *ptr) {
-    /* Pas de free(NULL) possible */
-    if(ptr == NULL)
+/* Met un chunk libre en tête de la liste des éléments libérés, ou dans l'arbre s'il est gros */
+static void link_free_metadata(metadata *meta)
+{
+    meta->free = MY_IS_FREE;
+    topchunk_pool->number_of_elements_freed++;
+    if(meta->size_of_chunk >= BEST_FIT_THRESHOLD)
     {
-        /* On tente de free NULL */
+        topchunk_pool->free_tree = tree_insert(topchunk_pool->free_tree, meta);
         return;
     }
-    if(topchunk_pool == NULL)
+    meta->next = NULL;
+    meta->next_waiting = topchunk_pool->free_metadata;
+    topchunk_pool->free_metadata = meta;
+}
+
+/* Retire un chunk libre de la liste des éléments libérés (previous est son précédent, NULL s'il est en tête)
+   ou de l'arbre. Sa taille ne doit pas avoir changé depuis link_free_metadata. */
+static void unlink_free_metadata(metadata *meta, metadata *previous)
+{
+    topchunk_pool->number_of_elements_freed--;
+    if(meta->size_of_chunk >= BEST_FIT_THRESHOLD)
     {
-        /* On tente de free alors que rien n'a été alloué */
+        topchunk_pool->free_tree = tree_remove(topchunk_pool->free_tree, meta);
+        meta->next = NULL;
+        meta->next_waiting = NULL;
         return;
     }
+    if(previous != NULL)
+        previous->next_waiting = meta->next_waiting;
+    else
+        topchunk_pool->free_metadata = meta->next_waiting;
+    meta->next_waiting = NULL;
+}
 
-    unsigned char found = find_element_to_free(ptr);
-    switch(found)
+/* Chunk libre qui commence à ptr, et son précédent s'il est dans la liste des petits chunks libres */
+static metadata *find_free_element(void *ptr, metadata **previous)
+{
+    metadata *prev = NULL;
+    metadata *current_meta = topchunk_pool->free_metadata;
+    while(current_meta != NULL)
     {
-        case 0:
-            /* not found */
-            logfile("??? %p is not found in allocated chunks ???\n",ptr);
-            break;
-        case 1:
-            /* found */
-            logfile("[+] Memory @ %p successfully freed.\n",ptr);
-            break;
-        case 2:
-            /* double free ! */
-            logfile("!!! VULN !!! : Double free detected for %p pointer\n",ptr);
-            exit(1);
-            break;
+        if(current_meta->chunk == ptr)
+        {
+            if(previous != NULL) *previous = prev;
+            return current_meta;
+        }
+        prev = current_meta;
+        current_meta = current_meta->next_waiting;
     }
+    if(previous != NULL) *previous = NULL;
+    return tree_find_chunk(ptr);
 }
 
-void *my_calloc(size_t nmemb, size_t size) {
-    size_t *ptr = NULL;
-    if(nmemb == 0 || size == 0)
+/* Chunk libre d'au moins footprint octets : first-fit parmi les petits, sinon best-fit parmi les gros.
+   previous est son précédent s'il vient de la liste. */
+static metadata *find_free_chunk(size_t footprint, metadata **previous)
+{
+    *previous = NULL;
+    if(footprint < BEST_FIT_THRESHOLD)
     {
-        ptr = my_malloc(ALIGNMENT);
-        memset(ptr,0,nmemb * size);
-        return ptr;
+        metadata *current_meta = topchunk_pool->free_metadata;
+        while(current_meta != NULL && current_meta->size_of_chunk < footprint)
+        {
+            *previous = current_meta;
+            current_meta = current_meta->next_waiting;
+        }
+        if(current_meta != NULL) return current_meta;
+        *previous = NULL;
     }
-
-    ptr = my_malloc(nmemb * size);
-    memset(ptr,0,nmemb * size);
-    logfile("[+] %zu bytes set to 0 @ %p\n",nmemb * size,ptr);
-    return ptr;
+    return tree_best_fit(footprint);
 }
 
-// void *my_realloc(void *ptr, size_t size) {
-//     if(ptr == NULL) {
-//         return my_malloc(size);
-//     }
+/* Découpe un chunk libre : les size premiers octets (+ canary) restent à meta, le reste devient un nouveau chunk libre.
+   Le reste hérite de l'état "connu à zéro" : le canary écrit par l'appelant est en dehors. */
+static metadata *split_free_chunk(metadata *meta, size_t size)
+{
+    metadata *new_frag_next = get_unused_metadata();
+    ARM_META_CANARY(new_frag_next);
+    new_frag_next->chunk = (void*)((size_t)meta->chunk + size + ALIGN(sizeof(size_t)));
+    new_frag_next->size_of_chunk = meta->size_of_chunk - (size + ALIGN(sizeof(size_t)));
+    new_frag_next->zero = meta->zero;
+    link_free_metadata(new_frag_next);
+    return new_frag_next;
+}
 
-//     if(size == 0) {
-//         my_free(ptr);
-//         return NULL;
-//     }
+/* Un chunk libre ne peut être fragmenté que si le reste peut contenir au moins ALIGNMENT octets et son canary */
+#define CAN_BE_SPLIT(footprint, size) ((footprint) >= (size) + 2 * ALIGN(sizeof(size_t)) + ALIGNMENT)
+
+/* Rend au noyau les pages entières d'un gros chunk libre : il redevient connu à zéro.
+   Les bords hors page sont mis à zéro à la main pour que tout le chunk le soit.
+   Avec les huge pages, seules des huge pages entières sont rendues : le noyau n'a pas à les couper. */
+/* Octets que purge_free_chunk rendrait au noyau pour ce chunk (0 s'il est propre ou trop petit) */
+static size_t purgeable_bytes(metadata *meta)
+{
+    size_t start = POOL_ALIGN((size_t)meta->chunk);
+    size_t end = ((size_t)meta->chunk + meta->size_of_chunk) & (~(POOL_GRANULARITY - 1));
+    if(meta->zero || end < start + PURGE_THRESHOLD) return 0;
+    return end - start;
+}
+
+/* Retourne le nombre d'octets rendus */
+static size_t purge_free_chunk(metadata *meta)
+{
+    size_t start = POOL_ALIGN((size_t)meta->chunk);
+    size_t end = ((size_t)meta->chunk + meta->size_of_chunk) & (~(POOL_GRANULARITY - 1));
+    if(meta->zero || end < start + PURGE_THRESHOLD) return 0;
+
+    /* Sur le fichier d'un tas persistant ou partagé, MADV_DONTNEED ne ferait que démapper : MADV_REMOVE libère ses blocs */
+    if(madvise((void*)start, end - start, topchunk_pool->persistent ? MADV_REMOVE : MADV_DONTNEED) == -1)
+    {
+        logfile("*** ERROR *** : madvise of freed chunk @ %p failed\n",meta->chunk);
+        return 0;
+    }
+    memset(meta->chunk, 0, start - (size_t)meta->chunk);
+    memset((void*)end, 0, (size_t)meta->chunk + meta->size_of_chunk - end);
+    meta->zero = 1;
+    MSM_PROBE2(purge, meta->chunk, end - start);
+    logfile("[+] %zu bytes of freed chunk @ %p purged\n",end - start,meta->chunk);
+    return end - start;
+}
+
+/* Decay (decay_ms dans MSM_CONF) : les pages d'un chunk libéré ne sont plus rendues tout de suite.
+   Les octets salis sont comptés par époque (decay_ms / MSM_DECAY_EPOCHS) ; à chaque nouvelle époque, seule une part
+   de chaque époque peut rester sale, de 1 pour la plus récente à 0 après decay_ms, selon une courbe en S (smoothstep).
+   Le surplus est rendu en commençant par les plus gros chunks libres : peu de madvise pour beaucoup de pages.
+   Pas de thread de fond : le decay avance sur les chemins lents (free, agrandissement de data_pool), sous le verrou
+   du tas, et par msm_decay() pour les programmes qui ont leur propre thread de maintenance. */
+#define DECAY_FIXED 1024
+
+static size_t decay_epoch_ms(void)
+{
+    size_t epoch = msm_config.decay_ms / MSM_DECAY_EPOCHS;
+    return (epoch != 0) ? epoch : 1;
+}
+
+/* Part (sur DECAY_FIXED) des octets salis il y a age époques qui peut encore rester sale : 1 - smoothstep */
+static size_t decay_allowed(size_t age)
+{
+    size_t x = (age + 1) * DECAY_FIXED / MSM_DECAY_EPOCHS;
+    size_t smooth = (3 * x * x * DECAY_FIXED - 2 * x * x * x) / (DECAY_FIXED * DECAY_FIXED);
+    return DECAY_FIXED - smooth;
+}
+
+/* Purge les gros chunks libres sales, du plus gros au plus petit, jusqu'à avoir rendu budget octets */
+static size_t purge_tree(metadata *node, size_t budget)
+{
+    size_t purged = 0;
+    while(node != NULL && purged < budget)
+    {
+        purged += purge_tree(TREE_RIGHT(node), budget - purged);
+        if(purged >= budget) break;
+        purged += purge_free_chunk(node);
+        node = TREE_LEFT(node);
+    }
+    return purged;
+}
+
+/* Passe aux époques écoulées et rend ce qui dépasse la courbe. Ne fait rien tant que l'époque en cours n'est pas finie. */
+static void decay_tick(topchunk *heap)
+{
+    size_t now = now_ms();
+    size_t elapsed = (now - heap->decay_epoch) / decay_epoch_ms();
+    if(elapsed == 0) return;
+
+    size_t dirty = 0;
+    for(size_t i = 0; i < MSM_DECAY_EPOCHS; i++) dirty += heap->decay_backlog[i];
+    heap->decay_epoch += elapsed * decay_epoch_ms();
+    /* Les époques plus vieilles que decay_ms sortent de l'anneau : leurs octets sont à rendre en entier */
+    for(size_t i = 0; i < elapsed && i < MSM_DECAY_EPOCHS; i++)
+    {
+        heap->decay_index = (heap->decay_index + 1) % MSM_DECAY_EPOCHS;
+        heap->decay_backlog[heap->decay_index] = 0;
+    }
+    /* Le cache des mappings vieillit au même rythme que les pages sales */
+    msm_mapcache_decay(now);
+    if(dirty == 0) return;
+
+    size_t limit = 0;
+    for(size_t age = 0; age < MSM_DECAY_EPOCHS; age++)
+    {
+        size_t index = (heap->decay_index + MSM_DECAY_EPOCHS - age) % MSM_DECAY_EPOCHS;
+        limit += heap->decay_backlog[index] / DECAY_FIXED * decay_allowed(age);
+    }
+    if(dirty <= limit) return;
+
+    size_t excess = dirty - limit;
+    size_t purged = purge_tree(heap->free_tree, excess);
+    if(purged != 0) logfile("[+] Decay : %zu of %zu dirty bytes purged\n",purged,dirty);
+
+    /* Le surplus est retiré des époques les plus anciennes : même les octets des chunks réutilisés depuis
+       (ils ne sont plus libres, il n'y avait rien à rendre) */
+    for(size_t age = MSM_DECAY_EPOCHS; age > 0 && excess != 0; age--)
+    {
+        size_t index = (heap->decay_index + MSM_DECAY_EPOCHS - (age - 1)) % MSM_DECAY_EPOCHS;
+        size_t taken = (heap->decay_backlog[index] < excess) ? heap->decay_backlog[index] : excess;
+        heap->decay_backlog[index] -= taken;
+        excess -= taken;
+    }
+}
+
+/* Les pages d'un chunk qui vient de redevenir libre : rendues tout de suite sans decay, sinon comptées comme sales */
+static void dirty_free_chunk(metadata *meta)
+{
+    if(msm_config.decay_ms == 0)
+    {
+        purge_free_chunk(meta);
+        return;
+    }
+    topchunk_pool->decay_backlog[topchunk_pool->decay_index] += purgeable_bytes(meta);
+    decay_tick(topchunk_pool);
+}
+
+#if MSM_HARDENING >= 2
+/* Sort les chunks les plus anciens de la quarantaine jusqu'à n'en garder que limit octets : ils redeviennent réutilisables */
+static size_t drain_quarantine(size_t limit)
+{
+    size_t released = 0;
+    while(topchunk_pool->quarantine_bytes > limit)
+    {
+        metadata *oldest = topchunk_pool->quarantine_head;
+        topchunk_pool->quarantine_head = oldest->next_waiting;
+        if(topchunk_pool->quarantine_head == NULL) topchunk_pool->quarantine_tail = NULL;
+        topchunk_pool->quarantine_bytes -= oldest->size_of_chunk;
+        released += oldest->size_of_chunk;
+        link_free_metadata(oldest);
+        dirty_free_chunk(oldest);
+    }
+    return released;
+}
+
+/* Quarantaine : un chunk libéré attend (file FIFO liée par next_waiting) que quarantine octets aient été libérés
+   après lui avant de redevenir réutilisable. Un use after free ne tombe donc pas tout de suite sur un autre objet. */
+static void quarantine_chunk(metadata *meta)
+{
+    meta->free = MY_IS_QUARANTINED;
+    meta->next = NULL;
+    meta->next_waiting = NULL;
+    if(topchunk_pool->quarantine_tail != NULL)
+        topchunk_pool->quarantine_tail->next_waiting = meta;
+    else
+        topchunk_pool->quarantine_head = meta;
+    topchunk_pool->quarantine_tail = meta;
+    topchunk_pool->quarantine_bytes += meta->size_of_chunk;
+    drain_quarantine(msm_config.quarantine);
+}
+
+static metadata *find_quarantined_element(void *ptr)
+{
+    metadata *current_meta = topchunk_pool->quarantine_head;
+    while(current_meta != NULL && current_meta->chunk != ptr)
+    {
+        current_meta = current_meta->next_waiting;
+    }
+    return current_meta;
+}
+#endif
+
+/* Un chunk qui vient d'être libéré : en quarantaine si elle est active, sinon tout de suite réutilisable */
+static void retire_free_chunk(metadata *meta)
+{
+#if MSM_HARDENING >= 2
+    if(msm_config.hardening >= 2 && msm_config.quarantine != 0)
+    {
+        quarantine_chunk(meta);
+        return;
+    }
+    /* Quarantaine coupée à chaud (opt.quarantine, opt.hardening) : ce qui restait en file redevient réutilisable,
+       sinon rewind_short_region ne pourrait plus jamais remettre sa région à zéro */
+    if(topchunk_pool->quarantine_head != NULL) drain_quarantine(0);
+#endif
+    link_free_metadata(meta);
+    dirty_free_chunk(meta);
+}
+
+size_t *verify_freed_block(size_t size, int *zero)
+{
+    if(topchunk_pool->number_of_elements_freed == 0) return NULL;
+
+    /* Chunk libre de taille suffisante (la taille d'un chunk libre inclut son canary) */
+    metadata *previous = NULL;
+    metadata *current_meta = find_free_chunk(size + ALIGN(sizeof(size_t)), &previous);
+    if(current_meta == NULL) return NULL;
+
+    unlink_free_metadata(current_meta, previous);
+    if(CAN_BE_SPLIT(current_meta->size_of_chunk, size))
+    {
+        /* Le bloc trouvé a une taille supérieure à la taille demandée : fragmentation du bloc */
+        metadata *new_frag_next = split_free_chunk(current_meta, size);
+        current_meta->size_of_chunk = size;
+        LATENCY_PATH(MSM_PATH_SPLIT);
+        logfile("[+] %zu bytes allocated @ %p\n └──> ",size,current_meta->chunk);
+        logfile("Chunk @ %p fragmented => new freed chunk created @ %p\n",current_meta,new_frag_next->chunk);
+    }
+    else
+    {
+        /* Le bloc trouvé a la taille parfaite (ou trop petite pour être fragmentée) : on le donne en entier */
+        current_meta->size_of_chunk -= ALIGN(sizeof(size_t));
+        LATENCY_PATH(MSM_PATH_REUSE);
+        logfile("[+] %zu bytes allocated @ %p\n",size,current_meta->chunk);
+    }
+
+    if(zero != NULL) *zero = (int)current_meta->zero;
+    current_meta->zero = 0;
+    ARM_META_CANARY(current_meta);
+    arm_chunk_canary(current_meta);
+    link_allocated_metadata(current_meta);
+    return current_meta->chunk;
+}
+
+/* Retourne 0 si le noyau refuse la croissance : meta_pool reste tel quel, l'appelant renonce à son allocation */
+int get_more_memory_mmap_metadata(size_t size)
+{
+    /* Augmenter de size (aligné sur une page, ou sur 2 Mo avec les huge pages !), et d'au moins growth % de la taille actuelle */
+    size_t more = POOL_ALIGN(size);
+    size_t minimum = POOL_ALIGN(topchunk_pool->total_size_metadata / 100 * msm_config.growth);
+    if(more < minimum) more = minimum;
+    if(more < size || topchunk_pool->total_size_metadata + more < more)
+    {
+        logfile("*** ERROR *** : %zu more bytes for topchunk_pool @ %p is too much\n",size,topchunk_pool);
+        return 0;
+    }
+    void *ptr = mremap(topchunk_pool,topchunk_pool->total_size_metadata, topchunk_pool->total_size_metadata + more, MREMAP_MAYMOVE);
+    if(ptr == MAP_FAILED)
+    {
+        logfile("*** ERROR *** : mremap for topchunk_pool @ %p failed, %zu more bytes refused\n",topchunk_pool,more);
+        return 0;
+    }
+    if(ptr != topchunk_pool)
+    {
+        logfile("*** ERROR *** : mremap for topchunk_pool failed\n");
+        perror("mmap meta_pool");
+        exit(1);
+    }
+    MSM_PROBE3(grow_meta, topchunk_pool, topchunk_pool->total_size_metadata, topchunk_pool->total_size_metadata + more);
+    topchunk_pool->total_size_metadata = topchunk_pool->total_size_metadata + more;
+    logfile("[+] Not enough memory for topchunk_pool @ %p : successfully mapped %zu more bytes\n",topchunk_pool,more);
+    return 1;
+}
+
+/* Retourne 0 si le noyau refuse la croissance : data_pool reste tel quel, l'appelant renonce à son allocation.
+   data_pool ne grandit que sur place (sans MREMAP_MAYMOVE) : déplacé, il emporterait tous les chunks distribués. */
+int get_more_memory_mmap_data(size_t size)
+{
+    /* Avant de demander plus de pages, le decay a peut-être des pages à rendre */
+    if(msm_config.decay_ms != 0) decay_tick(topchunk_pool);
+
+    /* Augmenter de size + ALIGN(sizeof(size_t)) pour le canary (aligné sur une page, ou sur 2 Mo avec les huge pages !) */
+    size_t wanted;
+    if(__builtin_add_overflow(topchunk_pool->total_size_data, size + ALIGN(sizeof(size_t)), &wanted) || wanted > 0x8000000000000000)
+    {
+        logfile("*** ERROR *** : %zu more bytes for data_pool @ %p is too much\n",size,data_pool);
+        return 0;
+    }
+    size_t new_aligned_size = POOL_ALIGN(wanted);
+    /* Et d'au moins growth % de la taille actuelle, pour espacer les mremap */
+    size_t minimum = topchunk_pool->total_size_data + POOL_ALIGN(topchunk_pool->total_size_data / 100 * msm_config.growth);
+    if(new_aligned_size < minimum) new_aligned_size = minimum;
+    if(mremap(data_pool,topchunk_pool->total_size_data, new_aligned_size, 0) == MAP_FAILED)
+    {
+        logfile("*** ERROR *** : mremap for data_pool @ %p failed, %zu more bytes refused\n",data_pool,new_aligned_size - topchunk_pool->total_size_data);
+        return 0;
+    }
+    size_t previous_size = topchunk_pool->total_size_data;
+    __atomic_store_n(&topchunk_pool->total_size_data, new_aligned_size, __ATOMIC_RELAXED);
+    MSM_PROBE3(grow_data, data_pool, previous_size, new_aligned_size);
+    logfile("[+] Not enough memory for data_pool @ %p : successfully mapped %zu more bytes\n",data_pool,new_aligned_size - previous_size);
+    return 1;
+}
+
+/* Taille du mapping d'un gros bloc : data + canary arrondis à la page, plus une page de garde */
+static size_t mapped_length(size_t size)
+{
+    return PAGE_ALIGN(size + ALIGN(sizeof(size_t))) + MY_PAGE_SIZE;
+}
+
+/* Un chunk aligné de data_pool est pris avec une marge d'alignement : elle compte pour choisir un mapping à part */
+static int is_mapped_request(size_t size, size_t alignment)
+{
+    /* Un mapping à part ne serait pas dans le fichier d'un tas persistant, ni visible des autres processus */
+    if(topchunk_pool != NULL && topchunk_pool->persistent) return 0;
+    if(alignment > msm_config.alignment) size += alignment + 2 * ALIGN(sizeof(size_t));
+    return size >= MAPPED_THRESHOLD;
+}
+
+/* Place le canary juste après les data et la page de garde PROT_NONE à la fin du mapping */
+static void arm_mapped_chunk(metadata *meta)
+{
+    size_t length = mapped_length(meta->size_of_chunk);
+#if MSM_HARDENING >= 1
+    size_t *canary = (size_t*)((size_t)meta->chunk + meta->size_of_chunk);
+    *canary = meta->canary_chunk;
+#endif
+    if(mprotect((void*)((size_t)meta->chunk + length - MY_PAGE_SIZE), MY_PAGE_SIZE, PROT_NONE) == -1)
+    {
+        logfile("*** ERROR *** : mprotect of guard page @ %p failed\n",(void*)((size_t)meta->chunk + length - MY_PAGE_SIZE));
+    }
+}
+
+/* Un gros bloc a son propre mapping : il peut être agrandi par mremap sans recopier les data.
+   zero (si non NULL) indique si le mapping est neuf, donc à zéro : un mapping repris du cache ne l'est pas. */
+static void *my_malloc_mapped(size_t size, size_t alignment, int *zero)
+{
+    LATENCY_PATH(MSM_PATH_MAPPED);
+    size_t length = mapped_length(size);
+    /* Les mappings du cache ne sont alignés que sur une page */
+    void *chunk = (alignment <= MY_PAGE_SIZE) ? msm_mapcache_take(length, topchunk_pool->node) : NULL;
+    if(zero != NULL) *zero = (chunk == NULL);
+    if(chunk == NULL)
+    {
+        /* Un mapping est aligné sur une page : pour un alignement plus fort, on mappe plus large et on rend les bords */
+        size_t extra = (alignment > MY_PAGE_SIZE) ? alignment - MY_PAGE_SIZE : 0;
+        void *mapping = mmap(NULL, length + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mapping == MAP_FAILED)
+        {
+            logfile("*** ERROR *** : mmap of %zu bytes for a mapped chunk failed\n",length + extra);
+            return NULL;
+        }
+        chunk = mapping;
+        if(extra != 0)
+        {
+            chunk = (void*)(((size_t)mapping + alignment - 1) & (~(alignment - 1)));
+            size_t head = (size_t)chunk - (size_t)mapping;
+            if(head != 0) munmap(mapping, head);
+            if(extra - head != 0) munmap((void*)((size_t)chunk + length), extra - head);
+        }
+        if(number_of_arenas > 1) msm_numa_bind(chunk, length, topchunk_pool->node);
+    }
+
+    metadata *meta = get_unused_metadata();
+    ARM_META_CANARY(meta);
+    DRAW_CHUNK_CANARY(meta);
+    meta->chunk = chunk;
+    meta->free = MY_IS_MAPPED;
+    meta->zero = 0;
+    meta->size_of_chunk = size;
+    meta->next_waiting = NULL;
+    meta->next = topchunk_pool->mapped_allocated;
+    topchunk_pool->mapped_allocated = meta;
+    arm_mapped_chunk(meta);
+
+    topchunk_pool->number_of_elements_mapped++;
+    topchunk_pool->total_size_mapped += length;
+    logfile("[+] %zu bytes mapped @ %p\n",size,chunk);
+    return chunk;
+}
+
+/* Recherche la meta d'un gros bloc vivant, et son précédent dans la liste pour pouvoir l'en retirer */
+static metadata *find_mapped_element(void *ptr, metadata **previous)
+{
+    metadata *prev = NULL;
+    metadata *current_meta = topchunk_pool->mapped_allocated;
+    while(current_meta != NULL)
+    {
+        if(current_meta->chunk == ptr)
+        {
+            if(previous != NULL) *previous = prev;
+            return current_meta;
+        }
+        prev = current_meta;
+        current_meta = current_meta->next;
+    }
+    return NULL;
+}
+
+/* Rend le mapping au noyau (ou le garde dans le cache des mappings) et met la meta de côté pour le prochain gros bloc */
+static void free_mapped(metadata *meta, metadata *previous)
+{
+    LATENCY_PATH(MSM_PATH_MAPPED);
+    size_t length = mapped_length(meta->size_of_chunk);
+    if(previous != NULL)
+        previous->next = meta->next;
+    else
+        topchunk_pool->mapped_allocated = meta->next;
+
+    if(!msm_mapcache_put(meta->chunk, length, topchunk_pool->node, now_ms()))
+    {
+        if(munmap(meta->chunk, length) == -1)
+        {
+            logfile("*** ERROR *** : munmap of mapped chunk @ %p failed\n",meta->chunk);
+        }
+        logfile("[+] Mapped memory @ %p (%zu bytes) successfully unmapped.\n",meta->chunk,length);
+    }
+
+    release_metadata(meta);
+    topchunk_pool->number_of_elements_mapped--;
+    topchunk_pool->total_size_mapped -= length;
+}
+
+/* Redimensionne un gros bloc en déplaçant les tables de pages (mremap) plutôt qu'en recopiant les data */
+static void *realloc_mapped(metadata *meta, size_t size)
+{
+    size_t old_length = mapped_length(meta->size_of_chunk);
+    size_t new_length = mapped_length(size);
+    void *old_chunk = meta->chunk;
+
+    if(size > meta->size_of_chunk)
+    {
+        /* L'ancien canary se retrouve dans les data : on l'efface pour ne pas le divulguer */
+        memset((void*)((size_t)old_chunk + meta->size_of_chunk), 0, ALIGN(sizeof(size_t)));
+    }
+
+    if(new_length != old_length)
+    {
+        /* La page de garde doit redevenir accessible : mremap ne déplace qu'un seul mapping homogène.
+           Elle n'a jamais été écrite, elle est donc toujours à zéro. */
+        if(mprotect((void*)((size_t)old_chunk + old_length - MY_PAGE_SIZE), MY_PAGE_SIZE, PROT_READ | PROT_WRITE) == -1)
+        {
+            logfile("*** ERROR *** : mprotect of guard page @ %p failed\n",(void*)((size_t)old_chunk + old_length - MY_PAGE_SIZE));
+            arm_mapped_chunk(meta);
+            return NULL;
+        }
+        void *chunk = mremap(old_chunk, old_length, new_length, MREMAP_MAYMOVE);
+        if(chunk == MAP_FAILED)
+        {
+            logfile("*** ERROR *** : mremap of mapped chunk @ %p failed\n",old_chunk);
+            /* Le bloc d'origine est intact : on remet son canary et sa page de garde */
+            arm_mapped_chunk(meta);
+            return NULL;
+        }
+        meta->chunk = chunk;
+        topchunk_pool->total_size_mapped += new_length;
+        topchunk_pool->total_size_mapped -= old_length;
+    }
+
+    meta->size_of_chunk = size;
+    DRAW_CHUNK_CANARY(meta);
+    arm_mapped_chunk(meta);
+    logfile("[+] Mapped chunk @ %p remapped to %zu bytes @ %p\n",old_chunk,size,meta->chunk);
+    return meta->chunk;
+}
+
+/* Vérifie qu'il reste de la place dans meta_pool pour records nouvelles meta
+   (2 pour une allocation : le cas extrême de la fragmentation de data).
+   Retourne 0 si meta_pool est plein et ne peut pas grandir (tas persistant, ou refus du noyau). */
+static int reserve_metadata(size_t records)
+{
+    size_t needed;
+    if(__builtin_mul_overflow(records, ALIGN(sizeof(metadata)), &needed)
+       || __builtin_add_overflow(needed, topchunk_pool->current_size_metadata, &needed))
+    {
+        logfile("*** ERROR *** : %zu metadata records cannot fit in topchunk_pool @ %p\n",records,(void*)topchunk_pool);
+        return 0;
+    }
+    if(needed > topchunk_pool->total_size_metadata)
+    {
+        if(topchunk_pool->persistent)
+        {
+            logfile("*** ERROR *** : meta_pool of persistent heap @ %p is full\n",(void*)topchunk_pool);
+            return 0;
+        }
+        /* on demande + de mémoire pour meta_pool avec mremap */
+        return get_more_memory_mmap_metadata(needed - topchunk_pool->total_size_metadata);
+    }
+    return 1;
+}
+
+/* Une meta pour RESERVE_RECORD_BYTES octets réservés : la taille moyenne supposée des chunks */
+#define RESERVE_RECORD_BYTES 256
+
+/* Fait entrer en mémoire les pages de [start, end) : MADV_POPULATE_WRITE (Linux 5.14), sinon une écriture par page */
+static void prefault_range(size_t start, size_t end, unsigned flags)
+{
+    start &= ~(MY_PAGE_SIZE - 1);
+    end = PAGE_ALIGN(end);
+    if(start >= end) return;
+    if(flags & MSM_RESERVE_WILLNEED) madvise((void*)start, end - start, MADV_WILLNEED);
+    if(!(flags & MSM_RESERVE_POPULATE)) return;
+#ifdef MADV_POPULATE_WRITE
+    if(madvise((void*)start, end - start, MADV_POPULATE_WRITE) == 0) return;
+#endif
+    /* La première page peut contenir des chunks : chaque octet touché est réécrit avec sa propre valeur */
+    for(size_t page = start; page < end; page += MY_PAGE_SIZE)
+    {
+        volatile char *byte = (volatile char*)page;
+        *byte = *byte;
+    }
+}
+
+/* Prépare le tas courant pour bytes octets de chunks de plus : data_pool et meta_pool agrandis d'avance (aucun mremap
+   sur le chemin de malloc), puis leurs pages annoncées ou fautées selon flags.
+   Retourne -1 si le tas a une taille fixe trop petite (tas persistant ou partagé) ou si le noyau refuse de l'agrandir. */
+static int reserve_pools(size_t bytes, unsigned flags)
+{
+    if(bytes > 0x8000000000000000 - ALIGNMENT) return -1;
+    size_t records = bytes / RESERVE_RECORD_BYTES + 2;
+    if(!reserve_metadata(records)) return -1;
+    size_t available = topchunk_pool->total_size_data - topchunk_pool->current_size_data;
+    if(bytes > available)
+    {
+        if(topchunk_pool->persistent)
+        {
+            logfile("*** ERROR *** : data_pool of persistent heap @ %p cannot reserve %zu bytes\n",(void*)topchunk_pool,bytes);
+            return -1;
+        }
+        if(!get_more_memory_mmap_data(bytes - available)) return -1;
+    }
+
+    size_t meta_start = (size_t)meta_pool + topchunk_pool->current_size_metadata;
+    size_t data_start = (size_t)data_pool + topchunk_pool->current_size_data;
+    prefault_range(meta_start, meta_start + records * ALIGN(sizeof(metadata)), flags);
+    prefault_range(data_start, data_start + bytes, flags);
+    logfile("[+] %zu bytes reserved in heap @ %p%s\n",bytes,(void*)topchunk_pool,(flags & MSM_RESERVE_POPULATE) ? " (prefaulted)" : "");
+    return 0;
+}
+
+/* Réservation de MSM_CONF (reserve, prefault) pour une arène qui vient d'être créée et sélectionnée */
+static void reserve_new_arena(void)
+{
+    static const unsigned prefault_flags[] = { 0, MSM_RESERVE_WILLNEED, MSM_RESERVE_POPULATE };
+    if(msm_config.reserve != 0) reserve_pools(msm_config.reserve, prefault_flags[msm_config.prefault]);
+}
+
+/* Arène du thread : une de celles du nœud où il tourne (les arènes n, n + nœuds, n + 2 * nœuds...),
+   choisie parmi elles selon l'ordre d'arrivée du thread. Elle est sélectionnée sous son verrou. */
+static void select_thread_arena(void)
+{
+    if(private_heap != NULL)
+    {
+        use_heap(private_heap);
+        return;
+    }
+    if(!pools_ready() && init_pools())
+    {
+        use_heap(arenas[0]);
+        reserve_new_arena();
+    }
+    if(number_of_arenas == 1)
+    {
+        use_heap(arenas[0]);
+        return;
+    }
+
+    size_t nodes = msm_numa_node_count();
+    size_t first = msm_numa_current_node() % number_of_arenas;
+    size_t count = (number_of_arenas - first + nodes - 1) / nodes;
+    if(thread_slot == (size_t)-1)
+    {
+        thread_slot = __atomic_fetch_add(&next_thread_slot, 1, __ATOMIC_RELAXED);
+    }
+    size_t index = first + nodes * (thread_slot % count);
+    topchunk *heap = arena_heap(index);
+    if(heap == NULL)
+    {
+        /* Deux threads peuvent arriver ensemble sur une arène qui n'existe pas encore : un seul la crée */
+        int created = 0;
+        release_heap();
+        pthread_mutex_lock(&arenas_lock);
+        heap = arenas[index];
+        if(heap == NULL)
+        {
+            heap = create_heap(index % nodes);
+            __atomic_store_n(&arenas[index], heap, __ATOMIC_RELEASE);
+            logfile("[+] Arena %zu created for node %zu\n",index,index % nodes);
+            created = 1;
+        }
+        pthread_mutex_unlock(&arenas_lock);
+        if(created)
+        {
+            use_heap(heap);
+            reserve_new_arena();
+        }
+    }
+    use_heap(heap);
+}
+
+/* ptr est dans le data_pool de heap. total_size_data ne fait que grandir : une valeur lue sans le verrou du tas
+   couvre au moins les chunks que l'appelant a reçus. */
+static int heap_contains(topchunk *heap, void *ptr)
+{
+    return heap != NULL && (size_t)ptr >= (size_t)heap->data_pool
+           && (size_t)ptr < (size_t)heap->data_pool + __atomic_load_n(&heap->total_size_data, __ATOMIC_RELAXED);
+}
+
+/* Partition qui contient ptr : elle est sélectionnée sous son verrou, sinon 0 est retourné */
+static int select_owner_partition(void *ptr)
+{
+    for(size_t id = 1; id < MSM_PARTITIONS; id++)
+    {
+        topchunk *heap = partition_heap(id);
+        if(heap_contains(heap, ptr))
+        {
+            use_heap(heap);
+            return 1;
+        }
+    }
+    for(size_t id = 1; id < MSM_PARTITIONS; id++)
+    {
+        topchunk *heap = partition_heap(id);
+        if(heap == NULL) continue;
+        use_heap(heap);
+        if(find_mapped_element(ptr, NULL) != NULL) return 1;
+    }
+    return 0;
+}
+
+/* Arène qui contient ptr, sélectionnée sous son verrou : un chunk peut être libéré par un thread d'un autre nœud
+   que celui qui l'a alloué, et un chunk d'une partition par free() */
+static void select_owner_arena(void *ptr)
+{
+    if(private_heap != NULL)
+    {
+        use_heap(private_heap);
+        return;
+    }
+    if(__atomic_load_n(&number_of_partitions, __ATOMIC_ACQUIRE) != 0 && select_owner_partition(ptr)) return;
+
+    for(size_t i = 0; i < number_of_arenas; i++)
+    {
+        topchunk *heap = arena_heap(i);
+        if(heap_contains(heap, ptr))
+        {
+            use_heap(heap);
+            return;
+        }
+    }
+    for(size_t i = 1; i < number_of_arenas; i++)
+    {
+        topchunk *heap = arena_heap(i);
+        if(heap == NULL) continue;
+        use_heap(heap);
+        if(find_mapped_element(ptr, NULL) != NULL) return;
+    }
+    /* Chunk de l'arène 0, ou pointeur inconnu de toutes les arènes : il sera signalé par l'arène 0 */
+    use_heap(arenas[0]);
+}
+
+size_t msm_numa_nodes(void) {
+    return msm_numa_node_count();
+}
+
+int msm_numa_node_stats(size_t node, msm_node_stats *stats) {
+    if(stats == NULL || node >= msm_numa_node_count()) return -1;
+
+    memset(stats, 0, sizeof(msm_node_stats));
+    for(size_t i = 0; i < msm_arena_count(); i++)
+    {
+        topchunk *heap = arena_heap(i);
+        if(heap == NULL || heap->node != node) continue;
+        msm_heap_lock(heap);
+        stats->arenas++;
+        stats->data_bytes += heap->total_size_data;
+        stats->used_bytes += heap->current_size_data;
+        stats->allocated_chunks += heap->number_of_elements_allocated;
+        stats->mapped_chunks += heap->number_of_elements_mapped;
+        stats->mapped_bytes += heap->total_size_mapped;
+        msm_heap_unlock(heap);
+    }
+    return 0;
+}
+
+/* Les arènes vues de l'extérieur de ce fichier (instantanés, statistiques) */
+size_t msm_arena_count(void) {
+    return pools_ready() ? number_of_arenas : 0;
+}
+
+topchunk *msm_arena(size_t index) {
+    return (index < msm_arena_count()) ? arena_heap(index) : NULL;
+}
+
+topchunk *msm_partition(size_t id) {
+    return (id < MSM_PARTITIONS) ? partition_heap(id) : NULL;
+}
+
+/* Rien n'a pu être alloué tant que ni les arènes ni un tas privé nommé par l'appelant n'existent */
+static int heap_in_use(void)
+{
+    return private_heap != NULL || pools_ready();
+}
+
+/* Partition du tas sélectionné (MSM_PARTITION_DEFAULT pour une arène ou un tas privé) */
+static unsigned partition_of(topchunk *heap)
+{
+    for(unsigned id = 1; id < MSM_PARTITIONS; id++)
+    {
+        if(partition_heap(id) == heap) return id;
+    }
+    return MSM_PARTITION_DEFAULT;
+}
+
+static int write_all(int fd, const void *buffer, size_t length)
+{
+    while(length > 0)
+    {
+        ssize_t written = write(fd, buffer, length);
+        if(written == -1 && errno == EINTR) continue;
+        if(written <= 0) return -1;
+        buffer = (const char*)buffer + written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/* Nombre de chunks d'une arène : les meta de meta_pool qui ont un chunk */
+static size_t count_dump_chunks(topchunk *heap)
+{
+    size_t count = 0;
+    metadata *records = (metadata*)((size_t)heap + ALIGN(sizeof(topchunk)));
+    for(size_t i = 0; i < heap->current_size_metadata / ALIGN(sizeof(metadata)); i++)
+    {
+        metadata *meta = (metadata*)((size_t)records + i * ALIGN(sizeof(metadata)));
+        if(meta->free != MY_IS_UNUSED) count++;
+    }
+    return count;
+}
+
+/* Instantané binaire des metadata (format dans my_secmalloc_dump.h) : ni malloc ni stdio,
+   il peut donc être pris depuis un handler de signal. meta_pool est parcouru comme un tableau :
+   pas de liste à suivre, même si le signal tombe au milieu d'une opération. */
+int msm_dump_heap(const char *path) {
+    if(path == NULL) return -1;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd == -1) return -1;
+
+    msm_dump_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MSM_DUMP_MAGIC, sizeof(MSM_DUMP_MAGIC));
+    header.version = MSM_DUMP_VERSION;
+    header.page_size = (uint32_t)MY_PAGE_SIZE;
+    header.alignment = msm_config.alignment;
+    for(size_t a = 0; a < number_of_arenas; a++)
+    {
+        if(arenas[a] != NULL) header.arenas++;
+    }
+    int error = write_all(fd, &header, sizeof(header));
+
+    msm_dump_chunk chunks[128];
+    for(size_t a = 0; a < number_of_arenas && error == 0; a++)
+    {
+        topchunk *heap = arenas[a];
+        if(heap == NULL) continue;
+        msm_dump_arena arena = {
+            .index = a,
+            .node = heap->node,
+            .data_pool = (uint64_t)(size_t)heap->data_pool,
+            .total_size_data = heap->total_size_data,
+            .current_size_data = heap->current_size_data,
+            .chunks = count_dump_chunks(heap),
+        };
+        error = write_all(fd, &arena, sizeof(arena));
+
+        size_t buffered = 0;
+        size_t remaining = arena.chunks;
+        metadata *records = (metadata*)((size_t)heap + ALIGN(sizeof(topchunk)));
+        for(size_t i = 0; i < heap->current_size_metadata / ALIGN(sizeof(metadata)) && remaining > 0 && error == 0; i++)
+        {
+            metadata *meta = (metadata*)((size_t)records + i * ALIGN(sizeof(metadata)));
+            if(meta->free == MY_IS_UNUSED) continue;
+            msm_dump_chunk *chunk = &chunks[buffered++];
+            chunk->offset = (meta->free == MY_IS_MAPPED) ? (uint64_t)(size_t)meta->chunk : (uint64_t)((size_t)meta->chunk - (size_t)heap->data_pool);
+            chunk->size = meta->size_of_chunk;
+            chunk->state = (uint8_t)meta->free;
+            chunk->zero = (uint8_t)meta->zero;
+            chunk->size_class = (meta->size_of_chunk == 0) ? 0 : (uint8_t)(63 - __builtin_clzll(meta->size_of_chunk));
+            chunk->reserved = 0;
+            chunk->arena = (uint32_t)a;
+            remaining--;
+            if(buffered == sizeof(chunks) / sizeof(chunks[0]) || remaining == 0)
+            {
+                error = write_all(fd, chunks, buffered * sizeof(msm_dump_chunk));
+                buffered = 0;
+            }
+        }
+    }
+
+    if(close(fd) == -1) error = -1;
+    return error;
+}
+
+/* zero (si non NULL) indique si le chunk rendu est connu à zéro : jamais distribué, fraîchement mappé ou purgé */
+static void *malloc_internal(size_t size, int *zero) {
+    if(zero != NULL) *zero = 0;
+    /* Si la taille dépasse la taille maximale d'un objet allouable avec l'alignement derrière */
+    if(size > 0x8000000000000000 - ALIGNMENT) return NULL;
+    /* Permet d'aligner la taille sur 8 ou 4 octets, et permet d'allouer au minimum 8 ou 4 octets pour une taille nulle */
+    size = (size == 0) ? ALIGN(1) : ALIGN(size);
+
+    /* Si le top_chunk n'a jamais été crée, alors le créer (tout premier malloc du programme),
+       puis travailler dans l'arène du nœud du thread */
+    select_thread_arena();
+
+    if(!reserve_metadata(2)) return NULL;
+
+    if(is_mapped_request(size, msm_config.alignment))
+    {
+        /* Gros bloc : servi par son propre mapping, hors de data_pool, à zéro s'il ne vient pas du cache */
+        return my_malloc_mapped(size, msm_config.alignment, zero);
+    }
+
+    size_t *freed_block = verify_freed_block(size, zero);
+    if(freed_block != NULL)
+    {
+        return freed_block;
+    }
+
+    if(topchunk_pool->current_size_data + ALIGN(sizeof(size_t)) + size > topchunk_pool->total_size_data)
+    {
+        if(topchunk_pool->persistent)
+        {
+            /* Le fichier d'un tas persistant a sa taille fixée à la création */
+            logfile("*** ERROR *** : data_pool of persistent heap @ %p is full, %zu bytes refused\n",(void*)topchunk_pool,size);
+            return NULL;
+        }
+        /* on demande + de mémoire pour data_pool avec mremap */
+        if(!get_more_memory_mmap_data(size)) return NULL;
+        LATENCY_PATH(MSM_PATH_GROW);
+    }
+    else
+    {
+        LATENCY_PATH(MSM_PATH_TOP);
+        /* Chemin lent (aucun chunk libre ne convenait) : le decay avance aussi quand le programme ne libère plus rien */
+        if(msm_config.decay_ms != 0) decay_tick(topchunk_pool);
+    }
+
+    /* Ajout du metadata à la fin de la liste */
+    metadata *new_meta = get_unused_metadata();
+    ARM_META_CANARY(new_meta);
+    new_meta->chunk = data_pool + topchunk_pool->current_size_data;
+    new_meta->zero = 0;
+    new_meta->size_of_chunk = size; /* data sans le canary */
+    topchunk_pool->current_size_data += size + ALIGN(sizeof(size_t));
+    link_allocated_metadata(new_meta);
+    arm_chunk_canary(new_meta);
+    MSM_PROBE2(carve, new_meta->chunk, size);
+    logfile("[+] %zu bytes allocated @ %p\n",size,new_meta->chunk);
+
+    /* Au-delà de current_size_data, data_pool n'a jamais été distribué : le chunk est encore à zéro */
+    if(zero != NULL) *zero = 1;
+    return new_meta->chunk;
+}
+
+void *my_malloc(size_t size) {
+    MSM_PROBE1(malloc_entry, size);
+    uint64_t start = LATENCY_START();
+    void *ptr = NULL;
+#if MSM_HARDENING >= 3
+    /* Échantillonnage : le chemin normal ne paie que la décrémentation du décompte du thread */
+    if(__builtin_expect(--msm_sample_countdown == 0, 0))
+    {
+        /* Un tas privé est rendu d'un bloc à sa destruction : rien de ce qu'il sert ne va dans le pool gardé */
+        if(private_heap == NULL)
+        {
+            ptr = msm_sampled_malloc(size);
+            LATENCY_PATH(MSM_PATH_SAMPLED);
+        }
+        else
+        {
+            msm_sample_countdown = 1;
+        }
+    }
+#endif
+    if(ptr == NULL)
+    {
+        begin_call();
+        ptr = malloc_internal(size, NULL);
+        end_call();
+    }
+    LATENCY_STOP(MSM_OP_MALLOC, start);
+    MSM_PROBE2(malloc_return, ptr, size);
+    return ptr;
+}
+
+/* Rend le surplus d'un chunk occupé de data_pool sous forme de chunk libre, s'il est assez grand */
+static void shrink_allocated_chunk(metadata *meta, size_t size)
+{
+    size_t footprint = meta->size_of_chunk + ALIGN(sizeof(size_t));
+    if(!CAN_BE_SPLIT(footprint, size)) return;
+
+    meta->size_of_chunk = footprint;
+    split_free_chunk(meta, size);
+    meta->size_of_chunk = size;
+    arm_chunk_canary(meta);
+}
+
+static void *aligned_alloc_internal(size_t alignment, size_t size) {
+    if(size > 0x8000000000000000 - ALIGNMENT || alignment > 0x8000000000000000 - ALIGNMENT - size) return NULL;
+    size = (size == 0) ? ALIGN(1) : ALIGN(size);
+
+    select_thread_arena();
+    /* 2 pour malloc_internal, 2 pour le début non aligné et le surplus : tout est réservé avant de prendre le chunk */
+    if(!reserve_metadata(4)) return NULL;
+
+    if(is_mapped_request(size, alignment))
+    {
+        return my_malloc_mapped(size, alignment, NULL);
+    }
+
+    /* Chunk de data_pool pris avec une marge : le début non aligné devient un chunk libre d'au moins 16 octets */
+    size_t *chunk = malloc_internal(size + alignment + 2 * ALIGN(sizeof(size_t)), NULL);
+    if(chunk == NULL) return NULL;
+    /* malloc_internal met toujours le chunk de data_pool en tête des éléments alloués */
+    metadata *meta = topchunk_pool->metadata_allocated;
+    reserve_metadata(2);
+
+    if(((size_t)chunk & (alignment - 1)) != 0)
+    {
+        size_t aligned = ((size_t)chunk + 2 * ALIGN(sizeof(size_t)) + alignment - 1) & (~(alignment - 1));
+        size_t head = aligned - (size_t)chunk;
+        metadata *head_meta = get_unused_metadata();
+        ARM_META_CANARY(head_meta);
+        head_meta->chunk = chunk;
+        head_meta->size_of_chunk = head;
+        head_meta->zero = 0;
+        link_free_metadata(head_meta);
+
+        meta->chunk = (void*)aligned;
+        meta->size_of_chunk -= head;
+    }
+    shrink_allocated_chunk(meta, size);
+    logfile("[+] %zu bytes aligned on %zu allocated @ %p\n",size,alignment,meta->chunk);
+    return meta->chunk;
+}
+
+void *my_aligned_alloc(size_t alignment, size_t size) {
+    /* L'alignement doit être une puissance de 2 */
+    if(alignment == 0 || (alignment & (alignment - 1)) != 0) return NULL;
+    if(alignment <= msm_config.alignment) return my_malloc(size);
+    MSM_PROBE1(malloc_entry, size);
+    uint64_t start = LATENCY_START();
+    begin_call();
+    void *ptr = aligned_alloc_internal(alignment, size);
+    end_call();
+    LATENCY_STOP(MSM_OP_MALLOC, start);
+    MSM_PROBE2(malloc_return, ptr, size);
+    return ptr;
+}
+
+/* Recherche la meta d'un chunk occupé de data_pool, et son précédent dans la liste pour pouvoir l'en retirer */
+static metadata *find_allocated_element(void *ptr, metadata **previous)
+{
+    metadata *prev = NULL;
+    metadata *current_meta = topchunk_pool->metadata_allocated;
+    while(current_meta != NULL)
+    {
+        if(current_meta->chunk == ptr)
+        {
+            if(previous != NULL) *previous = prev;
+            return current_meta;
+        }
+        prev = current_meta;
+        current_meta = current_meta->next;
+    }
+    return NULL;
+}
+
+/* Un chunk occupé de data_pool devient libre (previous est son précédent dans la liste des éléments alloués) */
+static void unlink_allocated_metadata(metadata *current_meta, metadata *previous)
+{
+    /* Retirer le bloc de la liste des éléments alloués */
+    if(previous != NULL)
+        previous->next = current_meta->next;
+    else
+        topchunk_pool->metadata_allocated = current_meta->next;
+    current_meta->next = NULL;
+    topchunk_pool->number_of_elements_allocated--;
+}
+
+static void free_allocated_element(metadata *current_meta, metadata *previous)
+{
+    unlink_allocated_metadata(current_meta, previous);
+
+    /* Ajouter à la taille du bloc free le canary de fin : il redevient sale */
+    current_meta->size_of_chunk += ALIGN(sizeof(size_t));
+    current_meta->zero = 0;
+    retire_free_chunk(current_meta);
+}
+
+unsigned char find_element_to_free(void *ptr)
+{
+    metadata *previous = NULL;
+    metadata *current_meta = find_allocated_element(ptr, &previous);
+    if(current_meta != NULL)
+    {
+        check_chunk_canary(current_meta);
+        free_allocated_element(current_meta, previous);
+        return 1;
+    }
+    /* Not found or double free */
+    if(find_free_element(ptr, NULL) != NULL)
+    {
+        return 2;
+    }
+#if MSM_HARDENING >= 2
+    if(find_quarantined_element(ptr) != NULL)
+    {
+        return 2;
+    }
+#endif
+    return 0;
+}
+
+static void report_free(void *ptr, unsigned char found)
+{
+    switch(found)
+    {
+        case 0:
+            /* not found */
+            logfile("??? %p is not found in allocated chunks ???\n",ptr);
+            break;
+        case 1:
+            /* found */
+            logfile("[+] Memory @ %p successfully freed.\n",ptr);
+            break;
+        case 2:
+            /* double free ! */
+            logfile("!!! VULN !!! : Double free detected for %p pointer\n",ptr);
+            exit(1);
+            break;
+    }
+}
+
+/* Région des chunks à courte durée de vie : quand son dernier chunk est libéré, toutes ses pages sont rendues au noyau
+   et les chunks suivants sont de nouveau découpés depuis le début de data_pool. Un chunk gardé plus longtemps que prévu
+   retarde la remise à zéro, sans jamais trouer les pages des autres régions. */
+static void rewind_short_region(void)
+{
+    topchunk *heap = topchunk_pool;
+    if(heap == NULL || heap != partition_heap(MSM_PARTITION_SHORT) || heap->current_size_data == 0) return;
+    /* Un chunk en quarantaine ne doit pas être réutilisé avant son tour */
+    if(heap->number_of_elements_allocated != 0 || heap->number_of_elements_mapped != 0 || heap->quarantine_head != NULL) return;
+
+    size_t used = POOL_ALIGN(heap->current_size_data);
+    /* Sans MADV_DONTNEED, les pages ne seraient pas à zéro pour les prochains chunks découpés au sommet */
+    if(madvise(heap->data_pool, used, MADV_DONTNEED) == -1)
+    {
+        logfile("*** ERROR *** : madvise of short-lived region @ %p failed\n",(void*)heap);
+        return;
+    }
+    heap->current_size_data = 0;
+    heap->current_size_metadata = 0;
+    heap->number_of_elements_freed = 0;
+    heap->free_metadata = NULL;
+    heap->free_tree = NULL;
+    heap->metadata_allocated = NULL;
+    heap->unused_metadata = NULL;
+    memset(heap->decay_backlog, 0, sizeof(heap->decay_backlog));
+    MSM_PROBE2(purge, heap->data_pool, used);
+    logfile("[+] Short-lived region @ %p emptied : %zu bytes purged\n",(void*)heap,used);
+}
+
+static void free_internal(void *ptr) {
+    /* Pas de free(NULL) possible */
+    if(ptr == NULL)
+    {
+        /* On tente de free NULL */
+        return;
+    }
+#if MSM_HARDENING >= 3
+    if(msm_guarded_owns(ptr))
+    {
+        LATENCY_PATH(MSM_PATH_SAMPLED);
+        msm_guarded_free(ptr);
+        return;
+    }
+#endif
+    if(!heap_in_use())
+    {
+        /* On tente de free alors que rien n'a été alloué */
+        return;
+    }
+    /* Le tas du chunk n'est sélectionné que le temps du free : un chunk de partition ne doit pas y entraîner malloc */
+    topchunk *current = topchunk_pool;
+    select_owner_arena(ptr);
+
+    metadata *previous = NULL;
+    metadata *mapped = find_mapped_element(ptr, &previous);
+    if(mapped != NULL)
+    {
+        check_chunk_canary(mapped);
+        free_mapped(mapped, previous);
+    }
+    else
+    {
+        report_free(ptr, find_element_to_free(ptr));
+    }
+    rewind_short_region();
+    restore_heap(current);
+}
+
+void my_free(void *ptr) {
+    MSM_PROBE1(free_entry, ptr);
+    /* free(NULL) n'est pas mesuré */
+    uint64_t start = (ptr != NULL) ? LATENCY_START() : 0;
+    LATENCY_PATH(MSM_PATH_RELEASE);
+    begin_call();
+    free_internal(ptr);
+    end_call();
+    LATENCY_STOP(MSM_OP_FREE, start);
+    MSM_PROBE1(free_return, ptr);
+}
+
+#if MSM_HARDENING >= 1
+/* La taille donnée par l'appelant doit être celle qui a produit ce chunk (au surplus non fragmentable près)
+   et le canary de fin doit être intact : sinon on ne fait pas confiance à l'appelant */
+static void check_sized_chunk(metadata *meta, size_t size)
+{
+    if(size > meta->size_of_chunk || CAN_BE_SPLIT(meta->size_of_chunk + ALIGN(sizeof(size_t)), size))
+    {
+        logfile("!!! VULN !!! : Size %zu given to free_sized does not match the %zu bytes chunk @ %p\n",size,meta->size_of_chunk,meta->chunk);
+        exit(1);
+    }
+    check_chunk_canary(meta);
+}
+#endif
+
+/* free dont l'appelant connaît la taille (et l'alignement) : la taille choisit la liste où chercher le chunk (gros blocs
+   mappés ou data_pool), puis elle est vérifiée contre le chunk trouvé. Ce n'est pas un raccourci : la liste est parcourue
+   comme pour free, les metadata étant hors des chunks, rien ne mène d'une adresse à sa meta sans la chercher. */
+static void free_aligned_sized_internal(void *ptr, size_t alignment, size_t size) {
+    if(ptr == NULL)
+    {
+        return;
+    }
+#if MSM_HARDENING >= 3
+    if(msm_guarded_owns(ptr))
+    {
+        LATENCY_PATH(MSM_PATH_SAMPLED);
+        msm_guarded_free(ptr);
+        return;
+    }
+#endif
+    if(!heap_in_use())
+    {
+        return;
+    }
+    topchunk *current = topchunk_pool;
+    select_owner_arena(ptr);
+
+    size = (size == 0) ? ALIGN(1) : ALIGN(size);
+    metadata *previous = NULL;
+    int mapped = is_mapped_request(size, alignment);
+    metadata *meta = mapped ? find_mapped_element(ptr, &previous) : find_allocated_element(ptr, &previous);
+    if(meta == NULL)
+    {
+        /* La taille donnée ne correspond pas à la liste du chunk : recherche dans l'autre liste */
+        mapped = !mapped;
+        meta = mapped ? find_mapped_element(ptr, &previous) : find_allocated_element(ptr, &previous);
+    }
+    if(meta == NULL)
+    {
+        /* Pas un chunk vivant : pointeur inconnu ou double free */
+        report_free(ptr, find_element_to_free(ptr));
+        restore_heap(current);
+        return;
+    }
+
+#if MSM_HARDENING >= 1
+    if(msm_config.hardening >= 1) check_sized_chunk(meta, size);
+#endif
+    if(mapped)
+    {
+        free_mapped(meta, previous);
+    }
+    else
+    {
+        free_allocated_element(meta, previous);
+        report_free(ptr, 1);
+    }
+    rewind_short_region();
+    restore_heap(current);
+}
+
+void my_free_aligned_sized(void *ptr, size_t alignment, size_t size) {
+    MSM_PROBE1(free_entry, ptr);
+    uint64_t start = (ptr != NULL) ? LATENCY_START() : 0;
+    LATENCY_PATH(MSM_PATH_RELEASE);
+    begin_call();
+    free_aligned_sized_internal(ptr, alignment, size);
+    end_call();
+    LATENCY_STOP(MSM_OP_FREE, start);
+    MSM_PROBE1(free_return, ptr);
+}
+
+void my_free_sized(void *ptr, size_t size) {
+    my_free_aligned_sized(ptr, msm_config.alignment, size);
+}
+
+void *my_calloc(size_t nmemb, size_t size) {
+    size_t total;
+    if(__builtin_mul_overflow(nmemb, size, &total))
+    {
+        return NULL;
+    }
+
+    MSM_PROBE1(malloc_entry, total);
+    uint64_t start = LATENCY_START();
+    void *ptr = NULL;
+#if MSM_HARDENING >= 3
+    /* Un chunk échantillonné a une page à lui, rendue au noyau à chaque free : il est à zéro */
+    if(__builtin_expect(--msm_sample_countdown == 0, 0))
+    {
+        ptr = msm_sampled_malloc(total);
+        LATENCY_PATH(MSM_PATH_SAMPLED);
+    }
+#endif
+
+    if(ptr == NULL)
+    {
+        int zero = 0;
+        begin_call();
+        ptr = malloc_internal(total, &zero);
+        end_call();
+        /* Chunk connu à zéro : pas de memset, les pages restent adossées à la page zéro du noyau */
+        if(ptr != NULL && !zero)
+        {
+            memset(ptr,0,total);
+            logfile("[+] %zu bytes set to 0 @ %p\n",total,ptr);
+        }
+    }
+    LATENCY_STOP(MSM_OP_CALLOC, start);
+    MSM_PROBE2(malloc_return, ptr, total);
+    return ptr;
+}
+
+// void *my_realloc(void *ptr, size_t size) {
+//     if(ptr == NULL) {
+//         return my_malloc(size);
+//     }
+
+//     if(size == 0) {
+//         my_free(ptr);
+//         return NULL;
+//     }
 
 //     metadata *current_meta = topchunk_pool->metadata_allocated;
 
@@ -789,7 +2122,88 @@ void *my_calloc(size_t nmemb, size_t size) {
 //     }
 // }
 
-void *my_realloc(void *ptr, size_t size) {
+/* Nouveau chunk d'un realloc qui ne peut pas se faire sur place : le tas sélectionné est celui du chunk d'origine,
+   le nouveau chunk reste dans la même partition */
+static void *malloc_like_owner(size_t size)
+{
+    unsigned id = (__atomic_load_n(&number_of_partitions, __ATOMIC_ACQUIRE) != 0) ? partition_of(topchunk_pool) : MSM_PARTITION_DEFAULT;
+    return (id != MSM_PARTITION_DEFAULT) ? msm_malloc_partition(size, id) : my_malloc(size);
+}
+
+/* realloc dans le tas du chunk, déjà sélectionné */
+static void *realloc_in_owner(void *ptr, size_t size) {
+    metadata *mapped = find_mapped_element(ptr, NULL);
+    if(mapped != NULL) {
+        check_chunk_canary(mapped);
+        if(ALIGN(size) >= MAPPED_THRESHOLD) {
+            /* Gros bloc qui reste gros : mremap, aucune copie des data */
+            return realloc_mapped(mapped, ALIGN(size));
+        }
+        /* Le bloc redevient petit : recopie dans data_pool */
+        void *new_ptr = malloc_like_owner(size);
+        if(new_ptr != NULL) {
+            memcpy(new_ptr, ptr, size);
+            my_free(ptr);
+        }
+        return new_ptr;
+    }
+
+    // Rechercher le meta correspondant au pointeur fourni
+    metadata *current_meta = find_allocated_element(ptr, NULL);
+    if(current_meta == NULL) {
+        // Pointeur non trouvé
+        return NULL;
+    }
+    check_chunk_canary(current_meta);
+
+    size = ALIGN(size);
+    if(!is_mapped_request(size, msm_config.alignment)) {
+        if(!reserve_metadata(2)) return NULL;
+        if(size <= current_meta->size_of_chunk) {
+            // Rétrécissement sur place : le surplus devient un chunk libre s'il est assez grand
+            shrink_allocated_chunk(current_meta, size);
+            return ptr;
+        }
+
+        // Vérifier si le bloc qui suit immédiatement en mémoire est libre et de taille suffisante
+        void *end_of_chunk = (void*)((size_t)current_meta->chunk + current_meta->size_of_chunk + ALIGN(sizeof(size_t)));
+        metadata *previous = NULL;
+        metadata *next_meta = find_free_element(end_of_chunk, &previous);
+        if(next_meta != NULL && current_meta->size_of_chunk + next_meta->size_of_chunk >= size) {
+            // Fusionner les blocs : l'ancien canary se retrouve dans les data, on l'efface pour ne pas le divulguer
+            memset(end_of_chunk - ALIGN(sizeof(size_t)), 0, ALIGN(sizeof(size_t)));
+            size_t footprint = current_meta->size_of_chunk + ALIGN(sizeof(size_t)) + next_meta->size_of_chunk;
+            unlink_free_metadata(next_meta, previous);
+            if(CAN_BE_SPLIT(footprint, size)) {
+                // Le surplus du bloc suivant reste libre, avec sa meta
+                next_meta->chunk = (void*)((size_t)current_meta->chunk + size + ALIGN(sizeof(size_t)));
+                next_meta->size_of_chunk = footprint - (size + ALIGN(sizeof(size_t)));
+                link_free_metadata(next_meta);
+                current_meta->size_of_chunk = size;
+            } else {
+                release_metadata(next_meta);
+                current_meta->size_of_chunk = footprint - ALIGN(sizeof(size_t));
+            }
+
+            // Mettre à jour le canary du bloc fusionné
+            arm_chunk_canary(current_meta);
+            logfile("[+] Chunk @ %p extended in place to %zu bytes\n",ptr,current_meta->size_of_chunk);
+            return ptr;
+        }
+    }
+
+    // Si la fusion n'est pas possible, allouer un nouveau bloc (dans la même partition) et copier les données.
+    // La taille est lue avant : malloc peut rendre le verrou de ce tas pour prendre celui de l'arène du thread
+    size_t old_size = current_meta->size_of_chunk;
+    void *new_ptr = malloc_like_owner(size);
+    if(new_ptr != NULL) {
+        memcpy(new_ptr, ptr, (old_size < size) ? old_size : size);
+        my_free(ptr);
+    }
+    return new_ptr;
+}
+
+static void *realloc_internal(void *ptr, size_t size) {
     if(ptr == NULL) {
         return my_malloc(size);
     }
@@ -799,50 +2213,552 @@ void *my_realloc(void *ptr, size_t size) {
         return NULL;
     }
 
-    metadata *current_meta = topchunk_pool->metadata_allocated;
-
-    // Rechercher le meta correspondant au pointeur fourni
-    while(current_meta != NULL) {
-        if(current_meta->chunk == ptr) {
-            break;
+#if MSM_HARDENING >= 3
+    if(msm_guarded_owns(ptr)) {
+        /* Chunk échantillonné : toujours recopié, sa page ne peut pas grandir */
+        size_t old_size = msm_guarded_size(ptr);
+        if(old_size == 0) {
+            msm_guarded_free(ptr);
+            return NULL;
         }
-        current_meta = current_meta->next;
+        void *new_ptr = my_malloc(size);
+        if(new_ptr != NULL) {
+            memcpy(new_ptr, ptr, (old_size < size) ? old_size : size);
+            msm_guarded_free(ptr);
+        }
+        return new_ptr;
     }
+#endif
 
-    if(current_meta == NULL) {
-        // Pointeur non trouvé
+    if(!heap_in_use()) {
         return NULL;
     }
 
-    // Vérifier si le bloc suivant est libre et de taille suffisante
-    metadata *next_meta = (metadata*)((size_t)current_meta + ALIGN(sizeof(metadata)));
-    if(next_meta != NULL && next_meta->free == MY_IS_FREE && (current_meta->size_of_chunk + next_meta->size_of_chunk + ALIGN(sizeof(size_t)) >= size)) {
-        // Fusionner les blocs
-        current_meta->size_of_chunk += next_meta->size_of_chunk;
+    if(size > 0x8000000000000000 - ALIGNMENT) return NULL;
+    /* Le tas du chunk n'est sélectionné que le temps du realloc */
+    topchunk *current = topchunk_pool;
+    select_owner_arena(ptr);
+    void *new_ptr = realloc_in_owner(ptr, size);
+    restore_heap(current);
+    return new_ptr;
+}
+
+/* Un realloc qui déplace le chunk déclenche aussi malloc_entry/return et free_entry/return entre ses deux points,
+   et compte aussi dans les histogrammes de malloc et de free */
+void *my_realloc(void *ptr, size_t size) {
+    MSM_PROBE2(realloc_entry, ptr, size);
+    uint64_t start = LATENCY_START();
+    begin_call();
+    void *new_ptr = realloc_internal(ptr, size);
+    end_call();
+    LATENCY_PATH((new_ptr == ptr) ? MSM_PATH_INPLACE : MSM_PATH_MOVED);
+    LATENCY_STOP(MSM_OP_REALLOC, start);
+    MSM_PROBE3(realloc_return, ptr, new_ptr, size);
+    return new_ptr;
+}
+
+/* Nombre de canary tirés par appel au générateur lors d'une allocation par lot (2 par chunk) */
+#define BATCH_CANARIES 512
+/* Nombre de pointeurs triés ensemble lors d'une libération par lot */
+#define BATCH_FREE 256
+
+size_t msm_malloc_batch(size_t size, size_t n, void **out) {
+    if(n == 0 || out == NULL) return 0;
+    if(size > 0x8000000000000000 - ALIGNMENT) return 0;
+    size = (size == 0) ? ALIGN(1) : ALIGN(size);
 
-        // Mettre à jour les liens
-        current_meta->next_waiting = next_meta->next_waiting;
-        if(next_meta->next_waiting != NULL) {
-            next_meta->next_waiting->next_waiting = current_meta;
+    size_t footprint = size + ALIGN(sizeof(size_t));
+    size_t run;
+    if(is_mapped_request(size, msm_config.alignment) || __builtin_mul_overflow(n, footprint, &run) || run > 0x8000000000000000)
+    {
+        /* Gros blocs : un mapping chacun, pas de run contigu possible */
+        size_t i;
+        for(i = 0; i < n; i++)
+        {
+            out[i] = my_malloc(size);
+            if(out[i] == NULL) break;
         }
+        return i;
+    }
 
-        topchunk_pool->number_of_elements_freed--;
+    begin_call();
+    select_thread_arena();
+    /* Toutes les meta du lot d'un coup : une seule croissance de meta_pool. Sans elles, rien n'est pris du tas. */
+    if(!reserve_metadata(n))
+    {
+        end_call();
+        return 0;
+    }
 
-        // Mettre à jour le canary du bloc fusionné
-        current_meta->canary_chunk = get_random_canary();
-        size_t *canary = (size_t*)((size_t)current_meta->chunk + current_meta->size_of_chunk);
-        *canary = current_meta->canary_chunk;
+    /* Run contigu pour tout le lot : un chunk libre assez grand, sinon le haut de data_pool */
+    void *base;
+    size_t surplus = 0;
+    metadata *previous = NULL;
+    metadata *current_meta = find_free_chunk(run, &previous);
+    if(current_meta != NULL)
+    {
+        unlink_free_metadata(current_meta, previous);
+        base = current_meta->chunk;
+        if(current_meta->size_of_chunk - run >= 2 * ALIGN(sizeof(size_t)))
+        {
+            /* Le reste du chunk libre garde sa meta */
+            current_meta->chunk = (void*)((size_t)base + run);
+            current_meta->size_of_chunk -= run;
+            link_free_metadata(current_meta);
+        }
+        else
+        {
+            /* Reste trop petit : il est donné au dernier chunk du lot */
+            surplus = current_meta->size_of_chunk - run;
+            release_metadata(current_meta);
+        }
+    }
+    else
+    {
+        if(topchunk_pool->current_size_data + run > topchunk_pool->total_size_data)
+        {
+            /* on demande + de mémoire pour data_pool avec mremap, une seule fois pour le lot.
+               Refusé : aucune liste n'a encore été touchée, le lot n'est pas alloué */
+            if(!get_more_memory_mmap_data(run))
+            {
+                end_call();
+                return 0;
+            }
+        }
+        base = data_pool + topchunk_pool->current_size_data;
+        topchunk_pool->current_size_data += run;
+    }
 
-        return ptr;
-    } else {
-        // Si la fusion n'est pas possible, allouer un nouveau bloc et copier les données
-        void *new_ptr = my_malloc(size);
-        if(new_ptr != NULL) {
-            memcpy(new_ptr, ptr, current_meta->size_of_chunk);
-            my_free(ptr);
+#if MSM_HARDENING >= 1
+    size_t canaries[BATCH_CANARIES];
+#endif
+    for(size_t i = 0; i < n; i++)
+    {
+        metadata *meta = get_unused_metadata();
+        meta->chunk = (void*)((size_t)base + i * footprint);
+        meta->size_of_chunk = (i == n - 1) ? size + surplus : size;
+        meta->zero = 0;
+        link_allocated_metadata(meta);
+#if MSM_HARDENING >= 1
+        size_t k = (2 * i) % BATCH_CANARIES;
+        if(k == 0)
+        {
+            size_t remaining = 2 * (n - i);
+            fill_random_canaries(canaries, (remaining < BATCH_CANARIES) ? remaining : BATCH_CANARIES);
+        }
+        meta->canary = canaries[k];
+        meta->canary_chunk = canaries[k + 1];
+        size_t *canary = (size_t*)((size_t)meta->chunk + meta->size_of_chunk);
+        *canary = meta->canary_chunk;
+#endif
+        out[i] = meta->chunk;
+    }
+    logfile("[+] %zu chunks of %zu bytes allocated in a run @ %p\n",n,size,base);
+    end_call();
+    return n;
+}
+
+void msm_free_batch(void **ptrs, size_t n) {
+    if(ptrs == NULL || !heap_in_use()) return;
+
+    begin_call();
+    topchunk *current = topchunk_pool;
+    void *sorted[BATCH_FREE];
+    metadata *found[BATCH_FREE];
+    for(size_t start = 0; start < n; start += BATCH_FREE)
+    {
+        /* Les pointeurs du paquet sont triés (tri par insertion, sans malloc) */
+        size_t count = 0;
+        for(size_t i = start; i < n && i < start + BATCH_FREE; i++)
+        {
+            if(ptrs[i] == NULL) continue;
+            size_t j = count++;
+            while(j > 0 && (size_t)sorted[j - 1] > (size_t)ptrs[i])
+            {
+                sorted[j] = sorted[j - 1];
+                j--;
+            }
+            sorted[j] = ptrs[i];
+        }
+        if(count == 0) continue;
+        memset(found, 0, count * sizeof(metadata*));
+        /* Le paquet est libéré dans l'arène de son premier pointeur, les autres passent par my_free */
+        select_owner_arena(sorted[0]);
+
+        /* Un seul parcours de la liste des éléments alloués pour tout le paquet */
+        size_t remaining = count;
+        metadata *previous = NULL;
+        metadata *current_meta = topchunk_pool->metadata_allocated;
+        while(current_meta != NULL && remaining > 0)
+        {
+            metadata *next = current_meta->next;
+            size_t low = 0, high = count;
+            while(low < high)
+            {
+                size_t middle = low + (high - low) / 2;
+                if((size_t)sorted[middle] < (size_t)current_meta->chunk) low = middle + 1;
+                else high = middle;
+            }
+            if(low < count && sorted[low] == current_meta->chunk && found[low] == NULL)
+            {
+                check_chunk_canary(current_meta);
+                found[low] = current_meta;
+                remaining--;
+                unlink_allocated_metadata(current_meta, previous);
+                logfile("[+] Memory @ %p successfully freed.\n",sorted[low]);
+            }
+            else
+            {
+                previous = current_meta;
+            }
+            current_meta = next;
+        }
+
+        /* Les chunks libérés ensemble et contigus en mémoire redeviennent un seul chunk libre :
+           le prochain lot peut y reprendre un run d'un seul tenant */
+        metadata *run = NULL;
+        for(size_t i = 0; i < count; i++)
+        {
+            if(found[i] == NULL) continue;
+            metadata *meta = found[i];
+            meta->size_of_chunk += ALIGN(sizeof(size_t));
+            if(run != NULL && (size_t)run->chunk + run->size_of_chunk == (size_t)meta->chunk)
+            {
+                run->size_of_chunk += meta->size_of_chunk;
+                release_metadata(meta);
+                continue;
+            }
+            if(run != NULL)
+            {
+                retire_free_chunk(run);
+            }
+            run = meta;
+            run->zero = 0;
+        }
+        if(run != NULL)
+        {
+            retire_free_chunk(run);
+        }
+        rewind_short_region();
+
+        /* Les pointeurs restants : gros blocs, pointeurs inconnus ou double free */
+        for(size_t i = 0; i < count && remaining > 0; i++)
+        {
+            if(found[i] == NULL)
+            {
+                remaining--;
+                my_free(sorted[i]);
+            }
+        }
+    }
+    restore_heap(current);
+    end_call();
+}
+
+/* Tas privés : chacun a ses pools, son secret de canary et ses statistiques, comme une arène,
+   mais il n'est servi qu'à qui le nomme et se rend au noyau d'un seul coup */
+static topchunk *enter_private_heap(topchunk *heap)
+{
+    /* Le tas est verrouillé pendant tout l'appel : contre les autres processus pour un tas partagé,
+       contre les autres threads sinon */
+    begin_call();
+    topchunk *previous = topchunk_pool;
+    private_heap = heap;
+    use_heap(heap);
+    return previous;
+}
+
+static void leave_private_heap(topchunk *previous)
+{
+    private_heap = NULL;
+    restore_heap(previous);
+    end_call();
+}
+
+msm_heap_t *msm_heap_create(void) {
+    msm_conf_init();
+    topchunk *heap = create_heap(msm_numa_current_node());
+    logfile("[+] Private heap created @ %p\n",heap);
+    return heap;
+}
+
+void *msm_heap_malloc(msm_heap_t *heap, size_t size) {
+    if(heap == NULL) return NULL;
+    topchunk *previous = enter_private_heap(heap);
+    void *ptr = malloc_internal(size, NULL);
+    leave_private_heap(previous);
+    return ptr;
+}
+
+void *msm_heap_aligned_alloc(msm_heap_t *heap, size_t alignment, size_t size) {
+    if(heap == NULL) return NULL;
+    topchunk *previous = enter_private_heap(heap);
+    void *ptr = my_aligned_alloc(alignment, size);
+    leave_private_heap(previous);
+    return ptr;
+}
+
+void msm_heap_free(msm_heap_t *heap, void *ptr) {
+    if(heap == NULL || ptr == NULL) return;
+    topchunk *previous = enter_private_heap(heap);
+    my_free(ptr);
+    leave_private_heap(previous);
+}
+
+void *msm_heap_realloc(msm_heap_t *heap, void *ptr, size_t size) {
+    if(heap == NULL) return NULL;
+    topchunk *previous = enter_private_heap(heap);
+    void *new_ptr = my_realloc(ptr, size);
+    leave_private_heap(previous);
+    return new_ptr;
+}
+
+/* Tous les chunks du tas disparaissent avec lui : gros blocs, data_pool puis topchunk_pool (et meta_pool).
+   Le verrou du tas attend seulement la fin d'un appel déjà commencé par un autre thread, et seul le thread appelant
+   oublie le tas : le détruire pendant qu'un autre thread s'en sert encore (ou s'en servira) est indéfini. */
+void msm_heap_destroy(msm_heap_t *heap) {
+    if(heap == NULL) return;
+    begin_call();
+    topchunk *previous = topchunk_pool;
+    use_heap(heap);
+    size_t chunks = heap->number_of_elements_allocated + heap->number_of_elements_mapped;
+    if(!heap->persistent)
+    {
+        metadata *mapped = heap->mapped_allocated;
+        while(mapped != NULL)
+        {
+            metadata *next = mapped->next;
+            if(munmap(mapped->chunk, mapped_length(mapped->size_of_chunk)) == -1)
+            {
+                logfile("*** ERROR *** : munmap of mapped chunk @ %p failed\n",mapped->chunk);
+            }
+            mapped = next;
+        }
+        if(munmap(heap->data_pool, heap->total_size_data) == -1)
+        {
+            logfile("*** ERROR *** : munmap of data_pool @ %p failed\n",heap->data_pool);
         }
-        return new_ptr;
     }
+    /* Le verrou vit dans le tas (ou dans l'en-tête d'un tas persistant) : rendu avant de le démapper.
+       Ce thread ne doit plus sélectionner le tas ensuite. */
+    release_heap();
+    if(private_heap == heap) private_heap = NULL;
+    restore_heap((previous != heap) ? previous : NULL);
+    end_call();
+
+    if(heap->persistent == MY_HEAP_FILE)
+    {
+        /* Le fichier garde les chunks : détruire un tas persistant revient à le fermer */
+        msm_heap_close(heap);
+        return;
+    }
+    if(heap->persistent == MY_HEAP_SHARED)
+    {
+        /* Les autres processus gardent le segment : ce processus s'en détache seulement */
+        msm_shm_detach(heap);
+        return;
+    }
+    pthread_mutex_destroy(&heap->lock);
+    if(munmap(heap, heap->total_size_metadata) == -1)
+    {
+        logfile("*** ERROR *** : munmap of topchunk_pool @ %p failed\n",(void*)heap);
+    }
+    logfile("[+] Private heap @ %p destroyed with its %zu chunks\n",(void*)heap,chunks);
+}
+
+/* Un tas persistant rouvert : l'horloge du decay repart de zéro (CLOCK_MONOTONIC ne survit pas au processus).
+   Avec rebuild (le tas n'a pas été fermé proprement, ou un processus est mort en tenant le verrou d'un tas partagé), les listes, l'arbre, la quarantaine et les compteurs
+   sont reconstruits en un seul parcours de meta_pool : seuls l'état, le chunk et la taille de chaque meta sont crus,
+   une meta dont le chunk sort de data_pool (écrite à moitié) redevient inutilisée.
+   Retourne le nombre de chunks occupés. */
+size_t msm_heap_reattach(topchunk *heap, int rebuild) {
+    /* Le verrou enregistré vient d'un autre processus, peut-être mort en le tenant */
+    pthread_mutex_init(&heap->lock, NULL);
+    heap->decay_epoch = now_ms();
+    heap->decay_index = 0;
+    memset(heap->decay_backlog, 0, sizeof(heap->decay_backlog));
+    if(!rebuild) return heap->number_of_elements_allocated;
+
+    /* Pas enter_private_heap : le verrou d'un tas partagé est déjà tenu par l'appelant */
+    topchunk *previous = topchunk_pool;
+    select_heap(heap);
+    heap->number_of_elements_allocated = 0;
+    heap->number_of_elements_freed = 0;
+    heap->free_metadata = NULL;
+    heap->free_tree = NULL;
+    heap->quarantine_head = NULL;
+    heap->quarantine_tail = NULL;
+    heap->quarantine_bytes = 0;
+    heap->metadata_allocated = NULL;
+    heap->mapped_allocated = NULL;
+    heap->unused_metadata = NULL;
+    heap->number_of_elements_mapped = 0;
+    heap->total_size_mapped = 0;
+
+    size_t start = (size_t)heap->data_pool;
+    size_t end = start + heap->total_size_data;
+    size_t data_end = 0;
+    size_t dropped = 0;
+    for(size_t offset = 0; offset < heap->current_size_metadata; offset += ALIGN(sizeof(metadata)))
+    {
+        metadata *meta = (metadata*)((size_t)meta_pool + offset);
+        size_t chunk = (size_t)meta->chunk;
+        /* La taille d'un chunk libre inclut son canary, pas celle d'un chunk occupé */
+        size_t footprint = meta->size_of_chunk + ((meta->free == MY_IS_BUSY) ? ALIGN(sizeof(size_t)) : 0);
+        int live = meta->free == MY_IS_BUSY || meta->free == MY_IS_FREE || meta->free == MY_IS_QUARANTINED;
+        if(!live || chunk < start || chunk >= end || meta->size_of_chunk == 0 || footprint > end - chunk)
+        {
+            if(meta->free != MY_IS_UNUSED) dropped++;
+            release_metadata(meta);
+            continue;
+        }
+        if(chunk + footprint - start > data_end) data_end = chunk + footprint - start;
+        if(meta->free == MY_IS_BUSY)
+        {
+            link_allocated_metadata(meta);
+        }
+        else
+        {
+            /* Un chunk en quarantaine est rendu : l'arrêt brutal a de toute façon coupé sa durée de quarantaine */
+            meta->zero = 0;
+            link_free_metadata(meta);
+        }
+    }
+    if(heap->current_size_data < data_end) heap->current_size_data = data_end;
+    restore_heap(previous);
+    logfile("[+] Persistent heap @ %p rebuilt : %zu busy chunks, %zu free chunks, %zu torn records dropped\n",(void*)heap,heap->number_of_elements_allocated,heap->number_of_elements_freed,dropped);
+    return heap->number_of_elements_allocated;
+}
+
+/* Fait avancer le decay de toutes les arènes et partitions, même si aucun chemin lent n'est pris */
+void msm_decay(void) {
+    if(msm_config.decay_ms == 0 || !pools_ready()) return;
+    begin_call();
+    topchunk *current = topchunk_pool;
+    for(size_t i = 0; i < number_of_arenas; i++)
+    {
+        topchunk *heap = arena_heap(i);
+        if(heap == NULL) continue;
+        use_heap(heap);
+        decay_tick(heap);
+    }
+    for(size_t id = 1; id < MSM_PARTITIONS; id++)
+    {
+        topchunk *heap = partition_heap(id);
+        if(heap == NULL) continue;
+        use_heap(heap);
+        decay_tick(heap);
+    }
+    restore_heap(current);
+    end_call();
+}
+
+int msm_reserve(size_t bytes, unsigned flags) {
+    begin_call();
+    select_thread_arena();
+    int reserved = reserve_pools(bytes, flags);
+    end_call();
+    return reserved;
+}
+
+/* Rend au noyau toutes les pages sales des gros chunks libres d'un tas, sans attendre le decay (arena.N.purge) */
+size_t msm_heap_purge(topchunk *heap) {
+    begin_call();
+    topchunk *current = topchunk_pool;
+    use_heap(heap);
+    size_t purged = purge_tree(heap->free_tree, ~(size_t)0);
+    memset(heap->decay_backlog, 0, sizeof(heap->decay_backlog));
+    restore_heap(current);
+    end_call();
+    logfile("[+] %zu bytes purged from heap @ %p\n",purged,(void*)heap);
+    return purged;
+}
+
+/* Ramène la quarantaine d'un tas sous le réglage courant (0 si elle est coupée) après un changement de
+   opt.quarantine ou opt.hardening : retourne le nombre d'octets sortis de la file */
+size_t msm_heap_drain_quarantine(topchunk *heap) {
+    size_t released = 0;
+#if MSM_HARDENING >= 2
+    begin_call();
+    topchunk *current = topchunk_pool;
+    use_heap(heap);
+    released = drain_quarantine((msm_config.hardening >= 2) ? msm_config.quarantine : 0);
+    rewind_short_region();
+    restore_heap(current);
+    end_call();
+#else
+    (void)heap;
+#endif
+    return released;
+}
+
+/* Vérifie le canary de chaque chunk occupé et de chaque gros bloc d'un tas (heap.check) : retourne le nombre de chunks vus.
+   Un canary écrasé termine le processus, comme au free. */
+size_t msm_heap_check(topchunk *heap) {
+    msm_heap_lock(heap);
+    size_t checked = 0;
+    for(metadata *meta = heap->metadata_allocated; meta != NULL; meta = meta->next, checked++)
+    {
+        check_chunk_canary(meta);
+    }
+    for(metadata *meta = heap->mapped_allocated; meta != NULL; meta = meta->next, checked++)
+    {
+        check_chunk_canary(meta);
+    }
+    msm_heap_unlock(heap);
+    return checked;
+}
+
+/* Chunk pris dans le tas de la partition id : un débordement n'y atteint que des objets de la même famille.
+   Il est libéré par free(), qui retrouve sa partition. */
+void *msm_malloc_partition(size_t size, unsigned id) {
+    if(id >= MSM_PARTITIONS) return NULL;
+    if(id == MSM_PARTITION_DEFAULT) return my_malloc(size);
+    if(!pools_ready()) init_pools();
+    topchunk *heap = partition_heap(id);
+    if(heap == NULL)
+    {
+        release_heap();
+        pthread_mutex_lock(&arenas_lock);
+        heap = partitions[id];
+        if(heap == NULL)
+        {
+            heap = create_heap(msm_numa_current_node());
+            __atomic_store_n(&partitions[id], heap, __ATOMIC_RELEASE);
+            __atomic_fetch_add(&number_of_partitions, 1, __ATOMIC_RELEASE);
+            logfile("[+] Partition %u created @ %p\n",id,(void*)heap);
+        }
+        pthread_mutex_unlock(&arenas_lock);
+    }
+    topchunk *previous = enter_private_heap(heap);
+    void *ptr = malloc_internal(size, NULL);
+    leave_private_heap(previous);
+    return ptr;
+}
+
+/* La durée de vie choisit la région avant la fréquence d'accès : c'est elle qui décide quand ses pages se vident */
+void *msm_malloc_hinted(size_t size, unsigned hints) {
+    if((hints & (MSM_HINT_SHORT | MSM_HINT_LONG)) == (MSM_HINT_SHORT | MSM_HINT_LONG)) return NULL;
+    if((hints & (MSM_HINT_HOT | MSM_HINT_COLD)) == (MSM_HINT_HOT | MSM_HINT_COLD)) return NULL;
+    if(hints & MSM_HINT_SHORT) return msm_malloc_partition(size, MSM_PARTITION_SHORT);
+    if(hints & MSM_HINT_COLD) return msm_malloc_partition(size, MSM_PARTITION_COLD);
+    if(hints & MSM_HINT_LONG) return msm_malloc_partition(size, MSM_PARTITION_LONG);
+    /* Chaud ou sans indication : avec les chunks de malloc, dans l'arène du thread */
+    return my_malloc(size);
+}
+
+int msm_heap_get_stats(msm_heap_t *heap, msm_heap_stats *stats) {
+    if(heap == NULL || stats == NULL) return -1;
+    msm_heap_lock(heap);
+    stats->data_bytes = heap->total_size_data;
+    stats->used_bytes = heap->current_size_data;
+    stats->metadata_bytes = heap->total_size_metadata;
+    stats->allocated_chunks = heap->number_of_elements_allocated;
+    stats->free_chunks = heap->number_of_elements_freed;
+    stats->mapped_chunks = heap->number_of_elements_mapped;
+    stats->mapped_bytes = heap->total_size_mapped;
+    msm_heap_unlock(heap);
+    return 0;
 }
 
 // Fonctions pour bibliothèque dynamique
@@ -866,4 +2782,28 @@ __attribute__((visibility("default")))
 void *realloc(void *ptr, size_t size) {
     return my_realloc(ptr, size);
 }
+
+__attribute__((visibility("default")))
+void free_sized(void *ptr, size_t size) {
+    my_free_sized(ptr, size);
+}
+
+__attribute__((visibility("default")))
+void free_aligned_sized(void *ptr, size_t alignment, size_t size) {
+    my_free_aligned_sized(ptr, alignment, size);
+}
+
+__attribute__((visibility("default")))
+void *aligned_alloc(size_t alignment, size_t size) {
+    return my_aligned_alloc(alignment, size);
+}
+
+__attribute__((visibility("default")))
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if(alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+    void *ptr = my_aligned_alloc(alignment, size);
+    if(ptr == NULL) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
 #endif
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "my_secmalloc.private.h"
+#include "my_secmalloc_probes.h"
+#include <stdlib.h>
+
+/* Arènes à pointeur (bump) : des blocs sont pris au tas principal, puis découpés en avançant un curseur.
+   Pas de free individuel : mark/rewind reviennent à un point donné, reset revient au début.
+   Les blocs ne sont rendus qu'à la destruction et resservent après un rewind ou un reset.
+
+   Bloc : [bump_block][data ......................][canary] */
+
+typedef struct bump_block
+{
+    struct bump_block *next;   // bloc suivant (déjà utilisé avant un rewind, ou encore vierge)
+    char *end;                 // fin des data : le canary du bloc est juste après
+} bump_block;
+
+struct msm_bump_arena
+{
+    char *cursor;              // prochain octet libre du bloc courant
+    char *end;                 // fin des data du bloc courant
+    bump_block *current;       // bloc courant
+    bump_block *first;         // premier bloc : un reset y revient
+    size_t block_size;         // taille des data d'un bloc ordinaire
+    size_t canary;             // canary écrit à la fin de chaque bloc (0 : pas de canary)
+};
+
+#define BLOCK_HEADER ((sizeof(bump_block) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+#define BLOCK_DATA(block) ((char*)(block) + BLOCK_HEADER)
+#define DEFAULT_BLOCK_SIZE (MY_PAGE_SIZE * 16)
+
+/* Un canary de fin de bloc écrasé veut dire qu'un chunk a débordé de son bloc */
+static void check_block(msm_arena_t *arena, bump_block *block)
+{
+#if MSM_HARDENING >= 1
+    if(arena->canary != 0 && *(size_t*)block->end != arena->canary)
+    {
+        MSM_PROBE1(canary_corrupt, block);
+        logfile("!!! VULN !!! : Heap overflow detected, canary of bump block @ %p is corrupted\n",(void*)block);
+        exit(1);
+    }
+#else
+    (void)arena;
+    (void)block;
+#endif
+}
+
+/* Blocs utilisés depuis le début de l'arène, jusqu'au bloc courant compris */
+static void check_used_blocks(msm_arena_t *arena)
+{
+    if(arena->canary == 0) return;
+    for(bump_block *block = arena->first; block != arena->current->next; block = block->next)
+    {
+        check_block(arena, block);
+    }
+}
+
+static bump_block *new_block(msm_arena_t *arena, size_t capacity)
+{
+    capacity = (capacity + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+    bump_block *block = my_malloc(BLOCK_HEADER + capacity + sizeof(size_t));
+    if(block == NULL)
+    {
+        logfile("*** ERROR *** : no memory for a bump block of %zu bytes\n",capacity);
+        return NULL;
+    }
+    block->next = NULL;
+    block->end = BLOCK_DATA(block) + capacity;
+    if(arena->canary != 0) *(size_t*)block->end = arena->canary;
+    return block;
+}
+
+static void enter_block(msm_arena_t *arena, bump_block *block)
+{
+    arena->current = block;
+    arena->cursor = BLOCK_DATA(block);
+    arena->end = block->end;
+}
+
+msm_arena_t *msm_arena_create(size_t block_size, unsigned flags)
+{
+    msm_arena_t *arena = my_malloc(sizeof(msm_arena_t));
+    if(arena == NULL) return NULL;
+    arena->block_size = (block_size != 0) ? block_size : DEFAULT_BLOCK_SIZE;
+    arena->canary = 0;
+#if MSM_HARDENING >= 1
+    if((flags & MSM_ARENA_CANARY) && msm_config.hardening >= 1)
+    {
+        /* Le canary finit par un octet nul : jamais 0 */
+        arena->canary = get_random_canary() | 0x100;
+    }
+#else
+    (void)flags;
+#endif
+    arena->first = new_block(arena, arena->block_size);
+    if(arena->first == NULL)
+    {
+        my_free(arena);
+        return NULL;
+    }
+    enter_block(arena, arena->first);
+    return arena;
+}
+
+/* Chemin lent : le bloc courant est plein. Le bloc suivant sert s'il est assez grand,
+   sinon un nouveau bloc (plus grand si la demande l'exige) est inséré après le bloc courant. */
+static void *alloc_slow(msm_arena_t *arena, size_t size, size_t align)
+{
+    if(size > ~(size_t)0 / 2 - align) return NULL;
+    check_block(arena, arena->current);
+
+    size_t needed = size + align - 1;
+    bump_block *block = arena->current->next;
+    if(block == NULL || (size_t)(block->end - BLOCK_DATA(block)) < needed)
+    {
+        block = new_block(arena, (needed > arena->block_size) ? needed : arena->block_size);
+        if(block == NULL) return NULL;
+        block->next = arena->current->next;
+        arena->current->next = block;
+    }
+    enter_block(arena, block);
+
+    char *start = (char*)(((size_t)arena->cursor + align - 1) & ~(align - 1));
+    arena->cursor = start + size;
+    return start;
+}
+
+void *msm_arena_alloc(msm_arena_t *arena, size_t size, size_t align)
+{
+    if(align == 0) align = ALIGNMENT;
+    if((align & (align - 1)) != 0) return NULL;
+
+    /* Chemin rapide : aligner puis avancer le curseur */
+    char *start = (char*)(((size_t)arena->cursor + align - 1) & ~(align - 1));
+    if(__builtin_expect(start <= arena->end && size <= (size_t)(arena->end - start), 1))
+    {
+        arena->cursor = start + size;
+        return start;
+    }
+    return alloc_slow(arena, size, align);
+}
+
+msm_arena_mark_t msm_arena_mark(msm_arena_t *arena)
+{
+    msm_arena_mark_t mark = { arena->current, arena->cursor };
+    return mark;
+}
+
+/* Tout ce qui a été alloué après mark est abandonné ; les blocs suivants restent chaînés pour resservir */
+void msm_arena_rewind(msm_arena_t *arena, msm_arena_mark_t mark)
+{
+    check_used_blocks(arena);
+    arena->current = mark.block;
+    arena->cursor = mark.cursor;
+    arena->end = arena->current->end;
+}
+
+void msm_arena_reset(msm_arena_t *arena)
+{
+    check_used_blocks(arena);
+    enter_block(arena, arena->first);
+}
+
+void msm_arena_destroy(msm_arena_t *arena)
+{
+    if(arena == NULL) return;
+    bump_block *block = arena->first;
+    while(block != NULL)
+    {
+        bump_block *next = block->next;
+        check_block(arena, block);
+        my_free(block);
+        block = next;
+    }
+    my_free(arena);
+}
@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include "my_secmalloc.private.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Valeurs par défaut : celles qui étaient codées en dur */
+#define DEFAULT_POOL_SIZE (MY_PAGE_SIZE * 1000)      // 4 Mo
+#define DEFAULT_MAPPED_THRESHOLD (MY_PAGE_SIZE * 32) // 128 Ko
+#define DEFAULT_PURGE_THRESHOLD (MY_PAGE_SIZE * 16)  // 64 Ko
+
+/* Plages ASLR (en pages) : voir les calculs dans init_pools() */
+#if defined(__x86_64__) || defined(_M_X64) || defined(__aarch64__) || defined(__ppc64__)
+    #define DEFAULT_META_ASLR 0x26ac
+    #define DEFAULT_DATA_ASLR 0x4f00001
+#else
+    #define DEFAULT_META_ASLR 0xf9c
+    #define DEFAULT_DATA_ASLR 0xffff
+#endif
+
+msm_conf msm_config = {
+    .data_pool_size = DEFAULT_POOL_SIZE,
+    .meta_pool_size = DEFAULT_POOL_SIZE,
+    .growth = 0,
+    .hugepages = 0,
+    .mapped_threshold = DEFAULT_MAPPED_THRESHOLD,
+    .alignment = ALIGNMENT,
+    .narenas = 0,
+    .purge_threshold = DEFAULT_PURGE_THRESHOLD,
+    .decay_ms = 0,
+    .quarantine = 0,
+    .hardening = MSM_HARDENING,
+    .meta_aslr = DEFAULT_META_ASLR,
+    .data_aslr = DEFAULT_DATA_ASLR,
+    .dump_signal = 0,
+    .sample_rate = 0,
+    .guarded_slots = 256,
+    .latency = 0,
+    .reserve = 0,
+    .prefault = 2,
+    .mapped_cache = 0,
+};
+
+/* Un thread qui arrive pendant la lecture de MSM_CONF attend qu'elle soit finie : il ne part pas avec les défauts */
+static pthread_once_t conf_once = PTHREAD_ONCE_INIT;
+
+/* Incrémenté à chaque réglage changé après le démarrage : ce qui en a été tiré par thread (décompte
+   d'échantillonnage) est refait au chemin lent suivant */
+size_t msm_conf_generation = 0;
+
+/* Les messages passent par write : MSM_CONF est lu avant que malloc ne soit utilisable */
+static void conf_error(const char *message, const char *pair, size_t length)
+{
+    if(write(STDERR_FILENO, "<my_secmalloc>: ", 16) < 0) return;
+    if(write(STDERR_FILENO, message, strlen(message)) < 0) return;
+    if(write(STDERR_FILENO, " \"", 2) < 0) return;
+    if(write(STDERR_FILENO, pair, length) < 0) return;
+    if(write(STDERR_FILENO, "\"\n", 2) < 0) return;
+}
+
+/* Nombre décimal avec un suffixe optionnel k, m ou g (puissances de 1024) */
+static int parse_value(const char *value, size_t length, size_t *out)
+{
+    size_t result = 0;
+    size_t i = 0;
+    if(length == 0) return 0;
+    for(; i < length && value[i] >= '0' && value[i] <= '9'; i++)
+    {
+        if(__builtin_mul_overflow(result, 10, &result) || __builtin_add_overflow(result, (size_t)(value[i] - '0'), &result)) return 0;
+    }
+    if(i == 0) return 0;
+    if(i + 1 == length)
+    {
+        unsigned shift;
+        switch(value[i])
+        {
+            case 'k': case 'K': shift = 10; break;
+            case 'm': case 'M': shift = 20; break;
+            case 'g': case 'G': shift = 30; break;
+            default: return 0;
+        }
+        if(result > (~(size_t)0 >> shift)) return 0;
+        result <<= shift;
+    }
+    else if(i != length)
+    {
+        return 0;
+    }
+    *out = result;
+    return 1;
+}
+
+static int key_is(const char *key, size_t length, const char *name)
+{
+    return strlen(name) == length && strncmp(key, name, length) == 0;
+}
+
+/* Applique une paire clé:valeur, retourne 0 si la clé est inconnue ou la valeur invalide */
+static int apply_pair(const char *key, size_t key_length, size_t value)
+{
+    if(key_is(key, key_length, "data_pool_size") || key_is(key, key_length, "meta_pool_size"))
+    {
+        /* Au moins une page, arrondi à la page */
+        if(value == 0 || value > (~(size_t)0 >> 1)) return 0;
+        value = (value + MY_PAGE_SIZE - 1) & ~(MY_PAGE_SIZE - 1);
+        if(key[0] == 'd') msm_config.data_pool_size = value;
+        else msm_config.meta_pool_size = value;
+    }
+    else if(key_is(key, key_length, "growth"))
+    {
+        if(value > 1000) return 0;
+        msm_config.growth = value;
+    }
+    else if(key_is(key, key_length, "hugepages"))
+    {
+        if(value > 1) return 0;
+        msm_config.hugepages = value;
+    }
+    else if(key_is(key, key_length, "mapped_threshold"))
+    {
+        if(value < MY_PAGE_SIZE) return 0;
+        msm_config.mapped_threshold = value;
+    }
+    else if(key_is(key, key_length, "alignment"))
+    {
+        if(value < sizeof(size_t) || value > MY_PAGE_SIZE || (value & (value - 1)) != 0) return 0;
+        msm_config.alignment = value;
+    }
+    else if(key_is(key, key_length, "narenas"))
+    {
+        if(value > MSM_MAX_ARENAS) return 0;
+        msm_config.narenas = value;
+    }
+    else if(key_is(key, key_length, "purge_threshold"))
+    {
+        msm_config.purge_threshold = value;
+    }
+    else if(key_is(key, key_length, "decay_ms"))
+    {
+        msm_config.decay_ms = value;
+    }
+    else if(key_is(key, key_length, "quarantine"))
+    {
+        msm_config.quarantine = value;
+    }
+    else if(key_is(key, key_length, "hardening"))
+    {
+        /* On ne peut pas activer à l'exécution une protection qui n'a pas été compilée */
+        if(value > MSM_HARDENING) return 0;
+        msm_config.hardening = value;
+    }
+    else if(key_is(key, key_length, "meta_aslr"))
+    {
+        msm_config.meta_aslr = value;
+    }
+    else if(key_is(key, key_length, "data_aslr"))
+    {
+        msm_config.data_aslr = value;
+    }
+    else if(key_is(key, key_length, "sample_rate"))
+    {
+        msm_config.sample_rate = value;
+    }
+    else if(key_is(key, key_length, "guarded_slots"))
+    {
+        /* Le pool gardé est mappé une seule fois, au premier échantillon */
+        if(value == 0 || value > 1024 * 1024) return 0;
+        msm_config.guarded_slots = value;
+    }
+    else if(key_is(key, key_length, "latency"))
+    {
+        if(value > 1) return 0;
+        msm_config.latency = value;
+    }
+    else if(key_is(key, key_length, "reserve"))
+    {
+        if(value > (~(size_t)0 >> 1)) return 0;
+        msm_config.reserve = value;
+    }
+    else if(key_is(key, key_length, "prefault"))
+    {
+        if(value > 2) return 0;
+        msm_config.prefault = value;
+    }
+    else if(key_is(key, key_length, "mapped_cache"))
+    {
+        msm_config.mapped_cache = value;
+    }
+    else if(key_is(key, key_length, "dump_signal"))
+    {
+        /* SIGKILL et SIGSTOP ne peuvent pas être interceptés */
+        if(value >= NSIG || value == SIGKILL || value == SIGSTOP) return 0;
+        msm_config.dump_signal = value;
+    }
+    else
+    {
+        return 0;
+    }
+    return 1;
+}
+
+/* Applique une chaîne "clé:valeur,clé:valeur" sans malloc, retourne le nombre de paires rejetées.
+   Doit être appelée avant la création des pools (premier malloc). */
+size_t msm_conf_parse(const char *conf)
+{
+    size_t errors = 0;
+    const char *pair = conf;
+    while(*pair != '\0')
+    {
+        const char *end = strchrnul(pair, ',');
+        const char *colon = memchr(pair, ':', end - pair);
+        size_t value;
+        if(colon == NULL || !parse_value(colon + 1, end - colon - 1, &value))
+        {
+            conf_error("Malformed conf pair", pair, end - pair);
+            errors++;
+        }
+        else if(!apply_pair(pair, colon - pair, value))
+        {
+            conf_error("Invalid conf pair", pair, end - pair);
+            errors++;
+        }
+        pair = (*end == ',') ? end + 1 : end;
+    }
+    return errors;
+}
+
+/* Change un réglage après le démarrage (msm_ctl "opt.<clé>"), avec les mêmes contrôles que MSM_CONF.
+   Retourne 0 si la clé est inconnue ou la valeur invalide. */
+int msm_conf_set(const char *key, size_t value)
+{
+    int applied = apply_pair(key, strlen(key), value);
+    if(applied) __atomic_fetch_add(&msm_conf_generation, 1, __ATOMIC_RELEASE);
+    return applied;
+}
+
+/* Lecture de MSM_CONF : appelée par le constructeur et, si un malloc arrive avant lui
+   (constructeur d'une autre bibliothèque), par init_pools(). Une seule lecture. */
+static void load_conf(void)
+{
+    const char *conf = getenv("MSM_CONF");
+    if(conf != NULL) msm_conf_parse(conf);
+}
+
+void msm_conf_init(void)
+{
+    pthread_once(&conf_once, load_conf);
+}
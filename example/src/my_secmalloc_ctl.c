@@ -0,0 +1,345 @@
+#include "my_secmalloc.private.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* msm_ctl : réglages, actions et statistiques rangés dans un espace de noms à points (façon mallctl).
+   Une lecture copie la valeur dans oldp si *oldlenp est exactement sa taille, une écriture prend newp / newlen.
+
+       epoch                       (rw uint64_t) écrire : prendre un nouvel instantané des statistiques
+       opt.<clé>                   (r size_t, w pour les clés modifiables à chaud) réglages de MSM_CONF
+       arenas.narenas              (r size_t)
+       arena.<N|all>.purge         (w -, r size_t : octets rendus) rendre les pages sales sans attendre le decay
+       arena.all.decay             (w -) faire avancer le decay (msm_decay)
+       thread.tcache.flush         (w -) pas de cache par thread : rien à vider
+       stats.arenas.<N>.<champ>    (r size_t) depuis l'instantané : mapped, mapped_chunks, data_pool, used,
+                                   allocated_chunks, free_chunks, quarantined, metadata
+       stats.<champ>               (r size_t) la somme sur toutes les arènes
+       stats.latency.<op>.<chemin>.<champ>
+                                   (r uint64_t) depuis l'instantané, en cycles : count, mean, p50, p90, p99, p999, max
+                                   op : malloc, calloc, free, realloc ; chemin : reuse, split, top, grow, mapped,
+                                   sampled, release, inplace, moved (MSM_PATH_* dans my_secmalloc.h)
+       stats.mapped_cache          (r size_t) depuis l'instantané : octets de mappings libérés gardés en cache
+       prof.dump                   (w const char *) msm_dump_heap(chemin)
+       heap.check                  (r size_t : chunks vérifiés) vérifier tous les canary (un canary écrasé termine le processus)
+
+   Retourne 0, ENOENT (nom inconnu), EINVAL (taille ou valeur invalide), EPERM (lecture seule) ou EIO (prof.dump). */
+
+#define CTL_ALL (~(size_t)0)
+
+typedef struct ctl_arena_stats
+{
+    size_t mapped;
+    size_t mapped_chunks;
+    size_t data_pool;
+    size_t used;
+    size_t allocated_chunks;
+    size_t free_chunks;
+    size_t quarantined;
+    size_t metadata;
+} ctl_arena_stats;
+
+/* Instantané pris à chaque écriture de epoch : plusieurs compteurs lus ensuite sont cohérents entre eux,
+   même si l'allocateur continue de servir entre deux lectures.
+   snapshot_lock protège l'instantané et epoch : on le prend pour l'écrire comme pour le lire */
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static ctl_arena_stats snapshot[MSM_MAX_ARENAS];
+static msm_latency_hist latency_snapshot[MSM_OPS][MSM_PATHS];
+static size_t snapshot_arenas = 0;
+static size_t snapshot_mapped_cache = 0;
+static uint64_t epoch = 0;
+
+static const struct
+{
+    const char *name;
+    size_t offset;
+} stat_fields[] = {
+    { "mapped", offsetof(ctl_arena_stats, mapped) },
+    { "mapped_chunks", offsetof(ctl_arena_stats, mapped_chunks) },
+    { "data_pool", offsetof(ctl_arena_stats, data_pool) },
+    { "used", offsetof(ctl_arena_stats, used) },
+    { "allocated_chunks", offsetof(ctl_arena_stats, allocated_chunks) },
+    { "free_chunks", offsetof(ctl_arena_stats, free_chunks) },
+    { "quarantined", offsetof(ctl_arena_stats, quarantined) },
+    { "metadata", offsetof(ctl_arena_stats, metadata) },
+};
+
+/* Noms dans l'ordre des MSM_OP_* et MSM_PATH_* */
+static const char *const latency_ops[MSM_OPS] = { "malloc", "calloc", "free", "realloc" };
+static const char *const latency_paths[MSM_PATHS] = { "reuse", "split", "top", "grow", "mapped", "sampled", "release", "inplace", "moved" };
+
+/* Réglages lisibles par opt.<clé> ; seuls ceux qui ne touchent pas à la disposition des pools peuvent changer */
+static const struct
+{
+    const char *name;
+    size_t *value;
+    int writable;
+} opt_fields[] = {
+    { "data_pool_size", &msm_config.data_pool_size, 0 },
+    { "meta_pool_size", &msm_config.meta_pool_size, 0 },
+    { "growth", &msm_config.growth, 1 },
+    { "hugepages", &msm_config.hugepages, 0 },
+    { "mapped_threshold", &msm_config.mapped_threshold, 1 },
+    { "alignment", &msm_config.alignment, 0 },
+    { "narenas", &msm_config.narenas, 0 },
+    { "purge_threshold", &msm_config.purge_threshold, 1 },
+    { "decay_ms", &msm_config.decay_ms, 1 },
+    { "quarantine", &msm_config.quarantine, 1 },
+    { "hardening", &msm_config.hardening, 1 },
+    { "meta_aslr", &msm_config.meta_aslr, 0 },
+    { "data_aslr", &msm_config.data_aslr, 0 },
+    { "dump_signal", &msm_config.dump_signal, 0 },
+    { "sample_rate", &msm_config.sample_rate, 1 },
+    { "guarded_slots", &msm_config.guarded_slots, 0 },
+    { "latency", &msm_config.latency, 1 },
+    { "reserve", &msm_config.reserve, 0 },
+    { "prefault", &msm_config.prefault, 0 },
+    { "mapped_cache", &msm_config.mapped_cache, 0 },
+};
+
+/* À appeler avec snapshot_lock */
+static void take_snapshot(void)
+{
+    snapshot_arenas = msm_arena_count();
+    for(size_t i = 0; i < snapshot_arenas; i++)
+    {
+        topchunk *heap = msm_arena(i);
+        ctl_arena_stats *stats = &snapshot[i];
+        memset(stats, 0, sizeof(ctl_arena_stats));
+        if(heap == NULL) continue;
+        msm_heap_lock(heap);
+        stats->mapped = heap->total_size_mapped;
+        stats->mapped_chunks = heap->number_of_elements_mapped;
+        stats->data_pool = heap->total_size_data;
+        stats->used = heap->current_size_data;
+        stats->allocated_chunks = heap->number_of_elements_allocated;
+        stats->free_chunks = heap->number_of_elements_freed;
+        stats->quarantined = heap->quarantine_bytes;
+        stats->metadata = heap->total_size_metadata;
+        msm_heap_unlock(heap);
+    }
+    for(unsigned op = 0; op < MSM_OPS; op++)
+    {
+        for(unsigned path = 0; path < MSM_PATHS; path++) msm_latency_get(op, path, &latency_snapshot[op][path]);
+    }
+    snapshot_mapped_cache = msm_mapcache_bytes();
+    epoch++;
+}
+
+static int ctl_read(void *oldp, size_t *oldlenp, const void *value, size_t length)
+{
+    if(oldp == NULL || oldlenp == NULL) return 0;
+    if(*oldlenp != length) return EINVAL;
+    memcpy(oldp, value, length);
+    return 0;
+}
+
+static int read_only(const void *newp, size_t newlen)
+{
+    return (newp != NULL || newlen != 0) ? EPERM : 0;
+}
+
+/* Numéro d'arène (ou "all") suivi d'un point : *rest pointe après le point */
+static int parse_index(const char *name, size_t *index, const char **rest)
+{
+    if(strncmp(name, "all.", 4) == 0)
+    {
+        *index = CTL_ALL;
+        *rest = name + 4;
+        return 1;
+    }
+    if(*name < '0' || *name > '9') return 0;
+    char *end;
+    *index = strtoul(name, &end, 10);
+    if(*end != '.') return 0;
+    *rest = end + 1;
+    return 1;
+}
+
+/* Une quarantaine réduite ou coupée à chaud rend tout de suite les chunks en trop de chaque arène et partition */
+static void drain_quarantines(void)
+{
+    for(size_t i = 0; i < msm_arena_count(); i++)
+    {
+        if(msm_arena(i) != NULL) msm_heap_drain_quarantine(msm_arena(i));
+    }
+    for(size_t id = 1; id < MSM_PARTITIONS; id++)
+    {
+        if(msm_partition(id) != NULL) msm_heap_drain_quarantine(msm_partition(id));
+    }
+}
+
+static int ctl_opt(const char *key, void *oldp, size_t *oldlenp, void *newp, size_t newlen)
+{
+    for(size_t i = 0; i < sizeof(opt_fields) / sizeof(opt_fields[0]); i++)
+    {
+        if(strcmp(key, opt_fields[i].name) != 0) continue;
+        size_t previous = *opt_fields[i].value;
+        if(newp != NULL)
+        {
+            if(!opt_fields[i].writable) return EPERM;
+            if(newlen != sizeof(size_t)) return EINVAL;
+            if(!msm_conf_set(key, *(size_t*)newp)) return EINVAL;
+            if(strcmp(key, "quarantine") == 0 || strcmp(key, "hardening") == 0) drain_quarantines();
+        }
+        return ctl_read(oldp, oldlenp, &previous, sizeof(size_t));
+    }
+    return ENOENT;
+}
+
+static int ctl_arena(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen)
+{
+    size_t index;
+    const char *operation;
+    if(!parse_index(name, &index, &operation)) return ENOENT;
+    if(index != CTL_ALL && (index >= msm_arena_count() || msm_arena(index) == NULL)) return ENOENT;
+    if(newp != NULL || newlen != 0) return EINVAL;
+
+    if(strcmp(operation, "purge") == 0)
+    {
+        size_t purged = 0;
+        for(size_t i = 0; i < msm_arena_count(); i++)
+        {
+            if((index == CTL_ALL || index == i) && msm_arena(i) != NULL) purged += msm_heap_purge(msm_arena(i));
+        }
+        return ctl_read(oldp, oldlenp, &purged, sizeof(size_t));
+    }
+    if(strcmp(operation, "decay") == 0 && index == CTL_ALL)
+    {
+        msm_decay();
+        return 0;
+    }
+    return ENOENT;
+}
+
+/* Nom suivi d'un point parmi names : *rest pointe après le point */
+static int parse_name(const char *name, const char *const *names, unsigned count, unsigned *index, const char **rest)
+{
+    for(unsigned i = 0; i < count; i++)
+    {
+        size_t length = strlen(names[i]);
+        if(strncmp(name, names[i], length) == 0 && name[length] == '.')
+        {
+            *index = i;
+            *rest = name + length + 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int ctl_latency(const char *name, void *oldp, size_t *oldlenp)
+{
+    unsigned op, path;
+    if(!parse_name(name, latency_ops, MSM_OPS, &op, &name)) return ENOENT;
+    if(!parse_name(name, latency_paths, MSM_PATHS, &path, &name)) return ENOENT;
+    const msm_latency_hist *hist = &latency_snapshot[op][path];
+
+    uint64_t value;
+    if(strcmp(name, "count") == 0) value = hist->count;
+    else if(strcmp(name, "mean") == 0) value = (hist->count != 0) ? hist->total / hist->count : 0;
+    else if(strcmp(name, "p50") == 0) value = msm_latency_quantile(hist, 0.5);
+    else if(strcmp(name, "p90") == 0) value = msm_latency_quantile(hist, 0.9);
+    else if(strcmp(name, "p99") == 0) value = msm_latency_quantile(hist, 0.99);
+    else if(strcmp(name, "p999") == 0) value = msm_latency_quantile(hist, 0.999);
+    else if(strcmp(name, "max") == 0) value = hist->max;
+    else return ENOENT;
+    return ctl_read(oldp, oldlenp, &value, sizeof(uint64_t));
+}
+
+/* À appeler avec snapshot_lock */
+static int ctl_stats(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen)
+{
+    if(read_only(newp, newlen)) return EPERM;
+    if(epoch == 0) take_snapshot();
+
+    if(strncmp(name, "latency.", 8) == 0)
+    {
+        return ctl_latency(name + 8, oldp, oldlenp);
+    }
+    if(strcmp(name, "mapped_cache") == 0)
+    {
+        return ctl_read(oldp, oldlenp, &snapshot_mapped_cache, sizeof(size_t));
+    }
+
+    size_t index = CTL_ALL;
+    if(strncmp(name, "arenas.", 7) == 0)
+    {
+        if(!parse_index(name + 7, &index, &name) || index == CTL_ALL) return ENOENT;
+        if(index >= snapshot_arenas) return ENOENT;
+    }
+    for(size_t f = 0; f < sizeof(stat_fields) / sizeof(stat_fields[0]); f++)
+    {
+        if(strcmp(name, stat_fields[f].name) != 0) continue;
+        size_t value = 0;
+        for(size_t i = 0; i < snapshot_arenas; i++)
+        {
+            if(index == CTL_ALL || index == i) value += *(size_t*)((char*)&snapshot[i] + stat_fields[f].offset);
+        }
+        return ctl_read(oldp, oldlenp, &value, sizeof(size_t));
+    }
+    return ENOENT;
+}
+
+int msm_ctl(const char *name, void *oldp, size_t *oldlenp, void *newp, size_t newlen)
+{
+    if(name == NULL) return ENOENT;
+    msm_conf_init();
+
+    if(strcmp(name, "epoch") == 0)
+    {
+        if(newp != NULL && newlen != sizeof(uint64_t)) return EINVAL;
+        pthread_mutex_lock(&snapshot_lock);
+        if(newp != NULL) take_snapshot();
+        int result = ctl_read(oldp, oldlenp, &epoch, sizeof(uint64_t));
+        pthread_mutex_unlock(&snapshot_lock);
+        return result;
+    }
+    if(strncmp(name, "opt.", 4) == 0)
+    {
+        return ctl_opt(name + 4, oldp, oldlenp, newp, newlen);
+    }
+    if(strcmp(name, "arenas.narenas") == 0)
+    {
+        if(read_only(newp, newlen)) return EPERM;
+        size_t count = msm_arena_count();
+        return ctl_read(oldp, oldlenp, &count, sizeof(size_t));
+    }
+    if(strncmp(name, "arena.", 6) == 0)
+    {
+        return ctl_arena(name + 6, oldp, oldlenp, newp, newlen);
+    }
+    if(strcmp(name, "thread.tcache.flush") == 0)
+    {
+        /* Les chunks libérés retournent directement dans les listes de leur arène : aucun cache par thread */
+        return (newp != NULL || newlen != 0) ? EINVAL : 0;
+    }
+    if(strncmp(name, "stats.", 6) == 0)
+    {
+        pthread_mutex_lock(&snapshot_lock);
+        int result = ctl_stats(name + 6, oldp, oldlenp, newp, newlen);
+        pthread_mutex_unlock(&snapshot_lock);
+        return result;
+    }
+    if(strcmp(name, "prof.dump") == 0)
+    {
+        if(newp == NULL || newlen != sizeof(const char*)) return EINVAL;
+        return (msm_dump_heap(*(const char**)newp) == 0) ? 0 : EIO;
+    }
+    if(strcmp(name, "heap.check") == 0)
+    {
+        if(read_only(newp, newlen)) return EPERM;
+        size_t checked = 0;
+        for(size_t i = 0; i < msm_arena_count(); i++)
+        {
+            if(msm_arena(i) != NULL) checked += msm_heap_check(msm_arena(i));
+        }
+        for(size_t id = 1; id < MSM_PARTITIONS; id++)
+        {
+            if(msm_partition(id) != NULL) checked += msm_heap_check(msm_partition(id));
+        }
+        return ctl_read(oldp, oldlenp, &checked, sizeof(size_t));
+    }
+    return ENOENT;
+}
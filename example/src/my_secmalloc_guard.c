@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+#include "my_secmalloc.private.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Allocations échantillonnées (façon GWP-ASan) : environ une allocation sur sample_rate est servie par un pool
+   à part, collée contre une page PROT_NONE. Un débordement linéaire y fait une faute immédiate,
+   et la page d'un chunk libéré reste inaccessible jusqu'à ce que tous les autres slots aient resservi.
+
+   Pool : [garde][data 0][garde][data 1][garde] ... [data n-1][garde]
+   Compilé à partir du niveau de durcissement 3. */
+
+#if MSM_HARDENING >= 3
+
+typedef struct guarded_slot
+{
+    void *chunk;        // début du chunk dans la page de data du slot
+    size_t size;        // taille du chunk (alignée)
+    size_t state;       // MY_IS_UNUSED (jamais servi), MY_IS_BUSY ou MY_IS_FREE
+} guarded_slot;
+
+/* Décompte propre à chaque thread : le chemin non échantillonné ne fait qu'une décrémentation.
+   À 1 au départ pour que la première allocation du thread tire le vrai décompte.
+   Il ne dépasse jamais SAMPLE_RECHECK (le reste d'un décompte plus long attend dans sample_remaining) : même sans
+   échantillonnage, chaque thread repasse par le chemin lent et y voit un sample_rate ou un hardening changé par msm_ctl. */
+#define SAMPLE_RECHECK 4096
+__thread size_t msm_sample_countdown = 1;
+static __thread size_t sample_remaining = 0;
+static __thread size_t sample_generation = 0;   // msm_conf_generation au tirage du décompte
+
+static unsigned char *guarded_pool = NULL;
+static size_t guarded_pool_length = 0;
+static guarded_slot *guarded_slots = NULL;
+static size_t next_guarded_slot = 0;
+static struct sigaction previous_segv_action;
+/* Le pool est commun à tous les threads : slots et pages ne changent d'état que sous ce verrou.
+   guarded_pool est publié en dernier, msm_guarded_owns le lit sans verrou. */
+static pthread_mutex_t guarded_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define SLOT_PAGE(index) (guarded_pool + (2 * (index) + 1) * MY_PAGE_SIZE)
+
+/* Message fixe écrit directement : logfile (vsnprintf, alloca) n'est pas async-signal-safe */
+static void fault_report(const char *message)
+{
+    if(report_file == -1) return;
+    if(write(report_file, message, strlen(message)) < 0) return;
+}
+
+/* Une faute dans le pool est un débordement ou un use after free : on le dit avant de laisser le processus mourir.
+   Ailleurs, le handler précédent est remis et la faute se reproduit pour lui. */
+static void guarded_fault(int signum, siginfo_t *info, void *context)
+{
+    (void)signum;
+    (void)context;
+    size_t address = (size_t)info->si_addr;
+    if(address >= (size_t)guarded_pool && address < (size_t)guarded_pool + guarded_pool_length)
+    {
+        size_t page = (address - (size_t)guarded_pool) / MY_PAGE_SIZE;
+        size_t index = (page == 0) ? 0 : (page - 1) / 2;
+        if(page % 2 == 1 && guarded_slots[index].state == MY_IS_FREE)
+        {
+            fault_report("!!! VULN !!! : Use after free detected (freed guarded chunk)\n");
+        }
+        else
+        {
+            fault_report("!!! VULN !!! : Heap overflow detected (guard page of a sampled chunk)\n");
+        }
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    sigaction(SIGSEGV, &previous_segv_action, NULL);
+}
+
+static int init_guarded_pool(void)
+{
+    size_t slots = msm_config.guarded_slots;
+    guarded_pool_length = (2 * slots + 1) * MY_PAGE_SIZE;
+    unsigned char *pool = mmap(NULL, guarded_pool_length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(pool == MAP_FAILED)
+    {
+        logfile("*** ERROR *** : mmap of the guarded pool failed, sampling disabled\n");
+        return 0;
+    }
+    size_t table_length = (slots * sizeof(guarded_slot) + MY_PAGE_SIZE - 1) & (~(MY_PAGE_SIZE - 1));
+    guarded_slots = mmap(NULL, table_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(guarded_slots == MAP_FAILED)
+    {
+        logfile("*** ERROR *** : mmap of the guarded slots failed, sampling disabled\n");
+        munmap(pool, guarded_pool_length);
+        guarded_slots = NULL;
+        return 0;
+    }
+    for(size_t i = 0; i < slots; i++)
+    {
+        guarded_slots[i].state = MY_IS_UNUSED;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = guarded_fault;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous_segv_action);
+
+    __atomic_store_n(&guarded_pool, pool, __ATOMIC_RELEASE);
+    logfile("[+] Guarded pool of %zu slots mapped @ %p\n",slots,pool);
+    return 1;
+}
+
+static void arm_countdown(size_t countdown)
+{
+    msm_sample_countdown = (countdown < SAMPLE_RECHECK) ? countdown : SAMPLE_RECHECK;
+    sample_remaining = countdown - msm_sample_countdown;
+}
+
+/* Les canary finissent par un octet nul : il est écarté */
+static size_t draw_countdown(void)
+{
+    return 1 + (get_random_canary() >> 8) % (2 * msm_config.sample_rate - 1);
+}
+
+/* Appelée quand le décompte du thread tombe à zéro : retire un décompte (moyenne sample_rate)
+   et sert size depuis le pool gardé si c'est possible. NULL : allocation normale. */
+void *msm_sampled_malloc(size_t size)
+{
+    msm_conf_init();
+    if(msm_config.sample_rate == 0 || msm_config.hardening < 3)
+    {
+        arm_countdown(SAMPLE_RECHECK);
+        return NULL;
+    }
+    size_t generation = __atomic_load_n(&msm_conf_generation, __ATOMIC_ACQUIRE);
+    if(sample_remaining != 0)
+    {
+        /* Décompte pas encore écoulé : il continue, sauf s'il a été tiré avec un autre sample_rate */
+        if(generation == sample_generation)
+        {
+            arm_countdown(sample_remaining);
+        }
+        else
+        {
+            sample_generation = generation;
+            arm_countdown(draw_countdown());
+        }
+        return NULL;
+    }
+    sample_generation = generation;
+    arm_countdown(draw_countdown());
+
+    size = (size == 0) ? msm_config.alignment : (size + msm_config.alignment - 1) & (~(msm_config.alignment - 1));
+    if(size > MY_PAGE_SIZE) return NULL;
+    pthread_mutex_lock(&guarded_lock);
+    if(guarded_pool == NULL && !init_guarded_pool())
+    {
+        pthread_mutex_unlock(&guarded_lock);
+        return NULL;
+    }
+
+    /* Slots servis à tour de rôle : un slot libéré reste inaccessible le plus longtemps possible */
+    void *chunk = NULL;
+    size_t slots = msm_config.guarded_slots;
+    for(size_t tried = 0; tried < slots; tried++)
+    {
+        size_t index = next_guarded_slot;
+        next_guarded_slot = (next_guarded_slot + 1) % slots;
+        guarded_slot *slot = &guarded_slots[index];
+        if(slot->state == MY_IS_BUSY) continue;
+
+        unsigned char *page = SLOT_PAGE(index);
+        if(mprotect(page, MY_PAGE_SIZE, PROT_READ | PROT_WRITE) == -1)
+        {
+            logfile("*** ERROR *** : mprotect of guarded slot @ %p failed\n",page);
+            break;
+        }
+        /* Le chunk finit exactement sur la page de garde suivante */
+        slot->chunk = page + MY_PAGE_SIZE - size;
+        slot->size = size;
+        slot->state = MY_IS_BUSY;
+        chunk = slot->chunk;
+        logfile("[+] %zu bytes sampled @ %p (guarded slot %zu)\n",size,chunk,index);
+        break;
+    }
+    pthread_mutex_unlock(&guarded_lock);
+    return chunk;
+}
+
+int msm_guarded_owns(void *ptr)
+{
+    unsigned char *pool = __atomic_load_n(&guarded_pool, __ATOMIC_ACQUIRE);
+    return pool != NULL && (size_t)ptr >= (size_t)pool && (size_t)ptr < (size_t)pool + guarded_pool_length;
+}
+
+static guarded_slot *guarded_slot_of(void *ptr)
+{
+    size_t page = ((size_t)ptr - (size_t)guarded_pool) / MY_PAGE_SIZE;
+    if(page % 2 == 0) return NULL;
+    guarded_slot *slot = &guarded_slots[(page - 1) / 2];
+    return (slot->chunk == ptr) ? slot : NULL;
+}
+
+size_t msm_guarded_size(void *ptr)
+{
+    pthread_mutex_lock(&guarded_lock);
+    guarded_slot *slot = guarded_slot_of(ptr);
+    size_t size = (slot != NULL && slot->state == MY_IS_BUSY) ? slot->size : 0;
+    pthread_mutex_unlock(&guarded_lock);
+    return size;
+}
+
+/* La page est rendue au noyau (elle sera à zéro au prochain usage) puis rendue inaccessible */
+void msm_guarded_free(void *ptr)
+{
+    pthread_mutex_lock(&guarded_lock);
+    guarded_slot *slot = guarded_slot_of(ptr);
+    if(slot == NULL)
+    {
+        logfile("!!! VULN !!! : Invalid free of %p inside the guarded pool\n",ptr);
+        exit(1);
+    }
+    if(slot->state != MY_IS_BUSY)
+    {
+        logfile("!!! VULN !!! : Double free detected for %p pointer\n",ptr);
+        exit(1);
+    }
+    unsigned char *page = (unsigned char*)((size_t)ptr & (~(MY_PAGE_SIZE - 1)));
+    if(madvise(page, MY_PAGE_SIZE, MADV_DONTNEED) == -1 || mprotect(page, MY_PAGE_SIZE, PROT_NONE) == -1)
+    {
+        logfile("*** ERROR *** : guarded slot @ %p could not be protected again\n",page);
+    }
+    slot->state = MY_IS_FREE;
+    pthread_mutex_unlock(&guarded_lock);
+    logfile("[+] Sampled memory @ %p successfully freed.\n",ptr);
+}
+
+#endif
@@ -0,0 +1,134 @@
+#include "my_secmalloc.private.h"
+#include <string.h>
+#include <sys/mman.h>
+
+/* Histogrammes de latence (latency dans MSM_CONF) : chaque thread compte dans sa propre table, sans verrou ni
+   instruction atomique coûteuse ; msm_latency_get additionne les tables de tous les threads.
+   Une table est mappée au premier enregistrement du thread et survit au thread : ses comptes restent dans la somme.
+   Au-delà de LATENCY_THREADS threads, les nouveaux threads ne sont plus mesurés. */
+
+#define LATENCY_THREADS 256
+/* Tranches par puissance de 2 (et premières valeurs comptées une à une) */
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_SUB_BITS 3
+
+typedef struct latency_table
+{
+    msm_latency_hist hist[MSM_OPS][MSM_PATHS];
+} latency_table;
+
+static latency_table *tables[LATENCY_THREADS];
+static size_t number_of_tables = 0;
+static __thread latency_table *thread_table = NULL;
+static __thread int thread_untracked = 0;
+
+/* Tranche d'une durée : exacte sous 8 cycles, puis 8 tranches par puissance de 2 */
+static size_t latency_bucket(uint64_t cycles)
+{
+    if(cycles < LATENCY_SUB_BUCKETS) return (size_t)cycles;
+    unsigned exponent = 63 - (unsigned)__builtin_clzll(cycles);
+    size_t index = (size_t)(exponent - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS
+                 + (size_t)((cycles >> (exponent - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+    return (index < MSM_LATENCY_BUCKETS) ? index : MSM_LATENCY_BUCKETS - 1;
+}
+
+/* Plus petite durée comptée dans la tranche index */
+static uint64_t bucket_lower(size_t index)
+{
+    if(index < LATENCY_SUB_BUCKETS) return index;
+    unsigned exponent = (unsigned)(index / LATENCY_SUB_BUCKETS) + LATENCY_SUB_BITS - 1;
+    uint64_t sub = index % LATENCY_SUB_BUCKETS;
+    return (LATENCY_SUB_BUCKETS + sub) << (exponent - LATENCY_SUB_BITS);
+}
+
+static latency_table *claim_table(void)
+{
+    size_t index = __atomic_fetch_add(&number_of_tables, 1, __ATOMIC_RELAXED);
+    if(index >= LATENCY_THREADS)
+    {
+        thread_untracked = 1;
+        return NULL;
+    }
+    /* Pas de my_malloc : la mesure ne doit pas se mesurer elle-même ni toucher au tas en cours de modification */
+    latency_table *table = mmap(NULL, sizeof(latency_table), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(table == MAP_FAILED)
+    {
+        logfile("*** ERROR *** : mmap of a latency table failed\n");
+        thread_untracked = 1;
+        return NULL;
+    }
+    __atomic_store_n(&tables[index], table, __ATOMIC_RELEASE);
+    return table;
+}
+
+/* Un seul écrivain par compteur (le thread de la table) : des load/store relâchés suffisent pour que
+   les lecteurs voient chaque compteur en entier, sans le lock add d'un incrément atomique */
+#define BUMP(field, amount) __atomic_store_n(&(field), __atomic_load_n(&(field), __ATOMIC_RELAXED) + (amount), __ATOMIC_RELAXED)
+
+void msm_latency_record(unsigned op, unsigned path, uint64_t cycles)
+{
+    latency_table *table = thread_table;
+    if(table == NULL)
+    {
+        if(thread_untracked) return;
+        table = thread_table = claim_table();
+        if(table == NULL) return;
+    }
+    msm_latency_hist *hist = &table->hist[op][path];
+    BUMP(hist->count, 1);
+    BUMP(hist->total, cycles);
+    BUMP(hist->buckets[latency_bucket(cycles)], 1);
+    if(cycles > hist->max) __atomic_store_n(&hist->max, cycles, __ATOMIC_RELAXED);
+}
+
+void msm_latency_merge(msm_latency_hist *into, const msm_latency_hist *from)
+{
+    if(into == NULL || from == NULL) return;
+    into->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+    into->total += __atomic_load_n(&from->total, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+    if(max > into->max) into->max = max;
+    for(size_t i = 0; i < MSM_LATENCY_BUCKETS; i++)
+    {
+        into->buckets[i] += __atomic_load_n(&from->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+int msm_latency_get(unsigned op, unsigned path, msm_latency_hist *out)
+{
+    if(out == NULL || op >= MSM_OPS || path >= MSM_PATHS) return -1;
+    memset(out, 0, sizeof(msm_latency_hist));
+    size_t count = __atomic_load_n(&number_of_tables, __ATOMIC_RELAXED);
+    if(count > LATENCY_THREADS) count = LATENCY_THREADS;
+    for(size_t i = 0; i < count; i++)
+    {
+        /* Une table réservée mais pas encore mappée est encore nulle */
+        latency_table *table = __atomic_load_n(&tables[i], __ATOMIC_ACQUIRE);
+        if(table != NULL) msm_latency_merge(out, &table->hist[op][path]);
+    }
+    return 0;
+}
+
+uint64_t msm_latency_quantile(const msm_latency_hist *hist, double quantile)
+{
+    if(hist == NULL || hist->count == 0) return 0;
+    if(quantile < 0) quantile = 0;
+    if(quantile > 1) quantile = 1;
+    /* Rang de l'opération du quantile, arrondi au-dessus (au moins la première) */
+    double exact = quantile * (double)hist->count;
+    uint64_t rank = (uint64_t)exact;
+    if((double)rank < exact) rank++;
+    if(rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for(size_t i = 0; i < MSM_LATENCY_BUCKETS - 1; i++)
+    {
+        seen += hist->buckets[i];
+        if(seen >= rank)
+        {
+            uint64_t upper = bucket_lower(i + 1) - 1;
+            return (upper < hist->max) ? upper : hist->max;
+        }
+    }
+    return hist->max;
+}
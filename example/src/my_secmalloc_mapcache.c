@@ -0,0 +1,148 @@
+#include "my_secmalloc.private.h"
+#include <sys/mman.h>
+
+/* Cache des mappings de gros blocs (mapped_cache dans MSM_CONF) : un gros bloc libéré garde son mapping et ses pages,
+   le prochain gros bloc de taille voisine le reprend sans mmap, munmap ni faute de page.
+   Rangés par classe de nombre de pages (puissances de 2), au plus MAPCACHE_DEPTH par classe et mapped_cache octets en tout.
+   Un mapping qui attend depuis plus de decay_ms est rendu au noyau par le decay ; sans decay_ms, seule la borne le chasse.
+   Contrepartie : un use after free dans un gros bloc en cache ne fait plus de segfault, d'où le cache désactivé par défaut.
+   Le cache est commun à toutes les arènes : il a son propre verrou, pris sous celui d'un tas (jamais l'inverse). */
+
+#define MAPCACHE_BUCKETS 24
+#define MAPCACHE_DEPTH 4
+/* Surplus accepté à la reprise : au plus un quart de la taille demandée, rendu au noyau par munmap */
+#define MAPCACHE_SLACK 4
+
+typedef struct cached_mapping
+{
+    void *mapping;      // NULL : emplacement vide
+    size_t length;      // page de garde comprise
+    size_t node;        // nœud NUMA de l'arène qui l'a libéré
+    size_t freed;       // date du free, en ms (decay)
+    size_t sequence;    // ordre des free : le plus petit part en premier
+} cached_mapping;
+
+static cached_mapping cache[MAPCACHE_BUCKETS][MAPCACHE_DEPTH];
+static size_t cached_bytes = 0;
+static size_t sequence = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t bucket_of(size_t length)
+{
+    size_t bucket = 63 - (size_t)__builtin_clzll(length / MY_PAGE_SIZE);
+    return (bucket < MAPCACHE_BUCKETS) ? bucket : MAPCACHE_BUCKETS - 1;
+}
+
+static void release(cached_mapping *entry)
+{
+    if(munmap(entry->mapping, entry->length) == -1)
+    {
+        logfile("*** ERROR *** : munmap of cached mapping @ %p failed\n",entry->mapping);
+    }
+    logfile("[+] Cached mapping @ %p (%zu bytes) unmapped\n",entry->mapping,entry->length);
+    __atomic_store_n(&cached_bytes, cached_bytes - entry->length, __ATOMIC_RELAXED);
+    entry->mapping = NULL;
+}
+
+static cached_mapping *oldest(size_t first, size_t last)
+{
+    cached_mapping *found = NULL;
+    for(size_t bucket = first; bucket <= last; bucket++)
+    {
+        for(size_t i = 0; i < MAPCACHE_DEPTH; i++)
+        {
+            cached_mapping *entry = &cache[bucket][i];
+            if(entry->mapping != NULL && (found == NULL || entry->sequence < found->sequence)) found = entry;
+        }
+    }
+    return found;
+}
+
+/* Reprend un mapping de length octets (page de garde comprise) libéré sur node, le surplus rendu au noyau.
+   Ses data sont celles de l'ancien bloc et sa nouvelle page de garde est encore accessible : à l'appelant de l'armer. */
+void *msm_mapcache_take(size_t length, size_t node)
+{
+    if(msm_mapcache_bytes() == 0) return NULL;
+    pthread_mutex_lock(&cache_lock);
+    cached_mapping *best = NULL;
+    /* Un mapping un peu plus grand peut être dans la classe suivante */
+    size_t first = bucket_of(length);
+    size_t last = (first + 1 < MAPCACHE_BUCKETS) ? first + 1 : first;
+    for(size_t bucket = first; bucket <= last; bucket++)
+    {
+        for(size_t i = 0; i < MAPCACHE_DEPTH; i++)
+        {
+            cached_mapping *entry = &cache[bucket][i];
+            if(entry->mapping == NULL || entry->node != node || entry->length < length) continue;
+            if(entry->length - length > length / MAPCACHE_SLACK) continue;
+            if(best == NULL || entry->length < best->length) best = entry;
+        }
+    }
+    if(best == NULL)
+    {
+        pthread_mutex_unlock(&cache_lock);
+        return NULL;
+    }
+
+    void *mapping = best->mapping;
+    if(best->length != length && munmap((void*)((size_t)mapping + length), best->length - length) == -1)
+    {
+        logfile("*** ERROR *** : munmap of the tail of cached mapping @ %p failed\n",mapping);
+    }
+    __atomic_store_n(&cached_bytes, cached_bytes - best->length, __ATOMIC_RELAXED);
+    best->mapping = NULL;
+    pthread_mutex_unlock(&cache_lock);
+    logfile("[+] Cached mapping @ %p reused for %zu bytes\n",mapping,length);
+    return mapping;
+}
+
+/* Garde le mapping d'un gros bloc libéré (page de garde armée) ; retourne 0 s'il est à rendre au noyau */
+int msm_mapcache_put(void *mapping, size_t length, size_t node, size_t now)
+{
+    if(msm_config.mapped_cache == 0 || length > msm_config.mapped_cache) return 0;
+    pthread_mutex_lock(&cache_lock);
+    size_t bucket = bucket_of(length);
+    cached_mapping *slot = NULL;
+    for(size_t i = 0; i < MAPCACHE_DEPTH && slot == NULL; i++)
+    {
+        if(cache[bucket][i].mapping == NULL) slot = &cache[bucket][i];
+    }
+    if(slot == NULL)
+    {
+        slot = oldest(bucket, bucket);
+        release(slot);
+    }
+    /* Au-delà de la borne, les plus vieux mappings de tout le cache partent d'abord */
+    while(cached_bytes + length > msm_config.mapped_cache) release(oldest(0, MAPCACHE_BUCKETS - 1));
+
+    slot->mapping = mapping;
+    slot->length = length;
+    slot->node = node;
+    slot->freed = now;
+    slot->sequence = sequence++;
+    __atomic_store_n(&cached_bytes, cached_bytes + length, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&cache_lock);
+    logfile("[+] Mapping @ %p (%zu bytes) kept in cache\n",mapping,length);
+    return 1;
+}
+
+/* Rend au noyau les mappings libérés depuis decay_ms ou plus (appelé à chaque époque du decay) */
+void msm_mapcache_decay(size_t now)
+{
+    if(msm_mapcache_bytes() == 0) return;
+    pthread_mutex_lock(&cache_lock);
+    for(size_t bucket = 0; bucket < MAPCACHE_BUCKETS; bucket++)
+    {
+        for(size_t i = 0; i < MAPCACHE_DEPTH; i++)
+        {
+            cached_mapping *entry = &cache[bucket][i];
+            if(entry->mapping != NULL && now - entry->freed >= msm_config.decay_ms) release(entry);
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+size_t msm_mapcache_bytes(void)
+{
+    return __atomic_load_n(&cached_bytes, __ATOMIC_RELAXED);
+}
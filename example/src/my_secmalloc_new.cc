@@ -0,0 +1,166 @@
+/* Remplacement de la famille operator new / operator delete pour les programmes C++.
+   Sans ce fichier, libstdc++ passe par malloc et delete oublie la taille que le compilateur connaît :
+   ici, new appelle directement l'allocateur et les delete dimensionnés passent la taille à my_free_sized. */
+#include "my_secmalloc.private.h"
+#include <new>
+
+#ifdef DYNAMIC
+
+namespace {
+
+/* Sémantique standard de new : tant que l'allocation échoue, appeler le new_handler, sinon bad_alloc */
+void *allocate_or_throw(std::size_t size, std::size_t alignment)
+{
+    for(;;)
+    {
+        void *ptr = (alignment == 0) ? my_malloc(size) : my_aligned_alloc(alignment, size);
+        if(ptr != nullptr)
+        {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if(handler == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+/* Les versions nothrow appellent la version qui lance, comme l'exige la norme (le new_handler est donc appelé) */
+void *allocate_or_null(std::size_t size, std::size_t alignment) noexcept
+{
+    try
+    {
+        return allocate_or_throw(size, alignment);
+    }
+    catch(...)
+    {
+        return nullptr;
+    }
+}
+
+}
+
+__attribute__((visibility("default")))
+void *operator new(std::size_t size)
+{
+    return allocate_or_throw(size, 0);
+}
+
+__attribute__((visibility("default")))
+void *operator new[](std::size_t size)
+{
+    return allocate_or_throw(size, 0);
+}
+
+__attribute__((visibility("default")))
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate_or_null(size, 0);
+}
+
+__attribute__((visibility("default")))
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate_or_null(size, 0);
+}
+
+__attribute__((visibility("default")))
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    return allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+__attribute__((visibility("default")))
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+__attribute__((visibility("default")))
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocate_or_null(size, static_cast<std::size_t>(alignment));
+}
+
+__attribute__((visibility("default")))
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocate_or_null(size, static_cast<std::size_t>(alignment));
+}
+
+__attribute__((visibility("default")))
+void operator delete(void *ptr) noexcept
+{
+    my_free(ptr);
+}
+
+__attribute__((visibility("default")))
+void operator delete[](void *ptr) noexcept
+{
+    my_free(ptr);
+}
+
+__attribute__((visibility("default")))
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    my_free(ptr);
+}
+
+__attribute__((visibility("default")))
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    my_free(ptr);
+}
+
+/* delete dimensionné : la taille connue du compilateur évite de chercher le chunk dans toutes les listes */
+__attribute__((visibility("default")))
+void operator delete(void *ptr, std::size_t size) noexcept
+{
+    my_free_sized(ptr, size);
+}
+
+__attribute__((visibility("default")))
+void operator delete[](void *ptr, std::size_t size) noexcept
+{
+    my_free_sized(ptr, size);
+}
+
+__attribute__((visibility("default")))
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+    my_free(ptr);
+}
+
+__attribute__((visibility("default")))
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+    my_free(ptr);
+}
+
+__attribute__((visibility("default")))
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    my_free(ptr);
+}
+
+__attribute__((visibility("default")))
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    my_free(ptr);
+}
+
+__attribute__((visibility("default")))
+void operator delete(void *ptr, std::size_t size, std::align_val_t alignment) noexcept
+{
+    my_free_aligned_sized(ptr, static_cast<std::size_t>(alignment), size);
+}
+
+__attribute__((visibility("default")))
+void operator delete[](void *ptr, std::size_t size, std::align_val_t alignment) noexcept
+{
+    my_free_aligned_sized(ptr, static_cast<std::size_t>(alignment), size);
+}
+
+#endif
@@ -0,0 +1,66 @@
+#define _GNU_SOURCE
+#include "my_secmalloc.private.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+/* Pas de libnuma : les nœuds sont lus dans sysfs et les pools placés par l'appel système mbind */
+#define NODE_MASK_WORDS 16  // 1024 nœuds
+
+static size_t number_of_nodes = 0;
+
+/* /sys/devices/system/node/online est une liste comme "0", "0-1" ou "0,2-3" : le plus grand nœud + 1.
+   Sans sysfs (ou sans NUMA), un seul nœud. Lu sans malloc. */
+size_t msm_numa_node_count(void)
+{
+    if(number_of_nodes != 0) return number_of_nodes;
+
+    number_of_nodes = 1;
+    int fd = open("/sys/devices/system/node/online", O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return number_of_nodes;
+    char buffer[256];
+    ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if(length <= 0) return number_of_nodes;
+    buffer[length] = '\0';
+
+    size_t node = 0;
+    size_t highest = 0;
+    for(ssize_t i = 0; i < length; i++)
+    {
+        if(buffer[i] >= '0' && buffer[i] <= '9')
+        {
+            node = node * 10 + (size_t)(buffer[i] - '0');
+            if(node > highest) highest = node;
+        }
+        else
+        {
+            node = 0;
+        }
+    }
+    if(highest >= NODE_MASK_WORDS * 8 * sizeof(unsigned long)) highest = NODE_MASK_WORDS * 8 * sizeof(unsigned long) - 1;
+    number_of_nodes = highest + 1;
+    return number_of_nodes;
+}
+
+/* Nœud du CPU sur lequel tourne le thread (getcpu passe par le vDSO) */
+size_t msm_numa_current_node(void)
+{
+    unsigned cpu;
+    unsigned node;
+    if(msm_numa_node_count() == 1 || getcpu(&cpu, &node) == -1) return 0;
+    return (node < number_of_nodes) ? node : 0;
+}
+
+/* MPOL_PREFERRED : les pages sont prises sur node tant qu'il en a, sinon ailleurs plutôt qu'un échec */
+void msm_numa_bind(void *address, size_t length, size_t node)
+{
+    unsigned long mask[NODE_MASK_WORDS] = {0};
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    if(syscall(SYS_mbind, address, length, MPOL_PREFERRED, mask, NODE_MASK_WORDS * 8 * sizeof(unsigned long), 0) == -1)
+    {
+        logfile("*** ERROR *** : mbind of %zu bytes @ %p to node %zu failed\n",length,address,node);
+    }
+}
@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include "my_secmalloc.private.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Tas persistant : tout le tas est un seul fichier mappé en MAP_SHARED, toujours à l'adresse choisie à sa création.
+   Les pointeurs des metadata (chunk, next, arbre...) et ceux que le programme range dans ses objets restent donc
+   valables d'un processus à l'autre, sans table de traduction.
+
+       Fichier : [persist_header (une page)][topchunk + meta_pool][data_pool]
+
+   Le fichier est creux : seules les pages touchées occupent le disque. Il est verrouillé (flock) tant qu'il est ouvert.
+   clean vaut 0 pendant que le tas est ouvert : s'il vaut encore 0 à l'ouverture suivante, le processus s'est arrêté
+   sans msm_heap_close et les listes sont reconstruites depuis les metadata (msm_heap_reattach).
+
+   Tas partagé : la même disposition dans un memfd que plusieurs processus mappent à la même adresse (msm_shm_attach).
+   Chaque appel msm_heap_* prend le mutex robuste de l'en-tête (PTHREAD_PROCESS_SHARED) ; si son propriétaire est mort
+   au milieu d'une opération, le suivant reconstruit les listes avant de continuer. Entre processus, les chunks
+   s'échangent par handle : leur offset dans le segment, vérifié au retour (msm_shm_handle / msm_shm_pointer). */
+
+#define PERSIST_MAGIC "MSMPERS"
+/* 2 : le topchunk porte son verrou entre threads */
+#define PERSIST_VERSION 2
+/* Fenêtre des adresses de tas persistants : au-dessus des exécutables PIE (0x55...), sous les bibliothèques et la pile (0x7f...).
+   L'adresse est tirée au hasard dans la fenêtre à la création, puis fixée pour toute la vie du fichier. */
+#define PERSIST_WINDOW_START (size_t)0x600000000000
+#define PERSIST_WINDOW_PAGES ((size_t)0x100000000000 / MY_PAGE_SIZE)
+#define PERSIST_ATTEMPTS 16
+
+typedef struct persist_header
+{
+    char magic[8];              // PERSIST_MAGIC, terminé par un 0
+    uint32_t version;           // PERSIST_VERSION
+    uint32_t page_size;         // taille d'une page de l'allocateur
+    uint64_t alignment;         // alignement des chunks : la taille réservée aux canary en dépend
+    uint64_t base;              // adresse du mapping
+    uint64_t file_size;         // taille du fichier (et du mapping)
+    uint64_t meta_size;         // taille de topchunk_pool + meta_pool
+    uint64_t data_size;         // taille de data_pool
+    uint64_t clean;             // 1 : fermé par msm_heap_close
+    uint64_t root;              // pointeur racine (msm_heap_set_root)
+    int64_t fd;                 // descripteur qui tient le verrou (valable seulement tant que le tas est ouvert)
+    uint64_t kind;              // MY_HEAP_FILE ou MY_HEAP_SHARED
+    pthread_mutex_t lock;       // tas partagé : mutex robuste entre processus
+} persist_header;
+
+/* Descripteurs des tas partagés de ce processus : ils diffèrent d'un processus à l'autre, ils ne vont pas dans l'en-tête.
+   La table est commune aux threads du processus : lue et modifiée sous shared_heaps_lock. */
+#define SHARED_HEAPS 16
+static struct
+{
+    topchunk *heap;
+    int fd;
+} shared_heaps[SHARED_HEAPS];
+static pthread_mutex_t shared_heaps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static persist_header *header_of(topchunk *heap)
+{
+    return (persist_header*)((size_t)heap - MY_PAGE_SIZE);
+}
+
+/* mmap à exactement address, sans écraser un mapping existant (MAP_FIXED_NOREPLACE, simple indication avant Linux 4.17) */
+static void *map_at(size_t address, size_t length, int fd)
+{
+    void *mapping = mmap((void*)address, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if(mapping == MAP_FAILED) return NULL;
+    if((size_t)mapping != address)
+    {
+        munmap(mapping, length);
+        return NULL;
+    }
+    return mapping;
+}
+
+/* Tas vide de size octets de data dans le fichier (ou memfd) fd, mappé à une adresse tirée dans la fenêtre */
+static topchunk *create_mapping(int fd, size_t size, size_t kind)
+{
+    /* Une meta (64 octets) pour 64 octets de data en moyenne : meta_pool ne coûte que les pages réellement touchées */
+    if(size > ((size_t)1 << 44)) return NULL;
+    size_t data_size = (size + MY_PAGE_SIZE - 1) & ~(MY_PAGE_SIZE - 1);
+    size_t topchunk_size = (sizeof(topchunk) + msm_config.alignment - 1) & ~(msm_config.alignment - 1);
+    size_t meta_size = (topchunk_size + data_size + MY_PAGE_SIZE - 1) & ~(MY_PAGE_SIZE - 1);
+    size_t file_size = MY_PAGE_SIZE + meta_size + data_size;
+    if(ftruncate(fd, (off_t)file_size) == -1)
+    {
+        logfile("*** ERROR *** : ftruncate of persistent heap to %zu bytes failed\n",file_size);
+        return NULL;
+    }
+
+    char *base = NULL;
+    for(size_t attempt = 0; attempt < PERSIST_ATTEMPTS && base == NULL; attempt++)
+    {
+        size_t pages = (PERSIST_WINDOW_PAGES > file_size / MY_PAGE_SIZE) ? PERSIST_WINDOW_PAGES - file_size / MY_PAGE_SIZE : 0;
+        base = map_at(PERSIST_WINDOW_START + generate_random_value(0, pages) * MY_PAGE_SIZE, file_size, fd);
+    }
+    if(base == NULL)
+    {
+        logfile("*** ERROR *** : no free address for a persistent heap of %zu bytes\n",file_size);
+        /* Le fichier redevient vide : une prochaine ouverture le créera de nouveau */
+        if(ftruncate(fd, 0) == -1) logfile("*** ERROR *** : ftruncate of persistent heap failed\n");
+        return NULL;
+    }
+
+    persist_header *header = (persist_header*)base;
+    memcpy(header->magic, PERSIST_MAGIC, sizeof(header->magic));
+    header->version = PERSIST_VERSION;
+    header->page_size = MY_PAGE_SIZE;
+    header->alignment = msm_config.alignment;
+    header->base = (uint64_t)(size_t)base;
+    header->file_size = file_size;
+    header->meta_size = meta_size;
+    header->data_size = data_size;
+    header->clean = 0;
+    header->root = 0;
+    header->kind = kind;
+
+    topchunk *heap = (topchunk*)(base + MY_PAGE_SIZE);
+    /* meta_pool commence après le topchunk : seul le reste de la région compte pour ses meta */
+    msm_heap_format(heap, meta_size - topchunk_size, base + MY_PAGE_SIZE + meta_size, data_size);
+    heap->persistent = kind;
+    logfile("[+] %s heap created @ %p : %zu bytes of data\n",(kind == MY_HEAP_SHARED) ? "Shared" : "Persistent",(void*)heap,data_size);
+    return heap;
+}
+
+/* Mappe un tas existant à son adresse, après avoir vérifié son en-tête */
+static topchunk *map_existing(int fd, size_t kind)
+{
+    struct stat st;
+    persist_header header;
+    if(fstat(fd, &st) == -1 || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+       || memcmp(header.magic, PERSIST_MAGIC, sizeof(header.magic)) != 0 || header.kind != kind)
+    {
+        logfile("*** ERROR *** : file is not a %s heap\n",(kind == MY_HEAP_SHARED) ? "shared" : "persistent");
+        return NULL;
+    }
+    if(header.version != PERSIST_VERSION || header.page_size != MY_PAGE_SIZE || header.alignment != msm_config.alignment
+       || header.file_size != (uint64_t)st.st_size || header.file_size != MY_PAGE_SIZE + header.meta_size + header.data_size)
+    {
+        logfile("*** ERROR *** : heap of version %u, alignment %zu is not compatible\n",header.version,(size_t)header.alignment);
+        return NULL;
+    }
+
+    char *base = map_at((size_t)header.base, (size_t)header.file_size, fd);
+    if(base == NULL)
+    {
+        logfile("*** ERROR *** : address %p of heap is already in use\n",(void*)(size_t)header.base);
+        return NULL;
+    }
+    return (topchunk*)(base + MY_PAGE_SIZE);
+}
+
+static topchunk *open_file(int fd, int *state)
+{
+    persist_header *header;
+    topchunk *heap = map_existing(fd, MY_HEAP_FILE);
+    if(heap == NULL) return NULL;
+    header = header_of(heap);
+    int rebuild = (header->clean != 1);
+    size_t busy = msm_heap_reattach(heap, rebuild);
+    *state = rebuild ? MSM_HEAP_RECOVERED : MSM_HEAP_REOPENED;
+    logfile("[+] Persistent heap reopened @ %p with %zu busy chunks%s\n",(void*)heap,busy,rebuild ? " (recovered)" : "");
+    return heap;
+}
+
+msm_heap_t *msm_heap_open(const char *path, size_t size, int *state) {
+    if(path == NULL) return NULL;
+    msm_conf_init();
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(fd == -1)
+    {
+        logfile("*** ERROR *** : open of persistent heap %s failed\n",path);
+        return NULL;
+    }
+    /* Un seul processus à la fois : deux processus qui modifient les mêmes listes sans verrou les corrompraient */
+    if(flock(fd, LOCK_EX | LOCK_NB) == -1)
+    {
+        logfile("*** ERROR *** : persistent heap %s is already open\n",path);
+        close(fd);
+        return NULL;
+    }
+
+    struct stat st;
+    int opened = MSM_HEAP_CREATED;
+    topchunk *heap = NULL;
+    if(fstat(fd, &st) == 0)
+    {
+        if(st.st_size == 0)
+            heap = (size != 0) ? create_mapping(fd, size, MY_HEAP_FILE) : NULL;
+        else
+            heap = open_file(fd, &opened);
+    }
+    if(heap == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    persist_header *header = header_of(heap);
+    header->fd = fd;
+    /* Ouvert : un arrêt avant msm_heap_close laissera clean à 0. L'en-tête est écrit avant toute modification du tas. */
+    header->clean = 0;
+    msync(header, MY_PAGE_SIZE, MS_SYNC);
+    if(state != NULL) *state = opened;
+    return heap;
+}
+
+int msm_heap_close(msm_heap_t *heap) {
+    if(heap == NULL || heap->persistent != MY_HEAP_FILE) return -1;
+    persist_header *header = header_of(heap);
+    size_t file_size = header->file_size;
+    int fd = (int)header->fd;
+    int error = 0;
+
+    /* D'abord tout le tas, puis seulement le drapeau : clean ne peut pas arriver sur le disque avant les listes */
+    if(msync(header, file_size, MS_SYNC) == -1) error = -1;
+    header->clean = 1;
+    header->fd = -1;
+    if(msync(header, MY_PAGE_SIZE, MS_SYNC) == -1) error = -1;
+    if(error == -1) logfile("*** ERROR *** : msync of persistent heap @ %p failed\n",(void*)heap);
+
+    logfile("[+] Persistent heap @ %p closed with %zu busy chunks\n",(void*)heap,heap->number_of_elements_allocated);
+    if(munmap(header, file_size) == -1) error = -1;
+    if(close(fd) == -1) error = -1;
+    return error;
+}
+
+/* La racine se lit et s'écrit sans le verrou du tas, d'un thread ou d'un processus à l'autre : accès atomiques.
+   L'écriture publie l'objet construit avant elle, la lecture le voit en entier. */
+void *msm_heap_root(msm_heap_t *heap) {
+    if(heap == NULL || !heap->persistent) return NULL;
+    return (void*)(size_t)__atomic_load_n(&header_of(heap)->root, __ATOMIC_ACQUIRE);
+}
+
+int msm_heap_set_root(msm_heap_t *heap, void *root) {
+    if(heap == NULL || !heap->persistent) return -1;
+    __atomic_store_n(&header_of(heap)->root, (uint64_t)(size_t)root, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Tas partagé */
+
+/* À appeler avec shared_heaps_lock */
+static int shared_slot(topchunk *heap)
+{
+    for(int i = 0; i < SHARED_HEAPS; i++)
+    {
+        if(shared_heaps[i].heap == heap) return i;
+    }
+    return -1;
+}
+
+static topchunk *register_shared(topchunk *heap, int fd)
+{
+    pthread_mutex_lock(&shared_heaps_lock);
+    int slot = shared_slot(NULL);
+    if(slot == -1)
+    {
+        pthread_mutex_unlock(&shared_heaps_lock);
+        logfile("*** ERROR *** : more than %d shared heaps in this process\n",SHARED_HEAPS);
+        munmap(header_of(heap), header_of(heap)->file_size);
+        close(fd);
+        return NULL;
+    }
+    shared_heaps[slot].heap = heap;
+    shared_heaps[slot].fd = fd;
+    pthread_mutex_unlock(&shared_heaps_lock);
+    return heap;
+}
+
+msm_heap_t *msm_shm_create(const char *name, size_t size) {
+    if(size == 0) return NULL;
+    msm_conf_init();
+    int fd = memfd_create((name != NULL) ? name : "my_secmalloc", MFD_CLOEXEC);
+    if(fd == -1)
+    {
+        logfile("*** ERROR *** : memfd_create for a shared heap failed\n");
+        return NULL;
+    }
+    topchunk *heap = create_mapping(fd, size, MY_HEAP_SHARED);
+    if(heap == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    /* Robuste : la mort d'un processus qui tient le verrou ne bloque pas les autres (EOWNERDEAD) */
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header_of(heap)->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+    header_of(heap)->fd = -1;
+    return register_shared(heap, fd);
+}
+
+int msm_shm_fd(msm_heap_t *heap) {
+    if(heap == NULL) return -1;
+    pthread_mutex_lock(&shared_heaps_lock);
+    int slot = shared_slot(heap);
+    int fd = (slot != -1) ? shared_heaps[slot].fd : -1;
+    pthread_mutex_unlock(&shared_heaps_lock);
+    return fd;
+}
+
+msm_heap_t *msm_shm_attach(int fd) {
+    msm_conf_init();
+    /* Le descripteur reçu reste à l'appelant : le tas garde le sien */
+    int own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if(own == -1) return NULL;
+    topchunk *heap = map_existing(own, MY_HEAP_SHARED);
+    if(heap == NULL)
+    {
+        close(own);
+        return NULL;
+    }
+    logfile("[+] Shared heap attached @ %p\n",(void*)heap);
+    return register_shared(heap, own);
+}
+
+int msm_shm_detach(msm_heap_t *heap) {
+    if(heap == NULL || heap->persistent != MY_HEAP_SHARED) return -1;
+    /* Le slot est libéré avant de démapper : un autre thread ne trouve plus le tas, ni son descripteur */
+    pthread_mutex_lock(&shared_heaps_lock);
+    int slot = shared_slot(heap);
+    int fd = (slot != -1) ? shared_heaps[slot].fd : -1;
+    if(slot != -1) shared_heaps[slot].heap = NULL;
+    pthread_mutex_unlock(&shared_heaps_lock);
+    if(slot == -1) return -1;
+    int error = 0;
+    if(munmap(header_of(heap), header_of(heap)->file_size) == -1) error = -1;
+    if(close(fd) == -1) error = -1;
+    return error;
+}
+
+void msm_shm_lock(topchunk *heap) {
+    persist_header *header = header_of(heap);
+    int error = pthread_mutex_lock(&header->lock);
+    if(error == EOWNERDEAD)
+    {
+        /* Son propriétaire est mort au milieu d'une opération : les listes sont peut-être à moitié modifiées */
+        logfile("*** ERROR *** : a process died holding the lock of shared heap @ %p, rebuilding it\n",(void*)heap);
+        msm_heap_reattach(heap, 1);
+        pthread_mutex_consistent(&header->lock);
+    }
+    else if(error != 0)
+    {
+        /* Sans le verrou, modifier le tas corromprait les autres processus */
+        logfile("*** ERROR *** : lock of shared heap @ %p failed\n",(void*)heap);
+        exit(1);
+    }
+}
+
+void msm_shm_unlock(topchunk *heap) {
+    pthread_mutex_unlock(&header_of(heap)->lock);
+}
+
+/* Handle d'un chunk : son offset depuis le début du segment, le même dans tous les processus (0 : aucun) */
+uint64_t msm_shm_handle(msm_heap_t *heap, const void *ptr) {
+    if(heap == NULL || heap->persistent != MY_HEAP_SHARED || ptr == NULL) return MSM_SHM_NULL;
+    size_t address = (size_t)ptr;
+    if(address < (size_t)heap->data_pool || address >= (size_t)heap->data_pool + heap->total_size_data) return MSM_SHM_NULL;
+    return (uint64_t)(address - (size_t)header_of(heap));
+}
+
+/* Un handle qui ne tombe pas dans data_pool (reçu d'un processus non fiable ?) ne donne pas de pointeur */
+void *msm_shm_pointer(msm_heap_t *heap, uint64_t handle) {
+    if(heap == NULL || heap->persistent != MY_HEAP_SHARED || handle == MSM_SHM_NULL) return NULL;
+    size_t data_offset = (size_t)heap->data_pool - (size_t)header_of(heap);
+    if(handle < data_offset || handle - data_offset >= heap->total_size_data) return NULL;
+    return (void*)((size_t)header_of(heap) + (size_t)handle);
+}
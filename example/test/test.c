@@ -1,8 +1,16 @@
 #include <criterion/criterion.h>
 #include "my_secmalloc.private.h"  // Inclut les déclarations des fonctions d'allocateur
+#include "my_secmalloc_dump.h"
 #include <sys/mman.h>
 #include <string.h>
 #include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sys/resource.h>
 
 /* Directives de préprocesseur pour l'alignement sur 8 octets / 4 octets selon l'architecture */
 #if defined(__x86_64__) || defined(_M_X64) || defined(__aarch64__) || defined(__ppc64__)
@@ -849,3 +857,1356 @@ Test(my_realloc, optimization_when_next_block_is_free) {
     // Libérer le bloc réalloué
     my_free(new_ptr);
 }
+
+// Test pour vérifier qu'un gros bloc agrandi par mremap conserve ses données
+Test(my_realloc, mapped_chunk_grows_without_copy) {
+    size_t size = 1024 * 1024;
+    char *ptr = my_malloc(size);
+    cr_assert_not_null(ptr, "Large allocation should succeed");
+    for (size_t i = 0; i < size; i++) {
+        ptr[i] = (char)(i % 251);
+    }
+
+    char *new_ptr = my_realloc(ptr, 64 * size);
+    cr_assert_not_null(new_ptr, "Growing a mapped chunk should succeed");
+    for (size_t i = 0; i < size; i++) {
+        cr_assert(new_ptr[i] == (char)(i % 251), "Content should be preserved after mremap at %zu", i);
+    }
+    for (size_t i = size; i < 64 * size; i += 4096) {
+        cr_assert(new_ptr[i] == 0, "Memory gained by mremap should be zero at %zu", i);
+    }
+    new_ptr[64 * size - 1] = 'x';
+
+    char *small_ptr = my_realloc(new_ptr, 100);
+    cr_assert_not_null(small_ptr, "Shrinking a mapped chunk to a small one should succeed");
+    for (size_t i = 0; i < 100; i++) {
+        cr_assert(small_ptr[i] == (char)(i % 251), "Content should be preserved when shrinking at %zu", i);
+    }
+    my_free(small_ptr);
+}
+
+// Test pour vérifier que la page de garde d'un gros bloc est replacée après un mremap
+Test(my_realloc, mapped_chunk_guard_page_after_remap, .signal = SIGSEGV) {
+    size_t size = 256 * 1024;
+    char *ptr = my_realloc(my_malloc(size), 4 * size);
+    cr_assert_not_null(ptr, "Growing a mapped chunk should succeed");
+    /* 4 Mo + canary arrondis à la page : la page de garde commence juste après */
+    ptr[4 * size + 4096] = 'x';
+}
+
+// Test pour vérifier que calloc remet à zéro un chunk réutilisé qui a été sali
+Test(my_calloc, reused_dirty_chunk_is_zeroed) {
+    char *ptr = my_malloc(200);
+    cr_assert_not_null(ptr, "Allocation should succeed");
+    memset(ptr, 0xAA, 200);
+    my_free(ptr);
+
+    char *zeroed = my_calloc(25, 8);
+    cr_assert_eq(zeroed, ptr, "Calloc should reuse the freed chunk");
+    for (size_t i = 0; i < 200; i++) {
+        cr_assert(zeroed[i] == 0, "Reused chunk should be zeroed at %zu", i);
+    }
+    my_free(zeroed);
+}
+
+// Test pour vérifier qu'un chunk purgé au free est réutilisé à zéro par calloc
+Test(my_calloc, purged_chunk_is_zero) {
+    size_t size = 100 * 1024;
+    char *ptr = my_malloc(size);
+    cr_assert_not_null(ptr, "Allocation should succeed");
+    memset(ptr, 0x55, size);
+    my_free(ptr);
+
+    char *zeroed = my_calloc(1, size / 2);
+    cr_assert_eq(zeroed, ptr, "Calloc should reuse the purged chunk");
+    char *rest = my_calloc(1, size / 4);
+    cr_assert_not_null(rest, "Calloc in the remaining fragment should succeed");
+    for (size_t i = 0; i < size / 2; i++) {
+        cr_assert(zeroed[i] == 0, "Purged chunk should be zero at %zu", i);
+    }
+    for (size_t i = 0; i < size / 4; i++) {
+        cr_assert(rest[i] == 0, "Remaining fragment should be zero at %zu", i);
+    }
+    my_free(zeroed);
+    my_free(rest);
+}
+
+// Test pour vérifier que calloc refuse une taille qui déborde
+Test(my_calloc, overflowing_size) {
+    char *ptr = my_calloc((size_t)1 << 33, (size_t)1 << 33);
+    cr_assert_null(ptr, "Calloc should fail when nmemb * size overflows");
+}
+
+// Test pour vérifier qu'un rétrécissement se fait sur place et libère le surplus
+Test(my_realloc, shrink_in_place) {
+    char *ptr = my_malloc(400);
+    cr_assert_not_null(ptr, "Allocation should succeed");
+    strcpy(ptr, "shrink");
+
+    char *new_ptr = my_realloc(ptr, 100);
+    cr_assert_eq(new_ptr, ptr, "Shrinking should keep the same pointer");
+    cr_assert_str_eq(new_ptr, "shrink", "Content should be preserved");
+
+    char *other = my_malloc(200);
+    cr_assert_eq(other, ptr + 104 + 8, "The released tail should be reused");
+    my_free(other);
+    my_free(new_ptr);
+}
+
+// Test pour vérifier l'alignement des allocations alignées, dans data_pool comme dans un mapping à part
+Test(my_aligned_alloc, alignments) {
+    size_t alignments[] = { 16, 64, 256, 4096, 65536 };
+    size_t sizes[] = { 1, 100, 1000, 200 * 1024 };
+    for (size_t a = 0; a < sizeof(alignments) / sizeof(alignments[0]); a++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            char *ptr = my_aligned_alloc(alignments[a], sizes[s]);
+            cr_assert_not_null(ptr, "Aligned allocation should succeed");
+            cr_assert(((size_t)ptr & (alignments[a] - 1)) == 0, "Pointer should be aligned on %zu", alignments[a]);
+            memset(ptr, 'a', sizes[s]);
+            my_free_aligned_sized(ptr, alignments[a], sizes[s]);
+        }
+    }
+    cr_assert_null(my_aligned_alloc(24, 100), "A non power of two alignment should be refused");
+}
+
+// Test pour vérifier qu'un free dimensionné libère bien le chunk, dans data_pool comme dans un mapping à part
+Test(my_free_sized, releases_chunk) {
+    char *ptr = my_malloc(100);
+    char *big = my_malloc(1024 * 1024);
+    cr_assert_not_null(ptr, "Allocation should succeed");
+    cr_assert_not_null(big, "Large allocation should succeed");
+    my_free_sized(ptr, 100);
+    my_free_sized(big, 1024 * 1024);
+
+    char *again = my_malloc(100);
+    cr_assert_eq(again, ptr, "The chunk freed with its size should be reused");
+    my_free(again);
+}
+
+#if MSM_HARDENING >= 1
+// Test pour vérifier qu'une taille erronée donnée à free_sized est détectée
+Test(my_free_sized, size_mismatch_detected, .exit_code = 1) {
+    char *ptr = my_malloc(100);
+    cr_assert_not_null(ptr, "Allocation should succeed");
+    my_free_sized(ptr, 40);
+}
+
+// Test pour vérifier qu'un débordement sur le canary est détecté par free_sized
+Test(my_free_sized, overflow_detected, .exit_code = 1) {
+    char *ptr = my_malloc(100);
+    cr_assert_not_null(ptr, "Allocation should succeed");
+    memset(ptr, 'A', 112);
+    my_free_sized(ptr, 100);
+}
+#endif
+
+// Test pour vérifier qu'un lot de chunks est alloué d'un seul tenant, puis libéré et réutilisé
+Test(msm_batch, malloc_and_free_batch) {
+    void *ptrs[200];
+    size_t n = msm_malloc_batch(48, 200, ptrs);
+    cr_assert_eq(n, (size_t)200, "The whole batch should be allocated");
+    for (size_t i = 0; i < n; i++) {
+        cr_assert_not_null(ptrs[i], "Chunk %zu should not be NULL", i);
+        if (i > 0) {
+            cr_assert_eq((char *)ptrs[i], (char *)ptrs[i - 1] + 48 + 8, "Chunks should form a contiguous run");
+        }
+        memset(ptrs[i], (int)i, 48);
+    }
+    for (size_t i = 0; i < n; i++) {
+        cr_assert(((unsigned char *)ptrs[i])[47] == (unsigned char)i, "Chunk %zu should keep its content", i);
+    }
+
+    msm_free_batch(ptrs, n);
+    char *again = my_malloc(48);
+    cr_assert_not_null(again, "Allocation after a batch free should succeed");
+    my_free(again);
+
+    n = msm_malloc_batch(48, 100, ptrs);
+    cr_assert_eq(n, (size_t)100, "A second batch should be allocated");
+    msm_free_batch(ptrs, n);
+}
+
+// Test pour vérifier un lot de gros blocs, servis chacun par un mapping
+Test(msm_batch, mapped_batch) {
+    void *ptrs[4];
+    size_t n = msm_malloc_batch(256 * 1024, 4, ptrs);
+    cr_assert_eq(n, (size_t)4, "The whole batch should be allocated");
+    for (size_t i = 0; i < n; i++) {
+        memset(ptrs[i], 'a', 256 * 1024);
+    }
+    msm_free_batch(ptrs, n);
+}
+
+// Test pour vérifier qu'un lot dont les metadata ne peuvent pas être réservées n'est pas alloué du tout
+Test(msm_batch, metadata_reservation_refused) {
+    size_t n = (size_t)1 << 22;
+    void **ptrs = mmap(NULL, n * sizeof(void*), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    cr_assert_neq(ptrs, MAP_FAILED, "The pointer array should be mapped");
+    void *kept = my_malloc(48);
+    size_t allocated = topchunk_pool->number_of_elements_allocated;
+    size_t used = topchunk_pool->current_size_data;
+
+    /* Espace d'adresses plafonné juste au-dessus de sa taille actuelle : meta_pool ne peut plus grandir */
+    unsigned long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    cr_assert_eq(fscanf(statm, "%lu", &pages), 1, "The process size should be readable");
+    fclose(statm);
+    struct rlimit previous, limit;
+    getrlimit(RLIMIT_AS, &previous);
+    limit.rlim_cur = pages * MY_PAGE_SIZE + 16 * 1024 * 1024;
+    limit.rlim_max = previous.rlim_max;
+    cr_assert_eq(setrlimit(RLIMIT_AS, &limit), 0, "The address space limit should be set");
+    size_t got = msm_malloc_batch(16, n, ptrs);
+    setrlimit(RLIMIT_AS, &previous);
+
+    cr_assert_eq(got, (size_t)0, "No chunk should be allocated without room for their metadata");
+    cr_assert_null(ptrs[0], "The output array should not be written");
+    cr_assert_eq(topchunk_pool->number_of_elements_allocated, allocated, "No chunk should be linked");
+    cr_assert_eq(topchunk_pool->current_size_data, used, "No data should be taken from the pool");
+
+    cr_assert_eq(msm_malloc_batch(16, 100, ptrs), (size_t)100, "A smaller batch should still be allocated");
+    msm_free_batch(ptrs, 100);
+    my_free(kept);
+    munmap(ptrs, n * sizeof(void*));
+}
+
+// Test pour vérifier qu'un lot dont le run ne peut pas être pris dans data_pool n'est pas alloué du tout
+Test(msm_batch, data_growth_refused) {
+    cr_assert_eq(msm_conf_parse("data_pool_size:64k"), (size_t)0, "data_pool_size should be accepted");
+    void *ptrs[4096];
+    memset(ptrs, 0, sizeof(ptrs));
+    void *kept = my_malloc(48);
+    /* Une page posée juste après data_pool : il ne peut plus grandir */
+    char *end = (char *)topchunk_pool->data_pool + topchunk_pool->total_size_data;
+    void *blocker = mmap(end, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    cr_assert_eq(blocker, (void *)end, "The page after data_pool should be free");
+    size_t allocated = topchunk_pool->number_of_elements_allocated;
+    size_t used = topchunk_pool->current_size_data;
+
+    cr_assert_eq(msm_malloc_batch(48, 4096, ptrs), (size_t)0, "No chunk should be allocated without room for the run");
+    cr_assert_null(ptrs[0], "The output array should not be written");
+    cr_assert_eq(topchunk_pool->number_of_elements_allocated, allocated, "No chunk should be linked");
+    cr_assert_eq(topchunk_pool->current_size_data, used, "No data should be taken from the pool");
+
+    munmap(blocker, 4096);
+    cr_assert_eq(msm_malloc_batch(48, 4096, ptrs), (size_t)4096, "The batch should be allocated once data_pool can grow");
+    msm_free_batch(ptrs, 4096);
+    my_free(kept);
+}
+
+// Test pour vérifier que MSM_CONF règle le seuil des gros blocs, l'alignement et la taille des pools
+Test(msm_conf, tunables_applied) {
+    cr_assert_eq(msm_conf_parse("data_pool_size:64k,meta_pool_size:8k,mapped_threshold:16k,alignment:16,growth:50"), (size_t)0, "All pairs should be accepted");
+    cr_assert_eq(msm_config.data_pool_size, (size_t)64 * 1024, "data_pool_size should be applied");
+    cr_assert_eq(msm_config.mapped_threshold, (size_t)16 * 1024, "mapped_threshold should be applied");
+
+    char *small = my_malloc(24);
+    char *other = my_malloc(24);
+    cr_assert(((size_t)small & 15) == 0 && ((size_t)other & 15) == 0, "Chunks should be aligned on 16 bytes");
+    cr_assert_eq(topchunk_pool->total_size_data, (size_t)64 * 1024, "data_pool should start at the configured size");
+
+    char *big = my_malloc(20 * 1024);
+    cr_assert_eq(topchunk_pool->number_of_elements_mapped, (size_t)1, "20 KiB should be above the configured threshold");
+    for (int i = 0; i < 100; i++) {
+        cr_assert_not_null(my_malloc(1024), "Allocation %d should succeed while data_pool grows", i);
+    }
+    my_free(big);
+}
+
+// Test pour vérifier que les paires invalides de MSM_CONF sont rejetées sans changer les réglages
+Test(msm_conf, invalid_pairs_rejected) {
+    size_t alignment = msm_config.alignment;
+    cr_assert_eq(msm_conf_parse("alignment:24,unknown:1,mapped_threshold,growth:12x"), (size_t)4, "Every bad pair should be rejected");
+    cr_assert_eq(msm_config.alignment, alignment, "A rejected alignment should not be applied");
+}
+
+// Test pour vérifier que les pools en huge pages sont alignés et grandissent par tranches de 2 Mo
+Test(msm_conf, hugepage_pools) {
+    size_t huge = 2 * 1024 * 1024;
+    cr_assert_eq(msm_conf_parse("hugepages:1,data_pool_size:64k"), (size_t)0, "hugepages should be accepted");
+    cr_assert_eq(msm_conf_parse("hugepages:2"), (size_t)1, "hugepages is a boolean");
+
+    char *first = my_malloc(100);
+    cr_assert_not_null(first, "Allocation should succeed");
+    cr_assert_eq((size_t)topchunk_pool & (huge - 1), (size_t)0, "Metadata pool should be 2 MiB aligned");
+    cr_assert_eq(topchunk_pool->total_size_data, huge, "data_pool should be rounded up to a huge page");
+
+    for (int i = 0; i < 40; i++) {
+        cr_assert_not_null(my_malloc(100 * 1024), "Allocation %d should succeed", i);
+    }
+    cr_assert_eq(topchunk_pool->total_size_data % huge, (size_t)0, "data_pool should grow by huge pages");
+    my_free(first);
+}
+
+// Test pour vérifier les statistiques par nœud NUMA (au moins un nœud, même sans NUMA)
+Test(numa_arenas, node_stats) {
+    msm_node_stats stats;
+    size_t nodes = msm_numa_nodes();
+    cr_assert(nodes >= 1, "There should be at least one node");
+    cr_assert_eq(msm_numa_node_stats(nodes, &stats), -1, "A node past the last one should be rejected");
+
+    void *small = my_malloc(100);
+    void *big = my_malloc(1024 * 1024);
+    size_t arenas = 0, chunks = 0, mapped = 0;
+    for (size_t node = 0; node < nodes; node++) {
+        cr_assert_eq(msm_numa_node_stats(node, &stats), 0, "Node %zu should have stats", node);
+        arenas += stats.arenas;
+        chunks += stats.allocated_chunks;
+        mapped += stats.mapped_chunks;
+    }
+    cr_assert(arenas >= 1, "The first allocation should create an arena");
+    cr_assert_eq(chunks, (size_t)1, "The small chunk should be counted");
+    cr_assert_eq(mapped, (size_t)1, "The big block should be counted");
+    my_free(small);
+    my_free(big);
+}
+
+typedef struct thread_allocation {
+    void *chunk;
+    topchunk *arena;
+} thread_allocation;
+
+static void *allocate_in_thread(void *arg) {
+    thread_allocation *allocation = arg;
+    allocation->chunk = my_malloc(100);
+    allocation->arena = topchunk_pool;
+    return NULL;
+}
+
+// Test pour vérifier qu'un autre thread prend une autre arène et que ses chunks se libèrent depuis n'importe quel thread
+Test(numa_arenas, arena_per_thread) {
+    cr_assert_eq(msm_conf_parse("narenas:2"), (size_t)0, "narenas should be accepted");
+    char *main_chunk = my_malloc(100);
+    topchunk *main_arena = topchunk_pool;
+
+    pthread_t thread;
+    thread_allocation allocation = { NULL, NULL };
+    pthread_create(&thread, NULL, allocate_in_thread, &allocation);
+    pthread_join(thread, NULL);
+    cr_assert_not_null(allocation.chunk, "Allocation in the second thread should succeed");
+    cr_assert_neq(allocation.arena, main_arena, "The second thread should use its own arena");
+    cr_assert_eq(topchunk_pool, main_arena, "The second thread should not change the arena selected by the main thread");
+
+    msm_node_stats stats;
+    cr_assert_eq(msm_numa_node_stats(0, &stats), 0, "Node 0 should have stats");
+    cr_assert_eq(stats.arenas, (size_t)2, "Both arenas should prefer node 0 on a single node machine");
+
+    my_free(allocation.chunk);
+    cr_assert_eq(allocation.arena->number_of_elements_allocated, (size_t)0, "The chunk should be freed in its own arena");
+    cr_assert_eq(main_arena->number_of_elements_allocated, (size_t)1, "The main arena should keep its chunk");
+    void *other = my_malloc(100);
+    cr_assert_eq(topchunk_pool, main_arena, "The main thread should stay on its own arena");
+    my_free(other);
+    my_free(main_chunk);
+}
+
+/* Chaque thread alloue et libère en boucle, et libère aussi les chunks d'un autre thread */
+#define STRESS_THREADS 4
+#define STRESS_ROUNDS 2000
+static void *volatile stress_exchange[STRESS_THREADS];
+
+static void *stress_arena(void *arg) {
+    size_t index = (size_t)arg;
+    unsigned seed = (unsigned)index;
+    for(size_t round = 0; round < STRESS_ROUNDS; round++)
+    {
+        char *chunk = my_malloc(16 + rand_r(&seed) % 512);
+        if(chunk == NULL) return (void*)1;
+        memset(chunk, (int)index, 16);
+        void *previous = __atomic_exchange_n(&stress_exchange[(index + 1) % STRESS_THREADS], chunk, __ATOMIC_ACQ_REL);
+        my_free(previous);
+        chunk = my_realloc(my_malloc(32), 64 + rand_r(&seed) % 256);
+        my_free(chunk);
+    }
+    return NULL;
+}
+
+// Test pour vérifier que plusieurs threads peuvent se partager une arène sans la corrompre
+Test(numa_arenas, shared_arena_stress) {
+    cr_assert_eq(msm_conf_parse("narenas:1"), (size_t)0, "narenas should be accepted");
+    pthread_t threads[STRESS_THREADS];
+    for(size_t i = 0; i < STRESS_THREADS; i++) pthread_create(&threads[i], NULL, stress_arena, (void*)i);
+    for(size_t i = 0; i < STRESS_THREADS; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        cr_assert_null(result, "Every allocation should succeed");
+    }
+    for(size_t i = 0; i < STRESS_THREADS; i++) my_free(stress_exchange[i]);
+
+    topchunk *arena = msm_arena(0);
+    cr_assert_eq(arena->number_of_elements_allocated, (size_t)0, "Every chunk should be back in the arena");
+    cr_assert_eq(msm_heap_check(arena), (size_t)0, "The arena lists should still be consistent");
+}
+
+// Test pour vérifier que le plus petit chunk libre suffisant est choisi, et non le premier de la liste
+Test(best_fit, smallest_adequate_chunk) {
+    char *large = my_malloc(8000);
+    my_malloc(16);
+    char *small = my_malloc(2000);
+    my_malloc(16);
+    char *medium = my_malloc(4000);
+    my_malloc(16);
+    my_free(large);
+    my_free(small);
+    my_free(medium);
+
+    cr_assert_eq(my_malloc(1500), small, "The 2000 bytes chunk is the best fit");
+    cr_assert_eq(my_malloc(3000), medium, "The 4000 bytes chunk is the best fit");
+    cr_assert_eq(my_malloc(8000), large, "The 8000 bytes chunk should still be whole");
+}
+
+// Test pour vérifier qu'à taille égale, le chunk libre de plus basse adresse est choisi
+Test(best_fit, lowest_address_first) {
+    char *low = my_malloc(2000);
+    my_malloc(16);
+    char *high = my_malloc(2000);
+    my_malloc(16);
+    cr_assert((size_t)low < (size_t)high, "Chunks should be carved upwards");
+    my_free(low);
+    my_free(high);
+
+    cr_assert_eq(my_malloc(2000), low, "The lowest chunk should be reused first");
+    cr_assert_eq(my_malloc(2000), high, "Then the next one");
+}
+
+// Test pour vérifier que les doubles free restent détectés pour un gros chunk libre
+Test(best_fit, double_free_in_tree, .exit_code = 1) {
+    char *ptr = my_malloc(5000);
+    my_malloc(16);
+    my_free(ptr);
+    my_free(ptr);
+}
+
+// Test pour vérifier que chercher un gros chunk libre par son adresse laisse l'arbre intact
+Test(best_fit, find_by_address_keeps_tree) {
+    char *grown = my_malloc(1200);
+    char *next = my_malloc(3000);
+    char *chunks[64];
+    for(int i = 0; i < 64; i++) {
+        chunks[i] = my_malloc(1024 + 16 * (size_t)((i * 37) % 64));
+        my_malloc(16);
+    }
+    my_free(next);
+    for(int i = 0; i < 64; i++) my_free(chunks[i]);
+
+    cr_assert_eq(my_realloc(grown, 3800), grown, "The chunk should grow into the free chunk that follows it");
+    for(int i = 0; i < 64; i++) {
+        cr_assert_eq(my_malloc(1024 + 16 * (size_t)((i * 37) % 64)), chunks[i], "Every free chunk should still be in the tree");
+    }
+    cr_assert_eq(topchunk_pool->number_of_elements_freed, (size_t)1, "Only the rest of the grown chunk should be free");
+}
+
+// Test pour vérifier qu'un instantané du tas décrit chaque chunk sans copier les data
+Test(msm_dump, snapshot_describes_chunks) {
+    char *busy = my_malloc(100);
+    char *freed = my_malloc(3000);
+    my_malloc(16);
+    char *big = my_malloc(1024 * 1024);
+    my_free(freed);
+
+    char path[] = "/tmp/msm_dump_XXXXXX";
+    int fd = mkstemp(path);
+    cr_assert_neq(fd, -1, "Temporary file should be created");
+    close(fd);
+    cr_assert_eq(msm_dump_heap(path), 0, "Dump should succeed");
+
+    FILE *snapshot = fopen(path, "rb");
+    cr_assert_not_null(snapshot, "Snapshot should be readable");
+    msm_dump_header header;
+    msm_dump_arena arena;
+    cr_assert_eq(fread(&header, sizeof(header), 1, snapshot), (size_t)1, "Header should be present");
+    cr_assert_str_eq(header.magic, MSM_DUMP_MAGIC, "Magic should match");
+    cr_assert_eq(header.arenas, (uint64_t)1, "One arena on this machine");
+    cr_assert_eq(fread(&arena, sizeof(arena), 1, snapshot), (size_t)1, "Arena should be present");
+    cr_assert_eq(arena.chunks, (uint64_t)4, "Every chunk should be described");
+
+    int seen_busy = 0, seen_free = 0, seen_mapped = 0;
+    for (uint64_t i = 0; i < arena.chunks; i++) {
+        msm_dump_chunk chunk;
+        cr_assert_eq(fread(&chunk, sizeof(chunk), 1, snapshot), (size_t)1, "Chunk %lu should be present", (unsigned long)i);
+        if (chunk.state == MY_IS_BUSY && chunk.offset == (uint64_t)(busy - (char*)arena.data_pool)) seen_busy = 1;
+        if (chunk.state == MY_IS_FREE && chunk.offset == (uint64_t)(freed - (char*)arena.data_pool)) seen_free = 1;
+        if (chunk.state == MY_IS_MAPPED && chunk.offset == (uint64_t)(size_t)big) seen_mapped = 1;
+    }
+    cr_assert(seen_busy && seen_free && seen_mapped, "Busy, free and mapped chunks should all be in the snapshot");
+    cr_assert_eq(fgetc(snapshot), EOF, "Nothing should follow the chunks");
+    fclose(snapshot);
+    unlink(path);
+}
+
+#if MSM_HARDENING >= 3
+// Test pour vérifier qu'un chunk échantillonné finit contre sa page de garde et se libère normalement
+Test(guarded, sampled_chunk_layout) {
+    cr_assert_eq(msm_conf_parse("sample_rate:1"), (size_t)0, "sample_rate should be accepted");
+    char *ptr = my_malloc(100);
+    cr_assert(msm_guarded_owns(ptr), "With a rate of 1 every small allocation should be sampled");
+    cr_assert_eq(((size_t)ptr + 104) % MY_PAGE_SIZE, (size_t)0, "The chunk should end on the guard page");
+    memset(ptr, 0x41, 100);
+
+    char *copy = my_realloc(ptr, 200);
+    cr_assert(msm_guarded_owns(copy), "The new chunk should be sampled too");
+    cr_assert(copy[0] == 0x41 && copy[99] == 0x41, "Realloc should keep the data");
+    my_free(copy);
+
+    char *zeroed = my_calloc(1, 64);
+    for (int i = 0; i < 64; i++) {
+        cr_assert(zeroed[i] == 0, "Sampled calloc should be zero at %d", i);
+    }
+    my_free(zeroed);
+}
+
+// Test pour vérifier qu'un débordement d'un chunk échantillonné fait une faute immédiate
+Test(guarded, overflow_faults, .signal = SIGSEGV) {
+    msm_conf_parse("sample_rate:1");
+    char *ptr = my_malloc(104);
+    ptr[104] = 'A';
+}
+
+// Test pour vérifier qu'un chunk échantillonné libéré reste inaccessible
+Test(guarded, use_after_free_faults, .signal = SIGSEGV) {
+    msm_conf_parse("sample_rate:1");
+    volatile char *ptr = my_malloc(32);
+    my_free((void*)ptr);
+    ptr[0] = 'A';
+}
+
+// Test pour vérifier que le double free d'un chunk échantillonné est détecté
+Test(guarded, double_free_detected, .exit_code = 1) {
+    msm_conf_parse("sample_rate:1");
+    char *ptr = my_malloc(32);
+    my_free(ptr);
+    my_free(ptr);
+}
+
+/* Une des allocations suivantes (au plus allocations) est-elle servie par le pool gardé ? */
+static int sampled_within(int allocations) {
+    for(int i = 0; i < allocations; i++)
+    {
+        void *ptr = my_malloc(32);
+        int sampled = msm_guarded_owns(ptr);
+        my_free(ptr);
+        if(sampled) return 1;
+    }
+    return 0;
+}
+
+// Test pour vérifier qu'un sample_rate et un hardening écrits par msm_ctl prennent effet dans un thread qui a déjà alloué
+Test(guarded, sample_rate_set_at_runtime) {
+    cr_assert(!sampled_within(100), "Sampling should be off by default");
+    size_t value = 1;
+    cr_assert_eq(msm_ctl("opt.sample_rate", NULL, NULL, &value, sizeof(value)), 0, "opt.sample_rate should be writable");
+    cr_assert(sampled_within(2 * 4096), "Sampling should start without restarting the thread");
+
+    value = 2;
+    cr_assert_eq(msm_ctl("opt.hardening", NULL, NULL, &value, sizeof(value)), 0, "opt.hardening should be writable");
+    cr_assert(!sampled_within(100), "Sampling should stop below hardening level 3");
+    value = 3;
+    cr_assert_eq(msm_ctl("opt.hardening", NULL, NULL, &value, sizeof(value)), 0, "opt.hardening should be writable");
+    cr_assert(sampled_within(2 * 4096), "Sampling should resume at hardening level 3");
+}
+#endif
+
+#if MSM_HARDENING >= 1
+// Test pour vérifier qu'un débordement sur le canary est détecté par un free ordinaire
+Test(hardening, canary_overflow_detected, .exit_code = 1) {
+    char *ptr = my_malloc(64);
+    cr_assert_not_null(ptr, "Allocation should succeed");
+    memset(ptr, 'A', 72);
+    my_free(ptr);
+}
+#endif
+
+#if MSM_HARDENING >= 2
+// Test pour vérifier qu'un chunk en quarantaine n'est pas resservi tout de suite
+Test(hardening, quarantined_chunk_not_reused) {
+    cr_assert_eq(msm_conf_parse("quarantine:64k"), (size_t)0, "quarantine should be accepted");
+    char *ptr = my_malloc(200);
+    my_malloc(16);
+    my_free(ptr);
+    char *again = my_malloc(200);
+    cr_assert_neq(again, ptr, "A quarantined chunk should not be handed out again");
+    my_free(again);
+}
+
+// Test pour vérifier que la quarantaine rend les chunks une fois son budget dépassé
+Test(hardening, quarantine_evicts_oldest) {
+    cr_assert_eq(msm_conf_parse("quarantine:1k"), (size_t)0, "quarantine should be accepted");
+    char *first = my_malloc(512);
+    char *ptrs[8];
+    for (int i = 0; i < 8; i++) {
+        ptrs[i] = my_malloc(512);
+    }
+    my_free(first);
+    for (int i = 0; i < 8; i++) {
+        my_free(ptrs[i]);
+    }
+    char *again = my_malloc(512);
+    cr_assert(again >= first && again <= ptrs[7], "Chunks past the budget should be reused");
+    cr_assert_neq(again, ptrs[7], "The latest chunk should still be quarantined");
+    my_free(again);
+}
+
+// Test pour vérifier que couper la quarantaine avec msm_ctl rend tout de suite les chunks qui y attendaient
+Test(hardening, quarantine_drained_when_lowered) {
+    cr_assert_eq(msm_conf_parse("quarantine:64k"), (size_t)0, "quarantine should be accepted");
+    char *ptr = my_malloc(200);
+    my_malloc(16);
+    my_free(ptr);
+    cr_assert_neq(topchunk_pool->quarantine_bytes, (size_t)0, "The chunk should wait in quarantine");
+
+    size_t off = 0;
+    cr_assert_eq(msm_ctl("opt.quarantine", NULL, NULL, &off, sizeof(off)), 0, "opt.quarantine should be writable");
+    cr_assert_eq(topchunk_pool->quarantine_bytes, (size_t)0, "The quarantine should be drained");
+    cr_assert_null(topchunk_pool->quarantine_head, "No chunk should be left in quarantine");
+    char *again = my_malloc(200);
+    cr_assert_eq(again, ptr, "The drained chunk should be reusable");
+    my_free(again);
+}
+
+// Test pour vérifier que le double free d'un chunk en quarantaine est détecté
+Test(hardening, double_free_in_quarantine, .exit_code = 1) {
+    msm_conf_parse("quarantine:64k");
+    char *ptr = my_malloc(200);
+    my_free(ptr);
+    my_free(ptr);
+}
+#endif
+
+// Test pour vérifier qu'un tas privé sert ses chunks depuis ses propres pools, sans toucher à l'arène
+Test(msm_heap, private_pools) {
+    char *global = my_malloc(100);
+    size_t arena_chunks = topchunk_pool->number_of_elements_allocated;
+    msm_heap_t *heap = msm_heap_create();
+    cr_assert_not_null(heap, "Heap creation should succeed");
+    cr_assert_neq(heap->canary_secret[0], topchunk_pool->canary_secret[0], "Each heap should have its own canary secret");
+
+    char *ptr = msm_heap_malloc(heap, 100);
+    char *big = msm_heap_malloc(heap, 1024 * 1024);
+    cr_assert(ptr >= (char*)heap->data_pool && ptr < (char*)heap->data_pool + heap->total_size_data, "The chunk should be in the heap data_pool");
+    cr_assert_not_null(big, "Large allocation should succeed");
+    cr_assert_eq(topchunk_pool->number_of_elements_allocated, arena_chunks, "The arena should not see the heap chunks");
+
+    msm_heap_stats stats;
+    cr_assert_eq(msm_heap_get_stats(heap, &stats), 0, "Stats should be readable");
+    cr_assert_eq(stats.allocated_chunks, (size_t)1, "One chunk in data_pool");
+    cr_assert_eq(stats.mapped_chunks, (size_t)1, "One mapped chunk");
+
+    memset(ptr, 'a', 100);
+    ptr = msm_heap_realloc(heap, ptr, 3000);
+    cr_assert(ptr[0] == 'a' && ptr[99] == 'a', "Realloc should keep the data");
+    msm_heap_free(heap, ptr);
+    msm_heap_free(heap, big);
+    msm_heap_get_stats(heap, &stats);
+    cr_assert_eq(stats.allocated_chunks, (size_t)0, "Every chunk should be freed");
+    cr_assert_eq(stats.mapped_chunks, (size_t)0, "The mapped chunk should be unmapped");
+    msm_heap_destroy(heap);
+
+    char *again = my_malloc(100);
+    cr_assert(again < (char*)heap || again >= (char*)heap + MY_PAGE_SIZE, "Malloc should be back on the arena");
+    my_free(again);
+    my_free(global);
+}
+
+// Test pour vérifier que la destruction d'un tas rend aussi les chunks jamais libérés
+Test(msm_heap, destroy_releases_everything, .signal = SIGSEGV) {
+    msm_heap_t *heap = msm_heap_create();
+    volatile char *ptr = msm_heap_malloc(heap, 64);
+    for (int i = 0; i < 1000; i++) {
+        msm_heap_malloc(heap, 48);
+    }
+    msm_heap_malloc(heap, 1024 * 1024);
+    msm_heap_destroy(heap);
+    ptr[0] = 'A';
+}
+
+// Test pour vérifier que le double free dans un tas privé est détecté
+Test(msm_heap, double_free_detected, .exit_code = 1) {
+    msm_heap_t *heap = msm_heap_create();
+    char *ptr = msm_heap_malloc(heap, 64);
+    msm_heap_malloc(heap, 16);
+    msm_heap_free(heap, ptr);
+    msm_heap_free(heap, ptr);
+}
+
+static void *use_private_heap(void *arg) {
+    msm_heap_t *heap = arg;
+    for(int round = 0; round < 2000; round++)
+    {
+        void *ptr = msm_heap_malloc(heap, 16 + round % 200);
+        if(ptr == NULL) return (void*)1;
+        msm_heap_free(heap, ptr);
+    }
+    return NULL;
+}
+
+// Test pour vérifier qu'un tas privé servi à des threads ne détourne pas le malloc d'un autre thread
+Test(msm_heap, private_heap_across_threads) {
+    msm_heap_t *heap = msm_heap_create();
+    void *kept = msm_heap_malloc(heap, 64);
+    msm_heap_stats stats;
+    msm_heap_get_stats(heap, &stats);
+    char *start = heap->data_pool;
+    char *end = start + stats.data_bytes;
+
+    pthread_t threads[2];
+    for(int i = 0; i < 2; i++) pthread_create(&threads[i], NULL, use_private_heap, heap);
+    for(int round = 0; round < 2000; round++)
+    {
+        char *ptr = my_malloc(100);
+        cr_assert(ptr < start || ptr >= end, "malloc should never land in a private heap used by another thread");
+        my_free(ptr);
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        cr_assert_null(result, "Every private allocation should succeed");
+    }
+
+    msm_heap_get_stats(heap, &stats);
+    cr_assert_eq(stats.allocated_chunks, (size_t)1, "Only the kept chunk should be left in the private heap");
+    msm_heap_free(heap, kept);
+    msm_heap_destroy(heap);
+}
+
+static int heap_destroyed = 0;
+
+static void *destroy_heap(void *arg) {
+    msm_heap_destroy(arg);
+    __atomic_store_n(&heap_destroyed, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Test pour vérifier que la destruction d'un tas attend la fin d'un appel qui tient son verrou
+Test(msm_heap, destroy_waits_for_lock) {
+    msm_heap_t *heap = msm_heap_create();
+    msm_heap_malloc(heap, 64);
+    msm_heap_lock(heap);
+    pthread_t thread;
+    pthread_create(&thread, NULL, destroy_heap, heap);
+    usleep(50 * 1000);
+    cr_assert(!__atomic_load_n(&heap_destroyed, __ATOMIC_ACQUIRE), "The heap should not be destroyed under a running call");
+    msm_heap_unlock(heap);
+    pthread_join(thread, NULL);
+    cr_assert(__atomic_load_n(&heap_destroyed, __ATOMIC_ACQUIRE), "The heap should be destroyed once its lock is free");
+
+    char *ptr = my_malloc(100);
+    cr_assert_not_null(ptr, "malloc should still work after the destruction");
+    my_free(ptr);
+}
+
+// Test pour vérifier qu'une arène à pointeur sert des chunks contigus et alignés, et revient en arrière
+Test(msm_bump, alloc_mark_rewind_reset) {
+    msm_arena_t *arena = msm_arena_create(4096, 0);
+    cr_assert_not_null(arena, "Arena creation should succeed");
+    char *a = msm_arena_alloc(arena, 10, 0);
+    char *b = msm_arena_alloc(arena, 10, 0);
+    cr_assert_eq(b, a + 16, "Chunks should follow each other");
+    char *aligned = msm_arena_alloc(arena, 32, 64);
+    cr_assert_eq((size_t)aligned % 64, (size_t)0, "Chunk should be aligned on 64");
+    cr_assert_null(msm_arena_alloc(arena, 8, 24), "A non power of two alignment should be refused");
+
+    msm_arena_mark_t mark = msm_arena_mark(arena);
+    char *c = msm_arena_alloc(arena, 100, 0);
+    char *big = msm_arena_alloc(arena, 10000, 0);
+    cr_assert_not_null(big, "Allocation larger than a block should succeed");
+    memset(big, 'x', 10000);
+    msm_arena_rewind(arena, mark);
+    cr_assert_eq(msm_arena_alloc(arena, 100, 0), c, "Rewind should hand out the same address again");
+
+    for (int i = 0; i < 1000; i++) {
+        cr_assert_not_null(msm_arena_alloc(arena, 48, 0), "Allocation %d should succeed", i);
+    }
+    msm_arena_reset(arena);
+    cr_assert_eq(msm_arena_alloc(arena, 10, 0), a, "Reset should go back to the first chunk");
+    msm_arena_destroy(arena);
+}
+
+#if MSM_HARDENING >= 1
+// Test pour vérifier qu'un débordement à la fin d'un bloc est détecté au reset
+Test(msm_bump, block_canary_detects_overflow, .exit_code = 1) {
+    msm_arena_t *arena = msm_arena_create(256, MSM_ARENA_CANARY);
+    char *ptr = msm_arena_alloc(arena, 256, 0);
+    memset(ptr, 'A', 264);
+    msm_arena_reset(arena);
+}
+#endif
+
+// Test pour vérifier que chaque partition a son propre tas, et que free retrouve la partition d'un chunk
+Test(msm_partition, separate_pools) {
+    char *plain = my_malloc(64);
+    char *object = msm_malloc_partition(64, MSM_PARTITION_OBJECT);
+    char *buffer = msm_malloc_partition(64, MSM_PARTITION_BUFFER);
+    cr_assert_not_null(object, "Partition allocation should succeed");
+    cr_assert_null(msm_malloc_partition(64, MSM_PARTITIONS), "An unknown partition should be refused");
+
+    topchunk *objects = msm_partition(MSM_PARTITION_OBJECT);
+    topchunk *buffers = msm_partition(MSM_PARTITION_BUFFER);
+    cr_assert(object >= (char*)objects->data_pool && object < (char*)objects->data_pool + objects->total_size_data, "Object should be in its partition");
+    cr_assert(buffer >= (char*)buffers->data_pool && buffer < (char*)buffers->data_pool + buffers->total_size_data, "Buffer should be in its partition");
+    cr_assert(plain < (char*)objects->data_pool || plain >= (char*)objects->data_pool + objects->total_size_data, "Malloc should not use a partition");
+
+    memset(buffer, 'b', 64);
+    buffer = my_realloc(buffer, 5000);
+    cr_assert(buffer >= (char*)buffers->data_pool && buffer < (char*)buffers->data_pool + buffers->total_size_data, "Realloc should stay in the partition");
+    cr_assert(buffer[0] == 'b' && buffer[63] == 'b', "Realloc should keep the data");
+
+    my_free(object);
+    my_free(buffer);
+    cr_assert_eq(objects->number_of_elements_allocated, (size_t)0, "The object should be freed in its partition");
+    cr_assert_eq(buffers->number_of_elements_allocated, (size_t)0, "The buffer should be freed in its partition");
+    my_free(plain);
+}
+
+// Test pour vérifier que le double free d'un chunk de partition est détecté
+Test(msm_partition, double_free_detected, .exit_code = 1) {
+    char *object = msm_malloc_partition(64, MSM_PARTITION_OBJECT);
+    msm_malloc_partition(16, MSM_PARTITION_OBJECT);
+    my_free(object);
+    my_free(object);
+}
+
+/* Page de data encore présente en mémoire (non rendue au noyau) */
+static int page_resident(void *address) {
+    unsigned char vec;
+    void *page = (void*)((size_t)address & ~(MY_PAGE_SIZE - 1));
+    cr_assert_eq(mincore(page, MY_PAGE_SIZE, &vec), 0, "mincore should succeed");
+    return vec & 1;
+}
+
+// Test pour vérifier que sans decay, les pages d'un gros chunk libéré sont rendues tout de suite
+Test(decay, immediate_purge_without_decay) {
+    char *ptr = my_malloc(100000);
+    my_malloc(16);
+    memset(ptr, 'a', 100000);
+    my_free(ptr);
+    cr_assert(!page_resident(ptr + 50000), "The pages should be purged on free");
+}
+
+// Test pour vérifier qu'avec decay_ms, les pages restent jusqu'à ce que le délai soit écoulé
+Test(decay, pages_purged_after_delay) {
+    cr_assert_eq(msm_conf_parse("decay_ms:64"), (size_t)0, "decay_ms should be accepted");
+    char *ptr = my_malloc(100000);
+    my_malloc(16);
+    memset(ptr, 'a', 100000);
+    my_free(ptr);
+    cr_assert(page_resident(ptr + 50000), "The pages should stay dirty right after free");
+
+    usleep(150 * 1000);
+    msm_decay();
+    cr_assert(!page_resident(ptr + 50000), "The pages should be purged once decay_ms has elapsed");
+
+    char *again = my_calloc(1, 100000);
+    cr_assert_eq(again, ptr, "The purged chunk should be reused");
+    cr_assert(again[50000] == 0, "The purged chunk should be zero");
+}
+
+// Test pour vérifier la lecture et l'écriture des réglages par msm_ctl
+Test(msm_ctl, opt_read_write) {
+    size_t value = 0;
+    size_t length = sizeof(value);
+    cr_assert_eq(msm_ctl("opt.decay_ms", &value, &length, NULL, 0), 0, "opt.decay_ms should be readable");
+    cr_assert_eq(value, (size_t)0, "decay_ms should be off by default");
+
+    size_t decay = 500;
+    cr_assert_eq(msm_ctl("opt.decay_ms", &value, &length, &decay, sizeof(decay)), 0, "opt.decay_ms should be writable");
+    cr_assert_eq(value, (size_t)0, "The previous value should be returned");
+    cr_assert_eq(msm_config.decay_ms, (size_t)500, "The new value should be applied");
+
+    size_t alignment = 64;
+    cr_assert_eq(msm_ctl("opt.alignment", NULL, NULL, &alignment, sizeof(alignment)), EPERM, "opt.alignment should be read only");
+    cr_assert_eq(msm_ctl("opt.decay_ms", NULL, NULL, &decay, 4), EINVAL, "A wrong length should be refused");
+    cr_assert_eq(msm_ctl("opt.nothing", &value, &length, NULL, 0), ENOENT, "An unknown name should be refused");
+    cr_assert_eq(msm_ctl("thread.tcache.flush", NULL, NULL, NULL, 0), 0, "thread.tcache.flush should be accepted");
+}
+
+// Test pour vérifier que les statistiques viennent de l'instantané pris à l'écriture de epoch
+Test(msm_ctl, stats_follow_epoch) {
+    char *big = my_malloc(1024 * 1024);
+    uint64_t epoch = 1;
+    size_t mapped = 0, chunks = 0;
+    size_t length = sizeof(size_t);
+    cr_assert_eq(msm_ctl("epoch", NULL, NULL, &epoch, sizeof(epoch)), 0, "epoch should be writable");
+    cr_assert_eq(msm_ctl("stats.arenas.0.mapped", &mapped, &length, NULL, 0), 0, "stats.arenas.0.mapped should be readable");
+    cr_assert_geq(mapped, (size_t)1024 * 1024, "The mapped chunk should be counted");
+
+    my_free(big);
+    cr_assert_eq(msm_ctl("stats.mapped_chunks", &chunks, &length, NULL, 0), 0, "stats.mapped_chunks should be readable");
+    cr_assert_eq(chunks, (size_t)1, "The snapshot should not change before the next epoch");
+    msm_ctl("epoch", NULL, NULL, &epoch, sizeof(epoch));
+    msm_ctl("stats.mapped_chunks", &chunks, &length, NULL, 0);
+    cr_assert_eq(chunks, (size_t)0, "The new snapshot should see the free");
+    cr_assert_eq(msm_ctl("stats.arenas.9.mapped", &mapped, &length, NULL, 0), ENOENT, "An unknown arena should be refused");
+}
+
+#define CTL_THREADS 4
+#define CTL_ROUNDS 2000
+
+static void *refresh_stats(void *arg)
+{
+    (void)arg;
+    uint64_t epoch = 1;
+    size_t chunks, length = sizeof(size_t);
+    for(size_t round = 0; round < CTL_ROUNDS; round++)
+    {
+        void *chunk = my_malloc(32);
+        if(msm_ctl("epoch", NULL, NULL, &epoch, sizeof(epoch)) != 0) return (void*)1;
+        if(msm_ctl("stats.allocated_chunks", &chunks, &length, NULL, 0) != 0) return (void*)1;
+        my_free(chunk);
+    }
+    return NULL;
+}
+
+// Test pour vérifier que des threads qui prennent et lisent l'instantané en même temps ne perdent aucune écriture de epoch
+Test(msm_ctl, snapshot_across_threads) {
+    uint64_t before = 0, after = 0;
+    size_t length = sizeof(uint64_t);
+    msm_ctl("epoch", &before, &length, NULL, 0);
+    pthread_t threads[CTL_THREADS];
+    for(size_t i = 0; i < CTL_THREADS; i++) pthread_create(&threads[i], NULL, refresh_stats, NULL);
+    for(size_t i = 0; i < CTL_THREADS; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        cr_assert_null(result, "Every msm_ctl call should succeed");
+    }
+    msm_ctl("epoch", &after, &length, NULL, 0);
+    cr_assert_eq(after - before, (uint64_t)CTL_THREADS * CTL_ROUNDS, "Every epoch write should take a snapshot");
+}
+
+// Test pour vérifier que arena.N.purge rend les pages laissées sales par le decay, et que heap.check parcourt les chunks
+Test(msm_ctl, purge_and_check) {
+    msm_conf_parse("decay_ms:60000");
+    char *ptr = my_malloc(100000);
+    my_malloc(16);
+    memset(ptr, 'a', 100000);
+    my_free(ptr);
+
+    size_t purged = 0, checked = 0;
+    size_t length = sizeof(size_t);
+    cr_assert_eq(msm_ctl("arena.0.purge", &purged, &length, NULL, 0), 0, "arena.0.purge should succeed");
+    cr_assert_geq(purged, (size_t)64 * 1024, "The dirty pages should be purged");
+    cr_assert_eq(msm_ctl("heap.check", &checked, &length, NULL, 0), 0, "heap.check should succeed");
+    cr_assert_eq(checked, (size_t)1, "The busy chunk should be checked");
+}
+
+#if MSM_HARDENING >= 1
+// Test pour vérifier que heap.check détecte un canary écrasé sans attendre le free
+Test(msm_ctl, check_detects_overflow, .exit_code = 1) {
+    char *ptr = my_malloc(64);
+    memset(ptr, 'A', 72);
+    msm_ctl("heap.check", NULL, NULL, NULL, 0);
+}
+#endif
+
+// Test pour vérifier que chaque opération est comptée dans l'histogramme du chemin qu'elle a pris
+Test(latency, paths_are_counted) {
+    size_t on = 1;
+    cr_assert_eq(msm_ctl("opt.latency", NULL, NULL, &on, sizeof(on)), 0, "opt.latency should be writable");
+    char *first = my_malloc(200);
+    my_malloc(16);
+    my_free(first);
+    char *again = my_malloc(200);
+    cr_assert_eq(again, first, "The freed chunk should be reused");
+    char *big = my_malloc(1024 * 1024);
+    my_free(big);
+    my_free(NULL);
+
+    msm_latency_hist hist;
+    cr_assert_eq(msm_latency_get(MSM_OP_MALLOC, MSM_PATH_TOP, &hist), 0, "The histogram should be readable");
+    cr_assert_eq(hist.count, (uint64_t)2, "Two chunks should be carved from the top");
+    cr_assert_geq(hist.max, hist.total / hist.count, "The slowest operation should be at least the mean");
+    msm_latency_get(MSM_OP_MALLOC, MSM_PATH_REUSE, &hist);
+    cr_assert_eq(hist.count, (uint64_t)1, "The reused chunk should be counted");
+    msm_latency_get(MSM_OP_MALLOC, MSM_PATH_MAPPED, &hist);
+    cr_assert_eq(hist.count, (uint64_t)1, "The mapped chunk should be counted");
+    msm_latency_get(MSM_OP_FREE, MSM_PATH_RELEASE, &hist);
+    cr_assert_eq(hist.count, (uint64_t)1, "free(NULL) should not be counted");
+    msm_latency_get(MSM_OP_FREE, MSM_PATH_MAPPED, &hist);
+    cr_assert_eq(hist.count, (uint64_t)1, "The munmap should be counted");
+    cr_assert_eq(msm_latency_get(MSM_OPS, 0, &hist), -1, "An unknown operation should be refused");
+}
+
+// Test pour vérifier les quantiles (à 12,5 % près) et la fusion de deux histogrammes
+Test(latency, quantile_and_merge) {
+    for(int i = 0; i < 999; i++) msm_latency_record(MSM_OP_CALLOC, MSM_PATH_GROW, 100);
+    msm_latency_record(MSM_OP_CALLOC, MSM_PATH_GROW, 1000000);
+
+    msm_latency_hist hist;
+    msm_latency_get(MSM_OP_CALLOC, MSM_PATH_GROW, &hist);
+    cr_assert_eq(hist.count, (uint64_t)1000, "Every record should be counted");
+    uint64_t p999 = msm_latency_quantile(&hist, 0.999);
+    cr_assert(p999 >= 100 && p999 <= 112, "The p999 should be in the bucket of 100 cycles, got %lu", (unsigned long)p999);
+    cr_assert_eq(msm_latency_quantile(&hist, 1.0), (uint64_t)1000000, "The p100 should be the max");
+
+    msm_latency_hist merged = hist;
+    msm_latency_merge(&merged, &hist);
+    cr_assert_eq(merged.count, (uint64_t)2000, "Merging should add the counts");
+    cr_assert_eq(merged.max, (uint64_t)1000000, "Merging should keep the max");
+    cr_assert_eq(msm_latency_quantile(&merged, 0.5), msm_latency_quantile(&hist, 0.5), "Merging a histogram with itself should keep its quantiles");
+}
+
+// Test pour vérifier la lecture des histogrammes par msm_ctl
+Test(latency, read_through_ctl) {
+    msm_conf_set("latency", 1);
+    my_free(my_realloc(my_malloc(32), 4096));
+
+    uint64_t epoch = 1, count = 0, p99 = 0;
+    size_t length = sizeof(uint64_t);
+    msm_ctl("epoch", NULL, NULL, &epoch, sizeof(epoch));
+    cr_assert_eq(msm_ctl("stats.latency.realloc.moved.count", &count, &length, NULL, 0), 0, "The count should be readable");
+    cr_assert_eq(count, (uint64_t)1, "The moving realloc should be counted");
+    cr_assert_eq(msm_ctl("stats.latency.realloc.moved.p99", &p99, &length, NULL, 0), 0, "The p99 should be readable");
+    cr_assert_gt(p99, (uint64_t)0, "A realloc should take some cycles");
+    cr_assert_eq(msm_ctl("stats.latency.malloc.nowhere.count", &count, &length, NULL, 0), ENOENT, "An unknown path should be refused");
+}
+
+// Chemin d'un fichier de tas persistant propre au processus de test
+static void persist_path(char *path, size_t length)
+{
+    snprintf(path, length, "/tmp/msm_persist_%d.heap", (int)getpid());
+    unlink(path);
+}
+
+// Test pour vérifier qu'un tas persistant fermé proprement est rouvert avec ses objets, à la même adresse
+Test(persistent_heap, reopen_after_close) {
+    char path[64];
+    persist_path(path, sizeof(path));
+    int state = -1;
+    msm_heap_t *heap = msm_heap_open(path, 1024 * 1024, &state);
+    cr_assert_not_null(heap, "The persistent heap should be created");
+    cr_assert_eq(state, MSM_HEAP_CREATED, "An empty file should create a heap");
+
+    char **list = msm_heap_malloc(heap, 2 * sizeof(char*));
+    list[0] = msm_heap_malloc(heap, 32);
+    list[1] = msm_heap_malloc(heap, 200000);
+    strcpy(list[0], "warm restart");
+    memset(list[1], 'x', 200000);
+    cr_assert(list[1] >= (char*)heap && list[1] < (char*)heap + 4 * 1024 * 1024, "A big chunk should stay in the file");
+    msm_heap_set_root(heap, list);
+    cr_assert_eq(msm_heap_close(heap), 0, "The heap should be closed cleanly");
+
+    msm_heap_t *again = msm_heap_open(path, 0, &state);
+    cr_assert_eq(again, heap, "The heap should be mapped at the same address");
+    cr_assert_eq(state, MSM_HEAP_REOPENED, "A cleanly closed heap should not need a recovery");
+    list = msm_heap_root(again);
+    cr_assert_str_eq(list[0], "warm restart", "The objects should survive");
+    cr_assert_eq(list[1][199999], 'x', "The big chunk should survive");
+    msm_heap_free(again, list[0]);
+    cr_assert_eq(msm_heap_malloc(again, 32), list[0], "The free lists should work after a reopen");
+    cr_assert_null(msm_heap_open(path, 0, &state), "An open heap should be locked");
+    msm_heap_close(again);
+    unlink(path);
+}
+
+// Test pour vérifier la reconstruction des listes d'un tas persistant laissé ouvert par un processus qui s'est arrêté
+Test(persistent_heap, recovery_after_crash) {
+    char path[64];
+    persist_path(path, sizeof(path));
+    pid_t child = fork();
+    if(child == 0)
+    {
+        msm_heap_t *heap = msm_heap_open(path, 1024 * 1024, NULL);
+        char **objects = msm_heap_malloc(heap, 3 * sizeof(char*));
+        for(int i = 0; i < 3; i++)
+        {
+            objects[i] = msm_heap_malloc(heap, 2000);
+            memset(objects[i], 'a' + i, 2000);
+        }
+        msm_heap_free(heap, objects[1]);
+        objects[1] = NULL;
+        msm_heap_set_root(heap, objects);
+        _exit(0);
+    }
+    waitpid(child, NULL, 0);
+
+    int state = -1;
+    msm_heap_t *heap = msm_heap_open(path, 0, &state);
+    cr_assert_not_null(heap, "The heap should be reopened");
+    cr_assert_eq(state, MSM_HEAP_RECOVERED, "A heap left open should be recovered");
+    msm_heap_stats stats;
+    msm_heap_get_stats(heap, &stats);
+    cr_assert_eq(stats.allocated_chunks, (size_t)3, "The busy chunks should be found again");
+    cr_assert_eq(stats.free_chunks, (size_t)1, "The free chunk should be found again");
+
+    char **objects = msm_heap_root(heap);
+    cr_assert_eq(objects[0][1999], 'a', "The first object should survive");
+    cr_assert_eq(objects[2][0], 'c', "The last object should survive");
+    char *reused = msm_heap_malloc(heap, 2000);
+    cr_assert(reused > objects[0] && reused < objects[2], "The recovered free chunk should be reused");
+    msm_heap_free(heap, objects[2]);
+    msm_heap_close(heap);
+    unlink(path);
+}
+
+// Test pour vérifier qu'un tas persistant plein refuse l'allocation au lieu de grandir, et qu'un fichier étranger est refusé
+Test(persistent_heap, fixed_size_and_bad_file) {
+    char path[64];
+    persist_path(path, sizeof(path));
+    msm_heap_t *heap = msm_heap_open(path, 64 * 1024, NULL);
+    cr_assert_not_null(msm_heap_malloc(heap, 32 * 1024), "A chunk that fits should be allocated");
+    cr_assert_null(msm_heap_malloc(heap, 64 * 1024), "The data_pool of a persistent heap should not grow");
+    msm_heap_destroy(heap);
+    unlink(path);
+
+    int fd = open(path, O_WRONLY | O_CREAT, 0600);
+    cr_assert_eq(write(fd, "not a heap at all, not a heap at all, not a heap at all, not a heap at all, ", 76), 76, "The foreign file should be written");
+    close(fd);
+    cr_assert_null(msm_heap_open(path, 0, NULL), "A file that is not a heap should be refused");
+    unlink(path);
+}
+
+Test(shared_heap, handle_across_fork) {
+    msm_heap_t *heap = msm_shm_create("msm-test", 256 * 1024);
+    cr_assert_not_null(heap, "The shared heap should be created");
+    int fd = msm_shm_fd(heap);
+    cr_assert_neq(fd, -1, "The shared heap should have a memfd");
+    int channel[2];
+    cr_assert_eq(pipe(channel), 0, "The pipe should be created");
+
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        /* Le fils s'attache de nouveau par une copie du descripteur, comme un processus qui l'aurait reçu (SCM_RIGHTS) */
+        int received = dup(fd);
+        msm_shm_detach(heap);
+        msm_heap_t *attached = msm_shm_attach(received);
+        if(attached != heap) _exit(2);
+        char *message = msm_heap_malloc(attached, 64);
+        if(message == NULL) _exit(3);
+        strcpy(message, "hello from the child");
+        uint64_t handle = msm_shm_handle(attached, message);
+        if(write(channel[1], &handle, sizeof(handle)) != (ssize_t)sizeof(handle)) _exit(4);
+        _exit(0);
+    }
+    close(channel[1]);
+    uint64_t handle = MSM_SHM_NULL;
+    cr_assert_eq(read(channel[0], &handle, sizeof(handle)), (ssize_t)sizeof(handle), "The handle should be received");
+    int status = 0;
+    waitpid(pid, &status, 0);
+    cr_assert_eq(WEXITSTATUS(status), 0, "The child should allocate in the shared heap");
+
+    char *message = msm_shm_pointer(heap, handle);
+    cr_assert_not_null(message, "The handle should resolve in the parent");
+    cr_assert_str_eq(message, "hello from the child", "The parent should read what the child wrote");
+    cr_assert_null(msm_shm_pointer(heap, 8), "A handle outside the data_pool should be refused");
+    msm_heap_free(heap, message);
+    close(channel[0]);
+    cr_assert_eq(msm_shm_detach(heap), 0, "The shared heap should be detached");
+}
+
+Test(shared_heap, lock_owner_dies) {
+    msm_heap_t *heap = msm_shm_create("msm-test", 64 * 1024);
+    cr_assert_not_null(heap, "The shared heap should be created");
+    void *kept = msm_heap_malloc(heap, 128);
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        /* Meurt en tenant le verrou, comme un processus tué au milieu d'un malloc */
+        msm_shm_lock(heap);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    void *ptr = msm_heap_malloc(heap, 128);
+    cr_assert_not_null(ptr, "The lock of a dead owner should be recovered");
+    cr_assert_neq(ptr, kept, "A chunk still busy should survive the rebuild");
+    msm_heap_free(heap, ptr);
+    msm_heap_free(heap, kept);
+    msm_shm_detach(heap);
+}
+
+static void *create_shared_heaps(void *arg) {
+    (void)arg;
+    for(int round = 0; round < 50; round++)
+    {
+        msm_heap_t *heap = msm_shm_create("msm-test", 16 * 1024);
+        if(heap == NULL) return (void*)1;
+        int fd = msm_shm_fd(heap);
+        /* Le descripteur du slot doit être celui de ce tas : son memfd a la taille du mapping */
+        if(fd == -1 || lseek(fd, 0, SEEK_END) == 0) return (void*)1;
+        msm_heap_set_root(heap, heap);
+        if(msm_heap_root(heap) != heap) return (void*)1;
+        if(msm_shm_detach(heap) != 0) return (void*)1;
+    }
+    return NULL;
+}
+
+// Test pour vérifier que des threads peuvent créer et détacher des tas partagés en même temps
+Test(shared_heap, table_across_threads) {
+    pthread_t threads[8];
+    for(int i = 0; i < 8; i++) pthread_create(&threads[i], NULL, create_shared_heaps, NULL);
+    for(int i = 0; i < 8; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        cr_assert_null(result, "Every shared heap should get its own slot");
+    }
+}
+
+// Test pour vérifier que msm_reserve agrandit data_pool d'avance et en faute les pages
+Test(reserve, steady_state_does_not_grow) {
+    cr_assert_eq(msm_reserve(1024 * 1024, MSM_RESERVE_POPULATE), 0, "The reservation should succeed");
+    size_t total = topchunk_pool->total_size_data;
+    size_t start = ((size_t)topchunk_pool->data_pool + topchunk_pool->current_size_data + 4095) & ~(size_t)4095;
+    size_t pages = (1024 * 1024 - 4096) / 4096;
+    unsigned char resident[256];
+    cr_assert_eq(mincore((void*)start, pages * 4096, resident), 0, "mincore should succeed");
+    for (size_t i = 0; i < pages; i++) {
+        cr_assert(resident[i] & 1, "Reserved page %zu should be resident", i);
+    }
+    for (int i = 0; i < 100; i++) {
+        cr_assert_not_null(my_malloc(8 * 1024), "Allocation %d should succeed", i);
+    }
+    cr_assert_eq(topchunk_pool->total_size_data, total, "data_pool should not grow within the reservation");
+}
+
+// Test pour vérifier qu'un data_pool qui ne peut pas grandir sur place est signalé, sans arrêter le processus
+Test(reserve, refused_growth_reported) {
+    cr_assert_eq(msm_conf_parse("data_pool_size:64k,mapped_threshold:1m"), (size_t)0, "The conf should be accepted");
+    char *kept = my_malloc(48);
+    cr_assert_not_null(kept, "Allocation should succeed");
+    /* Une page posée juste après data_pool : il ne peut plus grandir sans être déplacé */
+    char *end = (char *)topchunk_pool->data_pool + topchunk_pool->total_size_data;
+    void *blocker = mmap(end, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    cr_assert_eq(blocker, (void *)end, "The page after data_pool should be free");
+    size_t total = topchunk_pool->total_size_data;
+    size_t allocated = topchunk_pool->number_of_elements_allocated;
+
+    cr_assert_eq(msm_reserve(1024 * 1024, 0), -1, "A reservation that cannot grow data_pool should fail");
+    cr_assert_null(my_malloc(200 * 1024), "A chunk that cannot grow data_pool should be refused");
+    cr_assert_eq(topchunk_pool->total_size_data, total, "data_pool should keep its size");
+    cr_assert_eq(topchunk_pool->number_of_elements_allocated, allocated, "No chunk should be linked");
+
+    munmap(blocker, 4096);
+    char *big = my_malloc(200 * 1024);
+    cr_assert_not_null(big, "data_pool should grow once the page is gone");
+    my_free(big);
+    my_free(kept);
+}
+
+// Test pour vérifier que reserve et prefault de MSM_CONF préparent l'arène avant le premier chunk
+Test(reserve, conf_reserves_at_startup) {
+    cr_assert_eq(msm_conf_parse("data_pool_size:64k,reserve:2m,prefault:1"), (size_t)0, "reserve and prefault should be accepted");
+    cr_assert_eq(msm_conf_parse("prefault:3"), (size_t)1, "prefault goes from 0 to 2");
+    cr_assert_not_null(my_malloc(100), "Allocation should succeed");
+    cr_assert_geq(topchunk_pool->total_size_data, (size_t)2 * 1024 * 1024, "data_pool should be grown to the reservation at startup");
+    cr_assert_geq(topchunk_pool->total_size_metadata - topchunk_pool->current_size_metadata, (size_t)2 * 1024 * 1024 / 256 * sizeof(metadata), "meta_pool should be grown too");
+}
+
+// Test pour vérifier qu'un gros bloc libéré laisse son mapping au suivant, page de garde réarmée et calloc à zéro
+Test(mapped_cache, reuse_rearms_guard) {
+    cr_assert_eq(msm_conf_parse("mapped_cache:64m"), (size_t)0, "mapped_cache should be accepted");
+    char *first = my_malloc(2 * 1024 * 1024);
+    cr_assert_not_null(first, "The mapped chunk should be allocated");
+    memset(first, 'a', 2 * 1024 * 1024);
+    my_free(first);
+
+    char *second = my_calloc(1, 2 * 1024 * 1024 - 4096);
+    cr_assert_eq(second, first, "The cached mapping should be reused");
+    cr_assert_eq(second[0], 0, "calloc should clear a reused mapping");
+    cr_assert_eq(second[2 * 1024 * 1024 - 4097], 0, "calloc should clear a reused mapping to its end");
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* La page de garde du bloc plus court suit ses data et son canary arrondis à la page */
+        second[2 * 1024 * 1024 + 8] = 'x';
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    cr_assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV, "The guard page should be re-armed on reuse");
+    my_free(second);
+}
+
+// Test pour vérifier que le decay rend au noyau les mappings restés trop longtemps dans le cache
+Test(mapped_cache, evicted_by_decay) {
+    cr_assert_eq(msm_conf_parse("mapped_cache:64m,decay_ms:20"), (size_t)0, "mapped_cache and decay_ms should be accepted");
+    char *chunk = my_malloc(1024 * 1024);
+    my_free(chunk);
+    unsigned char resident[1];
+    cr_assert_eq(mincore(chunk, 4096, resident), 0, "The cached mapping should still be mapped");
+    usleep(60 * 1000);
+    msm_decay();
+    cr_assert_eq(mincore(chunk, 4096, resident), -1, "The decay should unmap the cached mapping");
+}
+
+// Test pour vérifier que chaque indication mène à sa région et que les indications contradictoires sont refusées
+Test(hinted, routed_by_hints) {
+    char *hot = msm_malloc_hinted(64, MSM_HINT_HOT);
+    char *short_lived = msm_malloc_hinted(64, MSM_HINT_SHORT | MSM_HINT_HOT);
+    char *long_lived = msm_malloc_hinted(64, MSM_HINT_LONG);
+    char *cold = msm_malloc_hinted(64, MSM_HINT_LONG | MSM_HINT_COLD);
+    cr_assert_null(msm_malloc_hinted(64, MSM_HINT_SHORT | MSM_HINT_LONG), "SHORT and LONG should be refused together");
+    cr_assert_null(msm_malloc_hinted(64, MSM_HINT_HOT | MSM_HINT_COLD), "HOT and COLD should be refused together");
+
+    topchunk *regions[] = { msm_partition(MSM_PARTITION_SHORT), msm_partition(MSM_PARTITION_LONG), msm_partition(MSM_PARTITION_COLD) };
+    char *chunks[] = { short_lived, long_lived, cold };
+    for (int i = 0; i < 3; i++) {
+        cr_assert_not_null(regions[i], "Region %d should be created", i);
+        cr_assert(chunks[i] >= (char*)regions[i]->data_pool && chunks[i] < (char*)regions[i]->data_pool + regions[i]->total_size_data, "Chunk %d should be in its region", i);
+        cr_assert(hot < (char*)regions[i]->data_pool || hot >= (char*)regions[i]->data_pool + regions[i]->total_size_data, "A hot chunk should stay with malloc");
+    }
+    my_free(hot);
+    my_free(short_lived);
+    my_free(long_lived);
+    my_free(cold);
+}
+
+// Test pour vérifier que la région éphémère se vide et rend ses pages dès que son dernier chunk est libéré
+Test(hinted, short_region_rewinds) {
+    char *first = msm_malloc_hinted(4096, MSM_HINT_SHORT);
+    char *chunks[32];
+    for (int i = 0; i < 32; i++) {
+        chunks[i] = msm_malloc_hinted(8192, MSM_HINT_SHORT);
+        memset(chunks[i], 'c', 8192);
+        cr_assert_not_null(msm_malloc_hinted(256, MSM_HINT_LONG), "Long-lived chunks should be interleaved");
+    }
+    topchunk *region = msm_partition(MSM_PARTITION_SHORT);
+    for (int i = 0; i < 32; i++) {
+        my_free(chunks[i]);
+    }
+    cr_assert_neq(region->current_size_data, (size_t)0, "A live chunk should keep the region");
+
+    my_free(first);
+    cr_assert_eq(region->current_size_data, (size_t)0, "The region should rewind when its last chunk is freed");
+    cr_assert(!page_resident(chunks[16]), "The pages of the region should be purged");
+    char *again = msm_malloc_hinted(64, MSM_HINT_SHORT);
+    cr_assert_eq(again, first, "The next chunk should be carved from the start of the region");
+    cr_assert_eq(again[0], 0, "A rewound region should be zero");
+    my_free(again);
+}
+
+// Test pour vérifier que free d'un chunk de partition ne laisse pas malloc dans la partition
+Test(msm_partition, free_keeps_malloc_heap) {
+    char *plain = my_malloc(64);
+    my_free(msm_malloc_partition(64, MSM_PARTITION_OBJECT));
+    char *next = my_malloc(64);
+    topchunk *objects = msm_partition(MSM_PARTITION_OBJECT);
+    cr_assert(next < (char*)objects->data_pool || next >= (char*)objects->data_pool + objects->total_size_data, "Malloc after a partition free should not use the partition");
+    my_free(plain);
+    cr_assert_eq(objects->number_of_elements_allocated, (size_t)0, "The partition should stay empty");
+    cr_assert_eq(topchunk_pool->number_of_elements_allocated, (size_t)1, "The first chunk should be freed from the malloc heap");
+    my_free(next);
+}
+
+// Test pour vérifier qu'un double free d'un chunk de malloc est encore détecté après un free de partition
+Test(msm_partition, double_free_after_partition_free, .exit_code = 1) {
+    char *plain = my_malloc(64);
+    my_malloc(16);
+    my_free(msm_malloc_partition(64, MSM_PARTITION_BUFFER));
+    my_free(plain);
+    my_free(plain);
+}
+
+// Test pour vérifier que malloc ne va pas dans la région éphémère après le free d'un chunk indiqué, et qu'elle se vide
+Test(hinted, malloc_after_hinted_free) {
+    char *kept = msm_malloc_hinted(64, MSM_HINT_SHORT);
+    my_free(msm_malloc_hinted(64, MSM_HINT_SHORT));
+    char *plain = my_malloc(64);
+    topchunk *region = msm_partition(MSM_PARTITION_SHORT);
+    cr_assert(plain < (char*)region->data_pool || plain >= (char*)region->data_pool + region->total_size_data, "Malloc after a hinted free should not use the short region");
+    my_free(kept);
+    cr_assert_eq(region->current_size_data, (size_t)0, "The short region should still rewind");
+    my_free(plain);
+}
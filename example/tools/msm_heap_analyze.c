@@ -0,0 +1,222 @@
+/* Analyse hors ligne d'un instantané écrit par msm_dump_heap() :
+       ./tools/msm_heap_analyze msm_heap.1234.dump
+   Histogramme de l'espace libre, plus grand run libre, occupation des pages et octets purgeables, par arène. */
+#include "my_secmalloc.private.h"
+#include "my_secmalloc_dump.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SIZE_CLASSES 64
+/* Tranches d'occupation des pages : vide, 1-25 %, 26-50 %, 51-75 %, 76-99 %, pleine */
+#define OCCUPANCY_BUCKETS 6
+
+static const char *occupancy_names[OCCUPANCY_BUCKETS] = { "empty", "1-25%", "26-50%", "51-75%", "76-99%", "full" };
+
+/* Empreinte d'un chunk dans data_pool : un chunk libre (ou en quarantaine) compte déjà son canary, pas un chunk occupé */
+static uint64_t footprint(const msm_dump_chunk *chunk, uint64_t alignment)
+{
+    if(chunk->state != MY_IS_BUSY) return chunk->size;
+    return chunk->size + ((sizeof(size_t) + alignment - 1) & ~(alignment - 1));
+}
+
+static int by_offset(const void *a, const void *b)
+{
+    const msm_dump_chunk *x = a;
+    const msm_dump_chunk *y = b;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+static void analyze_arena(const msm_dump_header *header, const msm_dump_arena *arena, msm_dump_chunk *chunks)
+{
+    uint64_t page = header->page_size;
+    uint64_t busy_chunks = 0, busy_bytes = 0;
+    uint64_t free_chunks = 0, free_bytes = 0;
+    uint64_t mapped_chunks = 0, mapped_bytes = 0;
+    uint64_t quarantined_chunks = 0, quarantined_bytes = 0;
+    uint64_t class_count[SIZE_CLASSES] = {0};
+    uint64_t class_bytes[SIZE_CLASSES] = {0};
+    uint64_t purgeable = 0;
+
+    uint64_t pages = (arena->current_size_data + page - 1) / page;
+    uint64_t *used = calloc(pages ? pages : 1, sizeof(uint64_t));
+    if(used == NULL)
+    {
+        perror("calloc");
+        exit(1);
+    }
+
+    for(uint64_t i = 0; i < arena->chunks; i++)
+    {
+        msm_dump_chunk *chunk = &chunks[i];
+        if(chunk->state == MY_IS_MAPPED)
+        {
+            mapped_chunks++;
+            mapped_bytes += chunk->size;
+            continue;
+        }
+        if(chunk->state == MY_IS_FREE)
+        {
+            free_chunks++;
+            free_bytes += chunk->size;
+            class_count[chunk->size_class % SIZE_CLASSES]++;
+            class_bytes[chunk->size_class % SIZE_CLASSES] += chunk->size;
+            /* Pages entières d'un chunk libre sale : ce que madvise(MADV_DONTNEED) rendrait au noyau */
+            uint64_t start = (chunk->offset + page - 1) & ~(page - 1);
+            uint64_t end = (chunk->offset + chunk->size) & ~(page - 1);
+            if(!chunk->zero && end > start) purgeable += end - start;
+            continue;
+        }
+        if(chunk->state == MY_IS_QUARANTINED)
+        {
+            /* Libéré mais pas encore réutilisable : ses pages restent occupées */
+            quarantined_chunks++;
+            quarantined_bytes += chunk->size;
+        }
+        else
+        {
+            busy_chunks++;
+            busy_bytes += chunk->size;
+        }
+        /* Octets occupés (data + canary) répartis sur les pages touchées */
+        uint64_t start = chunk->offset;
+        uint64_t end = chunk->offset + footprint(chunk, header->alignment);
+        if(end > arena->current_size_data) end = arena->current_size_data;
+        while(start < end)
+        {
+            uint64_t page_end = (start / page + 1) * page;
+            uint64_t stop = (page_end < end) ? page_end : end;
+            used[start / page] += stop - start;
+            start = stop;
+        }
+    }
+
+    /* Plus grand run libre : chunks libres triés par adresse, fusionnés quand ils se touchent */
+    qsort(chunks, arena->chunks, sizeof(msm_dump_chunk), by_offset);
+    uint64_t largest_run = 0, largest_offset = 0;
+    uint64_t run_offset = 0, run_size = 0;
+    for(uint64_t i = 0; i < arena->chunks; i++)
+    {
+        msm_dump_chunk *chunk = &chunks[i];
+        if(chunk->state != MY_IS_FREE) continue;
+        if(run_size != 0 && run_offset + run_size == chunk->offset)
+        {
+            run_size += chunk->size;
+        }
+        else
+        {
+            run_offset = chunk->offset;
+            run_size = chunk->size;
+        }
+        if(run_size > largest_run)
+        {
+            largest_run = run_size;
+            largest_offset = run_offset;
+        }
+    }
+
+    uint64_t occupancy[OCCUPANCY_BUCKETS] = {0};
+    for(uint64_t p = 0; p < pages; p++)
+    {
+        uint64_t in_page = (p == pages - 1 && arena->current_size_data % page) ? arena->current_size_data % page : page;
+        if(used[p] == 0) occupancy[0]++;
+        else if(used[p] >= in_page) occupancy[5]++;
+        else occupancy[1 + (used[p] * 4 - 1) / in_page]++;
+    }
+    free(used);
+
+    printf("=== arena %lu (node %lu) : data_pool @ 0x%lx ===\n", (unsigned long)arena->index, (unsigned long)arena->node, (unsigned long)arena->data_pool);
+    printf("data_pool       : %lu bytes, %lu handed out, %lu never touched\n", (unsigned long)arena->total_size_data,
+           (unsigned long)arena->current_size_data, (unsigned long)(arena->total_size_data - arena->current_size_data));
+    printf("busy chunks     : %lu (%lu bytes)\n", (unsigned long)busy_chunks, (unsigned long)busy_bytes);
+    printf("free chunks     : %lu (%lu bytes)\n", (unsigned long)free_chunks, (unsigned long)free_bytes);
+    printf("mapped chunks   : %lu (%lu bytes)\n", (unsigned long)mapped_chunks, (unsigned long)mapped_bytes);
+    printf("quarantined     : %lu (%lu bytes)\n", (unsigned long)quarantined_chunks, (unsigned long)quarantined_bytes);
+    printf("largest free run: %lu bytes @ offset 0x%lx\n", (unsigned long)largest_run, (unsigned long)largest_offset);
+    printf("purgeable       : %lu bytes\n", (unsigned long)purgeable);
+    printf("fragmentation   : %.1f%%\n", free_bytes ? 100.0 * (double)(free_bytes - largest_run) / (double)free_bytes : 0.0);
+
+    printf("free space by size class:\n");
+    for(int c = 0; c < SIZE_CLASSES; c++)
+    {
+        if(class_count[c] == 0) continue;
+        printf("  [%10lu, %10lu) : %8lu chunks %12lu bytes\n", 1UL << c, (c == 63) ? ~0UL : 1UL << (c + 1),
+               (unsigned long)class_count[c], (unsigned long)class_bytes[c]);
+    }
+
+    printf("page occupancy (%lu pages):\n", (unsigned long)pages);
+    for(int b = 0; b < OCCUPANCY_BUCKETS; b++)
+    {
+        printf("  %-7s : %8lu pages\n", occupancy_names[b], (unsigned long)occupancy[b]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <snapshot>\n", argv[0]);
+        return 2;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if(fd == -1 || fstat(fd, &st) == -1)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    size_t length = (size_t)st.st_size;
+    if(length < sizeof(msm_dump_header))
+    {
+        fprintf(stderr, "%s: truncated snapshot\n", argv[1]);
+        return 1;
+    }
+    /* Copie privée : les chunks d'une arène sont triés sur place */
+    unsigned char *snapshot = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(snapshot == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    msm_dump_header *header = (msm_dump_header*)snapshot;
+    if(memcmp(header->magic, MSM_DUMP_MAGIC, sizeof(MSM_DUMP_MAGIC)) != 0 || header->version != MSM_DUMP_VERSION)
+    {
+        fprintf(stderr, "%s: not a version %d heap snapshot\n", argv[1], MSM_DUMP_VERSION);
+        return 1;
+    }
+    if(header->page_size == 0 || (header->page_size & (header->page_size - 1)) != 0 || header->alignment == 0)
+    {
+        fprintf(stderr, "%s: corrupted header\n", argv[1]);
+        return 1;
+    }
+
+    size_t position = sizeof(msm_dump_header);
+    for(uint64_t a = 0; a < header->arenas; a++)
+    {
+        if(length - position < sizeof(msm_dump_arena))
+        {
+            fprintf(stderr, "%s: truncated snapshot\n", argv[1]);
+            return 1;
+        }
+        msm_dump_arena *arena = (msm_dump_arena*)(snapshot + position);
+        position += sizeof(msm_dump_arena);
+        if(arena->chunks > (length - position) / sizeof(msm_dump_chunk))
+        {
+            fprintf(stderr, "%s: truncated snapshot\n", argv[1]);
+            return 1;
+        }
+        analyze_arena(header, arena, (msm_dump_chunk*)(snapshot + position));
+        position += arena->chunks * sizeof(msm_dump_chunk);
+    }
+
+    munmap(snapshot, length);
+    return 0;
+}
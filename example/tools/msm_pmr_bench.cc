@@ -0,0 +1,120 @@
+/* Banc d'essai des ressources std::pmr de my_secmalloc_pmr.hpp face à std::pmr::unsynchronized_pool_resource :
+       make bench && ./tools/msm_pmr_bench [rounds]
+   Chaque charge est rejouée rounds fois sur chaque ressource ; le temps affiché est la moyenne par allocation. */
+#include "my_secmalloc_pmr.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t ELEMENTS = 20000;
+
+/* Beaucoup de petits nœuds, libérés dans l'ordre inverse de la création */
+std::size_t list_workload(std::pmr::memory_resource *resource)
+{
+    std::pmr::list<std::size_t> list(resource);
+    for(std::size_t i = 0; i < ELEMENTS; i++) list.push_back(i);
+    while(!list.empty()) list.pop_back();
+    return ELEMENTS;
+}
+
+/* Nœuds et tableau de buckets qui grandit, moitié des clés effacées au hasard */
+std::size_t map_workload(std::pmr::memory_resource *resource)
+{
+    std::pmr::unordered_map<std::size_t, std::size_t> map(resource);
+    std::size_t seed = 42;
+    for(std::size_t i = 0; i < ELEMENTS; i++) map[i] = i;
+    for(std::size_t i = 0; i < ELEMENTS / 2; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        map.erase((seed >> 33) % ELEMENTS);
+    }
+    return ELEMENTS;
+}
+
+/* Chaînes de tailles variées (au-delà du small string optimization) dans un vecteur qui grandit */
+std::size_t string_workload(std::pmr::memory_resource *resource)
+{
+    std::pmr::vector<std::pmr::string> strings(resource);
+    for(std::size_t i = 0; i < ELEMENTS / 4; i++)
+    {
+        strings.emplace_back(32 + i % 200, 'x');
+    }
+    return ELEMENTS / 4;
+}
+
+struct workload
+{
+    const char *name;
+    std::size_t (*run)(std::pmr::memory_resource *);
+};
+
+struct resource
+{
+    const char *name;
+    std::pmr::memory_resource *memory;
+    void (*release)(std::pmr::memory_resource *);
+};
+
+double measure(const workload &load, const resource &res, unsigned rounds)
+{
+    std::size_t allocations = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned r = 0; r < rounds; r++)
+    {
+        allocations += load.run(res.memory);
+        if(res.release != nullptr) res.release(res.memory);
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return elapsed / static_cast<double>(allocations);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    unsigned rounds = (argc > 1) ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 20;
+    if(rounds == 0) rounds = 1;
+
+    std::pmr::unsynchronized_pool_resource std_pool;
+    msm::pool_resource msm_pool;
+    msm::heap_resource msm_heap;
+    msm::monotonic_resource msm_monotonic;
+
+    const resource resources[] = {
+        { "std::pmr::unsynchronized_pool_resource", &std_pool, [](std::pmr::memory_resource *m) { static_cast<std::pmr::unsynchronized_pool_resource*>(m)->release(); } },
+        { "msm::pool_resource", &msm_pool, nullptr },
+        { "msm::heap_resource", &msm_heap, nullptr },
+        { "msm::monotonic_resource", &msm_monotonic, [](std::pmr::memory_resource *m) { static_cast<msm::monotonic_resource*>(m)->release(); } },
+    };
+    const workload workloads[] = {
+        { "list", list_workload },
+        { "unordered_map", map_workload },
+        { "strings", string_workload },
+    };
+
+    std::printf("%-40s", "ns per element");
+    for(const workload &load : workloads) std::printf(" %14s", load.name);
+    std::printf("\n");
+    for(const resource &res : resources)
+    {
+        std::printf("%-40s", res.name);
+        for(const workload &load : workloads) std::printf(" %14.1f", measure(load, res, rounds));
+        std::printf("\n");
+    }
+
+    /* Égalité : deux ressources sur le même tas se rendent la mémoire l'une de l'autre, même après un déplacement */
+    msm::heap_resource moved(std::move(msm_heap));
+    msm::heap_resource view(moved.heap());
+    if(!moved.is_equal(view) || msm_heap.is_equal(moved) || !msm_pool.is_equal(*msm::default_pool_resource()))
+    {
+        std::fprintf(stderr, "do_is_equal is inconsistent\n");
+        return 1;
+    }
+    return 0;
+}